@@ -0,0 +1,213 @@
+#include "arena.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGN 16
+
+struct ArenaBlock {
+    ArenaBlock *prev;
+    size_t size;
+    size_t used;
+    // Keeps data aligned to ARENA_ALIGN
+    size_t pad;
+    unsigned char data[];
+};
+
+/* Arena */
+
+/**
+ * @brief Allocates memory from an arena (aligned to 16 bytes)
+ *
+ * @throws Error if the function failed to allocate memory
+ */
+void *arena_alloc(Arena *a, size_t size){
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    ArenaBlock *b = a->head;
+    if (!b || b->size - b->used < size){
+        const size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = (ArenaBlock *)malloc(sizeof(ArenaBlock) + block_size);
+        if (!b){
+            ERROR("Failed to allocate an arena block of %zu bytes", block_size);
+        }
+        b->size = block_size;
+        b->used = 0;
+
+        // Oversized blocks go behind the current one so it keeps being filled
+        if (a->head && size > ARENA_BLOCK_SIZE){
+            b->prev = a->head->prev;
+            a->head->prev = b;
+        } else {
+            b->prev = a->head;
+            a->head = b;
+        }
+    }
+
+    void *res = b->data + b->used;
+    b->used += size;
+    return res;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t len){
+    char *res = (char *)arena_alloc(a, len + 1);
+    memcpy(res, s, len);
+    res[len] = '\0';
+    return res;
+}
+
+/**
+ * @brief Frees everything allocated from an arena, keeping its current block for reuse
+ */
+void arena_reset(Arena *a){
+    if (!a->head){
+        return;
+    }
+
+    ArenaBlock *b = a->head->prev;
+    while (b){
+        ArenaBlock *prev = b->prev;
+        free(b);
+        b = prev;
+    }
+    a->head->prev = NULL;
+    a->head->used = 0;
+}
+
+void arena_free(Arena *a){
+    ArenaBlock *b = a->head;
+    while (b){
+        ArenaBlock *prev = b->prev;
+        free(b);
+        b = prev;
+    }
+    a->head = NULL;
+}
+
+/* String pool */
+
+/*
+ * Every pooled string is preceded by a PoolHeader giving its size class, so that freeing it
+ * does not depend on what has been written into it since. Strings too big for any class
+ * are malloced with a PoolLarge in front of that, which keeps them in a list so that
+ * resetting or destroying the pool frees them too.
+ */
+typedef struct {
+    size_t size_class;
+} PoolHeader;
+
+struct PoolLarge {
+    PoolLarge *prev;
+    PoolLarge *next;
+    PoolHeader header;
+};
+
+// The size class of strings that are malloced
+#define POOL_LARGE ((size_t) -1)
+
+static PoolHeader *pool_header(char *s){
+    return (PoolHeader *) s - 1;
+}
+
+// Size classes are 16, 32, ..., 2^(POOL_CLASSES + 3) bytes, including the header
+static size_t size_class(size_t size){
+    size_t c = 0;
+    size_t class_size = 16;
+    while (class_size < size){
+        class_size *= 2;
+        c++;
+    }
+    return c < POOL_CLASSES ? c : POOL_LARGE;
+}
+
+/**
+ * @brief Allocates a string buffer of at least size bytes from a pool
+ */
+char *pool_alloc(StrPool *p, size_t size){
+    const size_t c = size_class(size + sizeof(PoolHeader));
+    if (c == POOL_LARGE){
+        PoolLarge *l = (PoolLarge *)malloc(sizeof(PoolLarge) + size);
+        if (!l){
+            ERROR("Failed to allocate a string of %zu bytes", size);
+        }
+        *l = (PoolLarge){ .next = p->large, .header.size_class = POOL_LARGE };
+        if (p->large){
+            p->large->prev = l;
+        }
+        p->large = l;
+        return (char *) (l + 1);
+    }
+
+    PoolHeader *h = (PoolHeader *) p->free_lists[c];
+    if (h){
+        p->free_lists[c] = *(void **) (h + 1);
+    } else {
+        h = (PoolHeader *)arena_alloc(&p->arena, (size_t) 16 << c);
+    }
+    h->size_class = c;
+    return (char *) (h + 1);
+}
+
+char *pool_strndup(StrPool *p, const char *s, size_t len){
+    char *res = pool_alloc(p, len + 1);
+    memcpy(res, s, len);
+    res[len] = '\0';
+    return res;
+}
+
+/**
+ * @brief Returns a string allocated from a pool to it
+ */
+void pool_free(StrPool *p, char *s){
+    if (!s){
+        return;
+    }
+
+    PoolHeader *h = pool_header(s);
+    if (h->size_class == POOL_LARGE){
+        PoolLarge *l = (PoolLarge *) s - 1;
+        if (l->prev){
+            l->prev->next = l->next;
+        } else {
+            p->large = l->next;
+        }
+        if (l->next){
+            l->next->prev = l->prev;
+        }
+        free(l);
+        return;
+    }
+
+    *(void **) s = p->free_lists[h->size_class];
+    p->free_lists[h->size_class] = h;
+}
+
+static void free_large(StrPool *p){
+    PoolLarge *l = p->large;
+    while (l){
+        PoolLarge *next = l->next;
+        free(l);
+        l = next;
+    }
+    p->large = NULL;
+}
+
+/**
+ * @brief Frees every string of a pool, even those still in use
+ */
+void pool_destroy(StrPool *p){
+    arena_free(&p->arena);
+    free_large(p);
+    memset(p->free_lists, 0, sizeof(p->free_lists));
+}
+
+/**
+ * @brief Releases every pooled string at once, keeping the pool's current block for reuse
+ */
+void pool_reset(StrPool *p){
+    arena_reset(&p->arena);
+    free_large(p);
+    memset(p->free_lists, 0, sizeof(p->free_lists));
+}
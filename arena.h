@@ -0,0 +1,44 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+typedef struct ArenaBlock ArenaBlock;
+
+/**
+ * A bump allocator. Allocations cannot be freed individually, only all at once by
+ * resetting or freeing the arena.
+ */
+typedef struct {
+    ArenaBlock *head;
+} Arena;
+
+void *arena_alloc(Arena *a, size_t size);
+char *arena_strndup(Arena *a, const char *s, size_t len);
+void arena_reset(Arena *a);
+void arena_free(Arena *a);
+
+// Strings of up to 2^(POOL_CLASSES + 3) bytes (including the terminator and a header) are pooled
+#define POOL_CLASSES 8
+
+typedef struct PoolLarge PoolLarge;
+
+/**
+ * A size-class allocator for strings, carved out of an arena. Freed strings go on a free
+ * list for their class (recorded when they are allocated), larger strings use malloc.
+ * Resetting or destroying the pool releases every string at once, large ones included.
+ */
+typedef struct {
+    Arena arena;
+    void *free_lists[POOL_CLASSES];
+    // The strings too large for any class, which are malloced
+    PoolLarge *large;
+} StrPool;
+
+char *pool_alloc(StrPool *p, size_t size);
+char *pool_strndup(StrPool *p, const char *s, size_t len);
+void pool_free(StrPool *p, char *s);
+void pool_reset(StrPool *p);
+void pool_destroy(StrPool *p);
+
+#endif
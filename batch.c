@@ -0,0 +1,374 @@
+#include "batch.h"
+#include "interpret.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(EMOTICON_NO_THREADS)
+#define HAVE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+    // Index into Batch.programs
+    unsigned int program;
+    char *input;
+    char *output;
+    // Line of the job list, for reporting failures
+    size_t line;
+    int result;
+} BatchJob;
+
+typedef struct {
+    Program program;
+    // Whether program compiled, as jobs whose program did not are failed without running
+    bool compiled;
+} BatchProgram;
+
+/**
+ * The jobs of one worker, as indices into Batch.jobs. Its worker takes them from the back,
+ * and other workers that have run out steal them from the front. Jobs take far longer to
+ * run than the lock does to take, so each deque is simply locked.
+ */
+typedef struct {
+#ifdef HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+    size_t *jobs;
+    size_t front;
+    size_t back;
+} JobDeque;
+
+typedef struct {
+    BatchJob *jobs;
+    size_t jobs_size;
+    size_t jobs_max_size;
+
+    // The code files, interned so that each is only compiled once
+    SymbolTable code_files;
+    BatchProgram *programs;
+
+    JobDeque *deques;
+    unsigned int workers;
+    bool jit;
+} Batch;
+
+typedef struct {
+    Batch *batch;
+    unsigned int id;
+} Worker;
+
+/* Job list */
+
+/**
+ * @brief Splits the next path off a line of the job list
+ *
+ * @return The path (NUL terminated in place), or NULL if there are none left
+ */
+static char *next_path(char **s){
+    char *p = *s;
+    while (isspace((unsigned char) *p)){
+        p++;
+    }
+    if (!*p){
+        return NULL;
+    }
+    char *end = p;
+    while (*end && !isspace((unsigned char) *end)){
+        end++;
+    }
+    *s = *end ? end + 1 : end;
+    *end = '\0';
+    return p;
+}
+
+static void add_job(Batch *b, BatchJob job){
+    if (b->jobs_size >= b->jobs_max_size){
+        size_t new_max = b->jobs_max_size ? b->jobs_max_size * 2 : 64;
+        BatchJob *temp = (BatchJob *)realloc(b->jobs, new_max * sizeof(BatchJob));
+        if (!temp){
+            ERROR("Failed to allocate memory for %zu jobs", new_max);
+        }
+        b->jobs = temp;
+        b->jobs_max_size = new_max;
+    }
+    b->jobs[b->jobs_size++] = job;
+}
+
+static char *copy_path(const char *path){
+    char *copy = strdup(path);
+    if (!copy){
+        ERROR("Failed to allocate memory for a path");
+    }
+    return copy;
+}
+
+/**
+ * @brief Reads every job in a job list
+ *
+ * @return 0 on success, or 1 if a line is not a job (which is printed)
+ */
+static int read_jobs(Batch *b, FILE *list){
+    char *line = NULL;
+    size_t line_max = 0;
+    size_t line_no = 0;
+    int res = 0;
+
+    while (getline(&line, &line_max, list) >= 0){
+        line_no++;
+        char *rest = line;
+        char *code = next_path(&rest);
+        if (!code || code[0] == '#'){
+            continue;
+        }
+        char *input = next_path(&rest);
+        char *output = next_path(&rest);
+        if (!input || !output || next_path(&rest)){
+            fprintf(stderr, "Batch: line %zu is not '<code file> <input file> <output file>'\n", line_no);
+            res = 1;
+            break;
+        }
+
+        add_job(b, (BatchJob){
+            .program = intern(&b->code_files, code, strlen(code)),
+            .input = copy_path(input),
+            .output = copy_path(output),
+            .line = line_no
+        });
+    }
+
+    if (!res && ferror(list)){
+        fprintf(stderr, "Batch: could not read the job list\n");
+        res = 1;
+    }
+    free(line);
+    return res;
+}
+
+/**
+ * @brief Compiles each distinct code file once. One that does not compile only fails its
+ * own jobs.
+ */
+static void compile_programs(Batch *b, int opt_level){
+    b->programs = (BatchProgram *)calloc(b->code_files.size ? b->code_files.size : 1, sizeof(BatchProgram));
+    if (!b->programs){
+        ERROR("Failed to allocate memory for %zu programs", b->code_files.size);
+    }
+
+    for (size_t i = 0; i < b->code_files.size; i++){
+        const char *path = b->code_files.names[i];
+        FILE *code = fopen(path, "r");
+        if (!code){
+            fprintf(stderr, "Could not open code file '%s'\n", path);
+            continue;
+        }
+        b->programs[i].compiled = !interpret_compile(code, opt_level, &b->programs[i].program, NULL);
+        fclose(code);
+    }
+}
+
+/* Running jobs */
+
+static int run_job(const Batch *b, const BatchJob *job){
+    const BatchProgram *p = &b->programs[job->program];
+    if (!p->compiled){
+        return 1;
+    }
+
+    FILE *input = fopen(job->input, "r");
+    if (!input){
+        fprintf(stderr, "Could not open input file '%s'\n", job->input);
+        return 1;
+    }
+    FILE *output = fopen(job->output, "w");
+    if (!output){
+        fprintf(stderr, "Could not open output file '%s'\n", job->output);
+        fclose(input);
+        return 1;
+    }
+
+    int res = interpret_program(&p->program, input, output, b->jit);
+    fclose(input);
+    if (fclose(output)){
+        fprintf(stderr, "Could not write output file '%s'\n", job->output);
+        res = 1;
+    }
+    return res;
+}
+
+static void deque_lock(JobDeque *d){
+#ifdef HAVE_THREADS
+    pthread_mutex_lock(&d->lock);
+#else
+    (void) d;
+#endif
+}
+
+static void deque_unlock(JobDeque *d){
+#ifdef HAVE_THREADS
+    pthread_mutex_unlock(&d->lock);
+#else
+    (void) d;
+#endif
+}
+
+/**
+ * @brief Takes a job from the back of a worker's own deque, or from the front of another's
+ *
+ * @return Whether there was a job to take
+ */
+static bool take_job(JobDeque *d, bool steal, size_t *job){
+    deque_lock(d);
+    const bool found = d->front != d->back;
+    if (found){
+        *job = steal ? d->jobs[d->front++] : d->jobs[--d->back];
+    }
+    deque_unlock(d);
+    return found;
+}
+
+/**
+ * @brief Runs jobs until there are none left in any deque. No jobs are added once the
+ * workers start, so a worker that finds every deque empty is done.
+ */
+static void *work(void *arg){
+    const Worker *w = (const Worker *) arg;
+    Batch *b = w->batch;
+    size_t job;
+
+    while (true) {
+        bool found = take_job(&b->deques[w->id], false, &job);
+        // Steal from the workers after this one first, so thieves spread out
+        for (unsigned int i = 1; !found && i < b->workers; i++){
+            found = take_job(&b->deques[(w->id + i) % b->workers], true, &job);
+        }
+        if (!found){
+            return NULL;
+        }
+        // Each job is only taken once, so only this worker writes its result
+        b->jobs[job].result = run_job(b, &b->jobs[job]);
+    }
+}
+
+/**
+ * @brief Deals the jobs out to the workers' deques in turn, then runs them. The calling
+ * thread is the first worker.
+ */
+static void run_jobs(Batch *b){
+    b->deques = (JobDeque *)calloc(b->workers, sizeof(JobDeque));
+    Worker *workers = (Worker *)calloc(b->workers, sizeof(Worker));
+    if (!b->deques || !workers){
+        ERROR("Failed to allocate memory for %u workers", b->workers);
+    }
+
+    const size_t per_worker = (b->jobs_size + b->workers - 1) / b->workers;
+    for (unsigned int i = 0; i < b->workers; i++){
+        JobDeque *d = &b->deques[i];
+        d->jobs = (size_t *)malloc((per_worker ? per_worker : 1) * sizeof(size_t));
+        if (!d->jobs){
+            ERROR("Failed to allocate memory for %zu jobs", per_worker);
+        }
+#ifdef HAVE_THREADS
+        pthread_mutex_init(&d->lock, NULL);
+#endif
+        workers[i] = (Worker){ .batch = b, .id = i };
+    }
+    for (size_t i = 0; i < b->jobs_size; i++){
+        JobDeque *d = &b->deques[i % b->workers];
+        d->jobs[d->back++] = i;
+    }
+
+#ifdef HAVE_THREADS
+    pthread_t *threads = (pthread_t *)calloc(b->workers, sizeof(pthread_t));
+    bool *started = (bool *)calloc(b->workers, sizeof(bool));
+    if (!threads || !started){
+        ERROR("Failed to allocate memory for %u workers", b->workers);
+    }
+    // A worker that could not be started leaves its jobs to be stolen
+    for (unsigned int i = 1; i < b->workers; i++){
+        started[i] = !pthread_create(&threads[i], NULL, work, &workers[i]);
+    }
+    work(&workers[0]);
+    for (unsigned int i = 1; i < b->workers; i++){
+        if (started[i]){
+            pthread_join(threads[i], NULL);
+        }
+    }
+    free(threads);
+    free(started);
+#else
+    work(&workers[0]);
+#endif
+
+    for (unsigned int i = 0; i < b->workers; i++){
+#ifdef HAVE_THREADS
+        pthread_mutex_destroy(&b->deques[i].lock);
+#endif
+        free(b->deques[i].jobs);
+    }
+    TFREE(b->deques);
+    free(workers);
+}
+
+static void free_batch(Batch *b){
+    for (size_t i = 0; i < b->jobs_size; i++){
+        free(b->jobs[i].input);
+        free(b->jobs[i].output);
+    }
+    free(b->jobs);
+    if (b->programs){
+        for (size_t i = 0; i < b->code_files.size; i++){
+            free_program(b->programs[i].program);
+        }
+        free(b->programs);
+    }
+    free_symbols(b->code_files);
+}
+
+/**
+ * @brief Gets how many workers to run jobs on by default: one per online CPU
+ */
+unsigned int batch_default_workers(void){
+#ifdef HAVE_THREADS
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (unsigned int) cpus : 1;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * @brief Runs every job in a job list on up to workers threads (see batch.h). A job's
+ * errors are printed, and only fail that job.
+ *
+ * @return 0 if every job ran to its end, otherwise 1
+ */
+int batch_run(FILE *list, int opt_level, bool jit, unsigned int workers){
+    Batch b = { .jit = jit };
+    if (read_jobs(&b, list)){
+        free_batch(&b);
+        return 1;
+    }
+
+    compile_programs(&b, opt_level);
+    b.workers = workers < 1 ? 1 : workers;
+    if (b.jobs_size && b.workers > b.jobs_size){
+        b.workers = (unsigned int) b.jobs_size;
+    }
+    run_jobs(&b);
+
+    int res = 0;
+    for (size_t i = 0; i < b.jobs_size; i++){
+        if (b.jobs[i].result){
+            fprintf(stderr, "Batch: job on line %zu (%s with %s) failed\n",
+                    b.jobs[i].line, b.code_files.names[b.jobs[i].program], b.jobs[i].input);
+            res = 1;
+        }
+    }
+    free_batch(&b);
+    return res;
+}
@@ -0,0 +1,17 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+ * Runs many programs, each on its own input, across a pool of worker threads. Each line of
+ * a job list is a job, as three paths:
+ *     <code file> <input file> <output file>
+ * Blank lines and lines starting with '#' are skipped. Each distinct code file is compiled
+ * once, and the compiled program is shared (read only) by every job that runs it.
+ */
+int batch_run(FILE *list, int opt_level, bool jit, unsigned int workers);
+unsigned int batch_default_workers(void);
+
+#endif
@@ -0,0 +1,549 @@
+#include "error.h"
+#include "lex.h"
+#include "list.h"
+#include "value.h"
+#include "interpret.h"
+#include "optimise.h"
+#include "jit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * Microbenchmarks of the lexer and lists, and end to end runs of the programs given on the
+ * command line. Results are written to stdout as JSON, one benchmark a line, and can be
+ * compared against the results of an earlier run (see usage).
+ *
+ * Each benchmark is timed over enough iterations to take at least the minimum time, BENCH_RUNS
+ * times, and the fastest run is kept (noise only ever makes runs slower).
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_CLOCK_GETTIME
+#define NULL_FILE "/dev/null"
+#endif
+
+// The flags the benchmarks were built with, as results are only comparable with the same
+#ifndef BENCH_CFLAGS
+#define BENCH_CFLAGS ""
+#endif
+
+#define BENCH_RUNS 5
+#define MAX_RESULTS 256
+
+// Slower than the baseline by more than this is a regression (as a fraction)
+#define DEFAULT_THRESHOLD 0.25
+
+typedef struct {
+    char name[128];
+    double ns_per_op;
+    size_t iterations;
+} BenchResult;
+
+typedef struct {
+    // Only run benchmarks whose names start with this
+    const char *filter;
+    double min_time;
+
+    BenchResult results[MAX_RESULTS];
+    size_t results_size;
+} Bench;
+
+// Keeps the compiler from optimising away what is being timed
+static volatile size_t sink;
+
+typedef void (*BenchFn)(void *arg, size_t iterations);
+
+static double now(void){
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static double time_iterations(BenchFn f, void *arg, size_t iterations){
+    const double start = now();
+    f(arg, iterations);
+    return now() - start;
+}
+
+/**
+ * @brief Times a benchmark, recording how long each of its operations takes
+ *
+ * @param ops How many operations an iteration of f does
+ */
+static void measure(Bench *b, const char *name, BenchFn f, void *arg, size_t ops){
+    if (b->filter && strncmp(name, b->filter, strlen(b->filter))){
+        return;
+    }
+    if (b->results_size >= MAX_RESULTS){
+        ERROR("Too many benchmarks (at most %d)", MAX_RESULTS);
+    }
+
+    // Scale the iterations up until a run takes long enough to time well, aiming a little
+    // past the minimum time as the first runs are too short to estimate from precisely
+    size_t iterations = 1;
+    double t = time_iterations(f, arg, iterations);
+    while (t < b->min_time){
+        const double scale = t > 0 ? b->min_time * 1.2 / t : 100;
+        iterations = (size_t) ((double) iterations * (scale < 2 ? 2 : scale > 100 ? 100 : scale));
+        t = time_iterations(f, arg, iterations);
+    }
+
+    double best = t;
+    for (int run = 1; run < BENCH_RUNS; run++){
+        t = time_iterations(f, arg, iterations);
+        if (t < best){
+            best = t;
+        }
+    }
+
+    BenchResult *r = &b->results[b->results_size++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->ns_per_op = best * 1e9 / (double) (iterations * ops);
+    r->iterations = iterations;
+    fprintf(stderr, "%-40s %12.2f ns/op\n", r->name, r->ns_per_op);
+}
+
+/* Lexer */
+
+static void bench_lex_token(void *arg, size_t iterations){
+    const char *s = (const char *) arg;
+    for (size_t i = 0; i < iterations; i++){
+        Token t = lex_token(s, 0, 0);
+        sink += t.type;
+        free_tkn(t);
+    }
+}
+
+static void bench_token2str(void *arg, size_t iterations){
+    const Token *t = (const Token *) arg;
+    for (size_t i = 0; i < iterations; i++){
+        char *s = token2str(*t);
+        sink += (unsigned char) s[0];
+        free(s);
+    }
+}
+
+static void bench_deobfuscate(void *arg, size_t iterations){
+    (void) arg;
+    for (size_t i = 0; i < iterations; i++){
+        for (size_t j = 0; j < sizeof(OBFUSCATED_EMO) / sizeof(OBFUSCATED_EMO[0]); j++){
+            sink += (unsigned char) deobfuscate_emoticon(OBFUSCATED_EMO[j]);
+        }
+    }
+}
+
+static void bench_scan(void *arg, size_t iterations){
+    const Source *code = (const Source *) arg;
+    for (size_t i = 0; i < iterations; i++){
+        Source src = string_source(code->buf, code->size);
+        set_scan_level(&src, code->scan_level);
+        while (true) {
+            skip_ws(&src);
+            const Lexeme lx = get_lexme(&src);
+            if (!lx.length){
+                break;
+            }
+            sink += lx.length;
+        }
+    }
+}
+
+/**
+ * @brief Generates code made of every kind of lexeme, with runs of whitespace of every kind
+ * between them
+ *
+ * @param lexemes Set to how many lexemes it has
+ */
+static char *generate_code(size_t size, size_t *lexemes){
+    static const char *const words[] = {
+        "hello", "a_string_too_long_to_be_inline", ":P", "::-O", "long_list_name-)", "8(~",
+        "42", "-3.25", "^_^", "x", "1", "+", "B]`", "^__^", ":C", "abc-{"
+    };
+    static const char *const spaces[] = { " ", " ", "  ", "\n", "\t", "\n    ", " \r\n" };
+    const size_t num_words = sizeof(words) / sizeof(words[0]);
+    const size_t num_spaces = sizeof(spaces) / sizeof(spaces[0]);
+
+    char *code = (char *)malloc(size + 64);
+    if (!code){
+        ERROR("Failed to allocate %zu bytes of code", size);
+    }
+    size_t len = 0;
+    *lexemes = 0;
+    // A fixed generator, so that every run lexes the same code
+    unsigned int seed = 12345;
+    while (len < size){
+        seed = seed * 1103515245 + 12345;
+        const char *w = words[(seed >> 16) % num_words];
+        const char *sp = spaces[(seed >> 8) % num_spaces];
+        len += (size_t) sprintf(code + len, "%s%s", w, sp);
+        ++*lexemes;
+    }
+    return code;
+}
+
+static void lexer_benchmarks(Bench *b){
+    static const struct {
+        const char *name;
+        const char *s;
+    } classes[] = {
+        { "str", "hello" },
+        { "long_str", "a_string_too_long_to_be_inline" },
+        { "emoticon", "::-O" },
+        { "long_eyes", "long_list_name-)" },
+        { "obfus", "8(~" },
+        { "switch", "^_^" },
+        { "int", "12345" },
+        { "double", "-3.25" },
+    };
+    char name[128];
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++){
+        snprintf(name, sizeof(name), "lex_token/%s", classes[i].name);
+        measure(b, name, bench_lex_token, (void *) classes[i].s, 1);
+    }
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++){
+        Token t = lex_token(classes[i].s, 0, 0);
+        snprintf(name, sizeof(name), "token2str/%s", classes[i].name);
+        measure(b, name, bench_token2str, &t, 1);
+        free_tkn(t);
+    }
+    measure(b, "deobfuscate_emoticon", bench_deobfuscate, NULL,
+            sizeof(OBFUSCATED_EMO) / sizeof(OBFUSCATED_EMO[0]));
+
+    // Each scanner the CPU has, on 4MB of code
+    static const char *const level_names[] = {
+        [SCAN_SCALAR] = "scalar", [SCAN_SSE2] = "sse2", [SCAN_AVX2] = "avx2"
+    };
+    size_t lexemes;
+    char *code = generate_code(4 << 20, &lexemes);
+    Source src = string_source(code, strlen(code));
+    const ScanLevel best = best_scan_level();
+    for (ScanLevel level = SCAN_SCALAR; level <= best; level++){
+        set_scan_level(&src, level);
+        snprintf(name, sizeof(name), "skip_ws+get_lexme/%s", level_names[level]);
+        measure(b, name, bench_scan, &src, lexemes);
+    }
+    free(code);
+}
+
+/* Lists */
+
+typedef struct {
+    List list;
+    size_t size;
+} ListArg;
+
+static List make_list(size_t size){
+    List l = { 0 };
+    for (size_t i = 0; i < size; i++){
+        if (linsert(&l, l.size, int_val((int) i))){
+            ERROR("Could not grow a list to %zu elements", i + 1);
+        }
+    }
+    return l;
+}
+
+static void bench_append(void *arg, size_t iterations){
+    const ListArg *a = (const ListArg *) arg;
+    for (size_t i = 0; i < iterations; i++){
+        List l = make_list(a->size);
+        sink += l.size;
+        lfree(l);
+    }
+}
+
+static void bench_insert_remove_middle(void *arg, size_t iterations){
+    ListArg *a = (ListArg *) arg;
+    for (size_t i = 0; i < iterations; i++){
+        linsert(&a->list, a->size / 2, int_val((int) i));
+        lremove(&a->list, a->size / 2);
+    }
+}
+
+static void bench_insert_remove_front(void *arg, size_t iterations){
+    ListArg *a = (ListArg *) arg;
+    for (size_t i = 0; i < iterations; i++){
+        linsert(&a->list, 0, int_val((int) i));
+        lremove(&a->list, 0);
+    }
+}
+
+static void bench_rotate(void *arg, size_t iterations){
+    ListArg *a = (ListArg *) arg;
+    for (size_t i = 0; i < iterations; i++){
+        lrotate(&a->list, 7);
+    }
+    Value v;
+    lget(a->list, 0, &v);
+    sink += (size_t) v.i;
+}
+
+static void bench_reverse(void *arg, size_t iterations){
+    ListArg *a = (ListArg *) arg;
+    for (size_t i = 0; i < iterations; i++){
+        lreverse(&a->list);
+    }
+    Value v;
+    lget(a->list, 0, &v);
+    sink += (size_t) v.i;
+}
+
+static void bench_copy(void *arg, size_t iterations){
+    ListArg *a = (ListArg *) arg;
+    for (size_t i = 0; i < iterations; i++){
+        List copy = lcopy(&a->list);
+        sink += copy.size;
+        lfree(copy);
+    }
+}
+
+// A copy that is then changed, so it has to actually be copied
+static void bench_copy_write(void *arg, size_t iterations){
+    ListArg *a = (ListArg *) arg;
+    for (size_t i = 0; i < iterations; i++){
+        List copy = lcopy(&a->list);
+        linsert(&copy, copy.size, int_val(0));
+        sink += copy.size;
+        lfree(copy);
+    }
+}
+
+static void list_benchmarks(Bench *b){
+    // A small ring, a large ring and a rope
+    static const size_t sizes[] = { 16, 4096, 4 * LIST_ROPE_SIZE };
+    static const struct {
+        const char *name;
+        BenchFn f;
+    } ops[] = {
+        { "linsert+lremove/middle", bench_insert_remove_middle },
+        { "linsert+lremove/front", bench_insert_remove_front },
+        { "lrotate", bench_rotate },
+        { "lreverse", bench_reverse },
+        { "lcopy", bench_copy },
+        { "lcopy+linsert", bench_copy_write },
+    };
+    char name[128];
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+        ListArg a = { .size = sizes[i] };
+        snprintf(name, sizeof(name), "linsert/append/%zu", sizes[i]);
+        measure(b, name, bench_append, &a, sizes[i]);
+
+        a.list = make_list(sizes[i]);
+        for (size_t j = 0; j < sizeof(ops) / sizeof(ops[0]); j++){
+            snprintf(name, sizeof(name), "%s/%zu", ops[j].name, sizes[i]);
+            measure(b, name, ops[j].f, &a, 1);
+        }
+        lfree(a.list);
+    }
+}
+
+/* Programs */
+
+typedef struct {
+    const char *path;
+    bool jit;
+} ProgramArg;
+
+static FILE *open_null(void){
+#ifdef NULL_FILE
+    FILE *f = fopen(NULL_FILE, "w+");
+#else
+    FILE *f = tmpfile();
+#endif
+    if (!f){
+        ERROR("Could not open a file to write output to");
+    }
+    return f;
+}
+
+/**
+ * @brief Runs a program end to end: reading, compiling, optimising and running it
+ */
+static void bench_program(void *arg, size_t iterations){
+    const ProgramArg *a = (const ProgramArg *) arg;
+    FILE *io = open_null();
+    for (size_t i = 0; i < iterations; i++){
+        FILE *code = fopen(a->path, "r");
+        if (!code){
+            ERROR("Could not open code file '%s'", a->path);
+        }
+        const int res = interpret((InterpeterOptions){
+            .input = io,
+            .output = io,
+            .code = code,
+            .opt_level = OPT_MAX,
+            .jit = a->jit
+        });
+        fclose(code);
+        if (res){
+            ERROR("Benchmark program '%s' failed", a->path);
+        }
+    }
+    fclose(io);
+}
+
+static void program_benchmarks(Bench *b, char **paths, int num_paths){
+    char name[128];
+    for (int i = 0; i < num_paths; i++){
+        const char *base = strrchr(paths[i], '/');
+        base = base ? base + 1 : paths[i];
+
+        ProgramArg a = { .path = paths[i] };
+        snprintf(name, sizeof(name), "run/%s", base);
+        measure(b, name, bench_program, &a, 1);
+        if (jit_available()){
+            a.jit = true;
+            snprintf(name, sizeof(name), "run_jit/%s", base);
+            measure(b, name, bench_program, &a, 1);
+        }
+    }
+}
+
+/* Results */
+
+static void write_results(const Bench *b, FILE *f){
+    fprintf(f, "{\n  \"cflags\": \"%s\",\n  \"benchmarks\": [\n", BENCH_CFLAGS);
+    for (size_t i = 0; i < b->results_size; i++){
+        const BenchResult *r = &b->results[i];
+        // Names never need escaping (see the benchmarks above), apart from program names
+        fputs("    {\"name\": \"", f);
+        for (const char *c = r->name; *c; c++){
+            if (*c == '"' || *c == '\\'){
+                fputc('\\', f);
+            }
+            fputc(*c, f);
+        }
+        fprintf(f, "\", \"ns_per_op\": %.3f, \"iterations\": %zu}%s\n",
+                r->ns_per_op, r->iterations, i + 1 < b->results_size ? "," : "");
+    }
+    fputs("  ]\n}\n", f);
+}
+
+/**
+ * @brief Compares the results against a baseline written by an earlier run, printing how
+ * each benchmark changed
+ *
+ * @return The number of benchmarks that got slower by more than threshold, or -1 if the
+ * baseline could not be read
+ */
+static int compare_baseline(const Bench *b, const char *path, double threshold){
+    FILE *f = fopen(path, "r");
+    if (!f){
+        fprintf(stderr, "Could not open baseline '%s'\n", path);
+        return -1;
+    }
+
+    int regressions = 0;
+    char line[512];
+    fprintf(stderr, "\n%-40s %12s %12s %8s\n", "Compared to baseline", "baseline", "now", "change");
+    while (fgets(line, sizeof(line), f)){
+        const char *flags = strstr(line, "\"cflags\": \"");
+        if (flags && strncmp(flags + 11, BENCH_CFLAGS "\"", strlen(BENCH_CFLAGS) + 1)){
+            fprintf(stderr, "Warning: the baseline was built with other flags, so may not compare\n");
+        }
+
+        const char *name = strstr(line, "\"name\": \"");
+        const char *ns = strstr(line, "\"ns_per_op\": ");
+        if (!name || !ns){
+            continue;
+        }
+        name += 9;
+        const size_t name_len = strcspn(name, "\"");
+        const double base = strtod(ns + 13, NULL);
+
+        for (size_t i = 0; i < b->results_size; i++){
+            const BenchResult *r = &b->results[i];
+            if (strlen(r->name) != name_len || strncmp(r->name, name, name_len) || base <= 0){
+                continue;
+            }
+            const double change = r->ns_per_op / base - 1;
+            const bool regressed = change > threshold;
+            regressions += regressed;
+            fprintf(stderr, "%-40s %12.2f %12.2f %+7.1f%%%s\n", r->name, base, r->ns_per_op,
+                    change * 100, regressed ? "  REGRESSION" : "");
+        }
+    }
+    fclose(f);
+    return regressions;
+}
+
+static void usage(const char *prog){
+    fprintf(stderr, "Usage: %s [--filter=PREFIX] [--time=SECONDS] [--baseline=FILE] [--threshold=PERCENT] [program.emo...]\n"
+                    "Runs the benchmarks, then each program end to end, writing the results to stdout as JSON.\n"
+                    "  --filter=PREFIX      Only run benchmarks whose names start with PREFIX\n"
+                    "  --time=SECONDS       Time each run of a benchmark for at least this long (default 0.05)\n"
+                    "  --baseline=FILE      Compare against the results of an earlier run, failing if any\n"
+                    "                       benchmark got slower by more than the threshold\n"
+                    "  --threshold=PERCENT  How much slower counts as a regression (default %d)\n",
+            prog, (int) (DEFAULT_THRESHOLD * 100));
+}
+
+int main(int argc, char **argv){
+    Bench *b = (Bench *)calloc(1, sizeof(Bench));
+    if (!b){
+        ERROR("Failed to allocate memory for the results");
+    }
+    b->min_time = 0.05;
+    const char *baseline = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    char **paths = argv + argc;
+    int num_paths = 0;
+
+    for (int i = 1; i < argc; i++){
+        char *end = NULL;
+        if (!strncmp(argv[i], "--filter=", 9)){
+            b->filter = argv[i] + 9;
+        } else if (!strncmp(argv[i], "--time=", 7)){
+            b->min_time = strtod(argv[i] + 7, &end);
+            if (end == argv[i] + 7 || *end || b->min_time <= 0){
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strncmp(argv[i], "--baseline=", 11)){
+            baseline = argv[i] + 11;
+        } else if (!strncmp(argv[i], "--threshold=", 12)){
+            threshold = strtod(argv[i] + 12, &end) / 100;
+            if (end == argv[i] + 12 || *end || threshold < 0){
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (argv[i][0] != '-'){
+            // The programs are the rest of the arguments
+            paths = argv + i;
+            num_paths = argc - i;
+            break;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    lexer_benchmarks(b);
+    list_benchmarks(b);
+    program_benchmarks(b, paths, num_paths);
+    write_results(b, stdout);
+
+    int res = 0;
+    if (baseline){
+        const int regressions = compare_baseline(b, baseline, threshold);
+        if (regressions){
+            if (regressions > 0){
+                fprintf(stderr, "%d benchmark%s slower than the baseline by more than %.0f%%\n",
+                        regressions, regressions == 1 ? " is" : "s are", threshold * 100);
+            }
+            res = 1;
+        }
+    }
+    free(b);
+    return res;
+}
@@ -0,0 +1,349 @@
+#include "cache.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ * A .emoc file is a header followed by sections, each aligned to EMOC_ALIGN:
+ * - the instructions and their source positions (code_size of each)
+ * - the literals, where the str of a string that is not inline is its offset in strings
+ * - the offset of each list name in names, then the names (NUL terminated)
+ * - the literals' strings (NUL terminated)
+ * It is only ever read by the build that wrote it, so everything is in its native layout.
+ */
+
+#define EMOC_MAGIC "EMOC"
+#define EMOC_ALIGN 16
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    // Layout checks, so files from a build with different structures are rebuilt
+    uint16_t instruction_size;
+    uint16_t value_size;
+    int32_t opt_level;
+    // The source the program was compiled from
+    uint64_t source_hash;
+    uint64_t source_size;
+
+    uint64_t code_size;
+    uint64_t literals_size;
+    uint64_t symbols_size;
+    uint64_t names_size;
+    uint64_t strings_size;
+} EmocHeader;
+
+// Where each section starts, from the start of the file
+typedef struct {
+    size_t code;
+    size_t positions;
+    size_t literals;
+    size_t name_offsets;
+    size_t names;
+    size_t strings;
+    size_t size;
+} EmocLayout;
+
+static size_t align_up(size_t n){
+    return (n + EMOC_ALIGN - 1) & ~(size_t) (EMOC_ALIGN - 1);
+}
+
+static EmocLayout emoc_layout(const EmocHeader *h){
+    EmocLayout l;
+    l.code = align_up(sizeof(EmocHeader));
+    l.positions = align_up(l.code + h->code_size * sizeof(Instruction));
+    l.literals = align_up(l.positions + h->code_size * sizeof(SourcePos));
+    l.name_offsets = align_up(l.literals + h->literals_size * sizeof(Value));
+    l.names = align_up(l.name_offsets + h->symbols_size * sizeof(uint64_t));
+    l.strings = align_up(l.names + h->names_size);
+    l.size = l.strings + h->strings_size;
+    return l;
+}
+
+static bool is_boxed_str(const Value *v){
+    return v->type == VAL_STR && v->storage != TKN_INLINE;
+}
+
+/**
+ * @brief Gets where the compiled program for a code file is cached: prog.emo is cached in
+ * prog.emoc, and anything else has .emoc added
+ *
+ * @return The path (free it after)
+ */
+char *cache_path(const char *code_path){
+    const size_t len = strlen(code_path);
+    const bool is_emo = len >= 4 && !strcmp(code_path + len - 4, ".emo");
+    char *path = (char *)malloc(len + 6);
+    if (!path){
+        ERROR("Failed to allocate memory for a path of %zu characters", len + 5);
+    }
+    memcpy(path, code_path, len);
+    strcpy(path + len, is_emo ? "c" : ".emoc");
+    return path;
+}
+
+uint64_t hash_source(const Source *src){
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < src->size; i++){
+        h ^= (unsigned char) src->buf[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static EmocHeader make_header(const Source *src, int opt_level){
+    EmocHeader h = {
+        .version = EMOC_VERSION,
+        .instruction_size = sizeof(Instruction),
+        .value_size = sizeof(Value),
+        .opt_level = opt_level,
+        .source_hash = hash_source(src),
+        .source_size = src->size
+    };
+    memcpy(h.magic, EMOC_MAGIC, sizeof(h.magic));
+    return h;
+}
+
+#ifdef HAVE_MMAP
+
+/**
+ * @brief Checks that an instruction of a mapped program only refers to what the program
+ * has, so that a damaged file cannot make a run read or jump out of bounds
+ */
+static bool valid_instruction(const Program *p, size_t pc){
+    const Instruction *ins = &p->code[pc];
+    if (ins->op >= NUM_OPCODES || ins->list >= p->symbols.size){
+        return false;
+    }
+    switch ((Opcode) ins->op){
+        case OP_PUSH:
+        case OP_PUSH_FACE:
+        case OP_ROTATE_BY:
+            return ins->arg < p->literals_size;
+        case OP_MATHS_CONST_RIGHT:
+        case OP_COMPARE_CONST_RIGHT:
+            return (size_t) ins->arg + 1 < p->literals_size;
+        case OP_OPEN_BLOCK:
+        case OP_CLOSE_BLOCK:
+        case OP_DIVIDE_BLOCK:
+        case OP_BREAK:
+        case OP_BREAK_AND_POP:
+            return ins->arg < p->size;
+        // A guard is followed by the ( of its loop, which is jumped past when it does the loop
+        case OP_LOOP_ROTATE:
+            if (pc + 1 + (size_t) ins->arg >= p->size || p->code[pc + 1 + ins->arg].op != OP_ROTATE_BY){
+                return false;
+            }
+            // Fallthrough
+        case OP_LOOP_COUNT_DOWN:
+        case OP_LOOP_DRAIN:
+            return pc + 1 < p->size && p->code[pc + 1].op == OP_OPEN_BLOCK;
+        default:
+            return true;
+    }
+}
+
+/**
+ * @brief Maps the compiled program cached for a source
+ *
+ * @return 0 on success, or 1 if there is no cache or it is stale, from another version or
+ * damaged (so the program should be compiled and cached again)
+ */
+int cache_load(const char *path, const Source *src, int opt_level, CachedProgram *out){
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0){
+        return 1;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (!fstat(fd, &st) && (size_t) st.st_size >= sizeof(EmocHeader)){
+        map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED){
+        return 1;
+    }
+    const size_t map_size = (size_t) st.st_size;
+    const char *base = (const char *) map;
+
+    // Only the sizes of the sections may differ from the header this build would write
+    EmocHeader h;
+    memcpy(&h, base, sizeof(h));
+    EmocHeader expected = make_header(src, opt_level);
+    memcpy(&expected.code_size, &h.code_size, sizeof(h) - offsetof(EmocHeader, code_size));
+    const bool sizes_fit = h.code_size <= map_size && h.literals_size <= map_size &&
+            h.symbols_size <= map_size && h.names_size <= map_size && h.strings_size <= map_size;
+    const EmocLayout l = emoc_layout(&h);
+    if (memcmp(&h, &expected, sizeof(h)) || !sizes_fit || l.size != map_size || !h.code_size ||
+            (h.names_size && base[l.names + h.names_size - 1]) ||
+            (h.strings_size && base[map_size - 1])){
+        munmap(map, map_size);
+        return 1;
+    }
+
+    Program p = { 0 };
+    p.code = (Instruction *) (base + l.code);
+    p.positions = (SourcePos *) (base + l.positions);
+    p.size = p.max_size = h.code_size;
+
+    p.literals = (Value *)malloc((h.literals_size ? h.literals_size : 1) * sizeof(Value));
+    p.symbols.names = (char **)malloc((h.symbols_size ? h.symbols_size : 1) * sizeof(char *));
+    if (!p.literals || !p.symbols.names){
+        ERROR("Failed to allocate memory for a cached program");
+    }
+    p.literals_size = p.literals_max_size = h.literals_size;
+    p.symbols.size = p.symbols.max_size = h.symbols_size;
+
+    bool damaged = false;
+    memcpy(p.literals, base + l.literals, h.literals_size * sizeof(Value));
+    for (size_t i = 0; i < h.literals_size; i++){
+        if (is_boxed_str(&p.literals[i])){
+            const uintptr_t offset = (uintptr_t) p.literals[i].str;
+            damaged |= offset >= h.strings_size;
+            p.literals[i].storage = TKN_BORROWED;
+            p.literals[i].str = (char *) (base + l.strings + offset);
+        }
+    }
+    const uint64_t *name_offsets = (const uint64_t *) (base + l.name_offsets);
+    for (size_t i = 0; i < h.symbols_size; i++){
+        damaged |= name_offsets[i] >= h.names_size;
+        p.symbols.names[i] = (char *) (base + l.names + name_offsets[i]);
+    }
+    for (size_t pc = 0; pc < p.size && !damaged; pc++){
+        damaged |= !valid_instruction(&p, pc);
+    }
+    // Runs stop at the OP_HALT every program ends with
+    damaged |= p.code[p.size - 1].op != OP_HALT;
+
+    *out = (CachedProgram){ .program = p, .map = map, .map_size = map_size };
+    if (damaged){
+        cache_free(out);
+        return 1;
+    }
+    return 0;
+}
+
+void cache_free(CachedProgram *c){
+    free(c->program.literals);
+    free(c->program.symbols.names);
+    munmap(c->map, c->map_size);
+    *c = (CachedProgram){ 0 };
+}
+
+#else
+
+int cache_load(const char *path, const Source *src, int opt_level, CachedProgram *out){
+    (void) path;
+    (void) src;
+    (void) opt_level;
+    (void) out;
+    return 1;
+}
+
+void cache_free(CachedProgram *c){
+    *c = (CachedProgram){ 0 };
+}
+
+#endif
+
+static void write_padding(FILE *f, size_t from, size_t to){
+    static const char zeros[EMOC_ALIGN] = { 0 };
+    fwrite(zeros, 1, to - from, f);
+}
+
+/**
+ * @brief Caches the compiled program for a source. It is written to a temporary file that
+ * then replaces the cache, so that runs at the same time never see half a file.
+ *
+ * @return 0 on success, or 1 if the cache could not be written
+ */
+int cache_save(const char *path, const Source *src, int opt_level, const Program *p){
+    EmocHeader h = make_header(src, opt_level);
+    h.code_size = p->size;
+    h.literals_size = p->literals_size;
+    h.symbols_size = p->symbols.size;
+    for (size_t i = 0; i < p->symbols.size; i++){
+        h.names_size += strlen(p->symbols.names[i]) + 1;
+    }
+    for (size_t i = 0; i < p->literals_size; i++){
+        if (is_boxed_str(&p->literals[i])){
+            h.strings_size += strlen(p->literals[i].str) + 1;
+        }
+    }
+    const EmocLayout l = emoc_layout(&h);
+
+    const size_t len = strlen(path);
+    char *temp_path = (char *)malloc(len + 32);
+    if (!temp_path){
+        ERROR("Failed to allocate memory for a path of %zu characters", len + 32);
+    }
+#ifdef HAVE_MMAP
+    snprintf(temp_path, len + 32, "%s.%ld.tmp", path, (long) getpid());
+#else
+    snprintf(temp_path, len + 32, "%s.tmp", path);
+#endif
+
+    FILE *f = fopen(temp_path, "wb");
+    if (!f){
+        free(temp_path);
+        return 1;
+    }
+
+    fwrite(&h, sizeof(h), 1, f);
+    write_padding(f, sizeof(h), l.code);
+    fwrite(p->code, sizeof(Instruction), p->size, f);
+    write_padding(f, l.code + p->size * sizeof(Instruction), l.positions);
+    fwrite(p->positions, sizeof(SourcePos), p->size, f);
+    write_padding(f, l.positions + p->size * sizeof(SourcePos), l.literals);
+
+    size_t offset = 0;
+    for (size_t i = 0; i < p->literals_size; i++){
+        Value v = p->literals[i];
+        if (is_boxed_str(&v)){
+            const size_t slen = strlen(v.str) + 1;
+            v.str = (char *) (uintptr_t) offset;
+            offset += slen;
+        }
+        fwrite(&v, sizeof(Value), 1, f);
+    }
+    write_padding(f, l.literals + p->literals_size * sizeof(Value), l.name_offsets);
+
+    offset = 0;
+    for (size_t i = 0; i < p->symbols.size; i++){
+        const uint64_t name_offset = offset;
+        fwrite(&name_offset, sizeof(name_offset), 1, f);
+        offset += strlen(p->symbols.names[i]) + 1;
+    }
+    write_padding(f, l.name_offsets + p->symbols.size * sizeof(uint64_t), l.names);
+    for (size_t i = 0; i < p->symbols.size; i++){
+        fwrite(p->symbols.names[i], 1, strlen(p->symbols.names[i]) + 1, f);
+    }
+    write_padding(f, l.names + h.names_size, l.strings);
+    for (size_t i = 0; i < p->literals_size; i++){
+        if (is_boxed_str(&p->literals[i])){
+            fwrite(p->literals[i].str, 1, strlen(p->literals[i].str) + 1, f);
+        }
+    }
+
+    const bool failed = ferror(f) | fclose(f);
+    if (failed || rename(temp_path, path)){
+        remove(temp_path);
+        free(temp_path);
+        return 1;
+    }
+    free(temp_path);
+    return 0;
+}
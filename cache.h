@@ -0,0 +1,27 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "compile.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump whenever the compiled program (or anything it is made of) changes
+#define EMOC_VERSION 1
+
+/**
+ * A compiled program loaded from a .emoc file. Its instructions and source positions are
+ * the file itself, mapped read only, so it must not be changed (or optimised).
+ */
+typedef struct {
+    Program program;
+    void *map;
+    size_t map_size;
+} CachedProgram;
+
+char *cache_path(const char *code_path);
+uint64_t hash_source(const Source *src);
+int cache_load(const char *path, const Source *src, int opt_level, CachedProgram *out);
+int cache_save(const char *path, const Source *src, int opt_level, const Program *p);
+void cache_free(CachedProgram *c);
+
+#endif
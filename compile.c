@@ -0,0 +1,378 @@
+#include "compile.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+static _Noreturn void compile_err(const Program *p, size_t pc, const char *msg, ...){
+    va_list args;
+    va_start(args, msg);
+    fail_at("Compile Error: ", p->positions[pc].line, p->positions[pc].column, msg, args);
+}
+
+static void emit(Program *p, Instruction ins, unsigned int line, unsigned int column){
+    if (p->size >= p->max_size) {
+        size_t new_max = p->max_size ? p->max_size * 2 : 64;
+        Instruction *temp = (Instruction *)realloc(p->code, new_max * sizeof(Instruction));
+        if (!temp) {
+            ERROR("Failed to allocate memory for a program of %zu instructions", new_max);
+        }
+        p->code = temp;
+
+        SourcePos *temp_pos = (SourcePos *)realloc(p->positions, new_max * sizeof(SourcePos));
+        if (!temp_pos) {
+            ERROR("Failed to allocate memory for a program of %zu instructions", new_max);
+        }
+        p->positions = temp_pos;
+        p->max_size = new_max;
+    }
+    p->positions[p->size] = (SourcePos){ .line = line, .column = column };
+    p->code[p->size++] = ins;
+}
+
+unsigned int add_literal(Program *p, Value v){
+    if (p->literals_size >= p->literals_max_size) {
+        size_t new_max = p->literals_max_size ? p->literals_max_size * 2 : 64;
+        Value *temp = (Value *)realloc(p->literals, new_max * sizeof(Value));
+        if (!temp) {
+            ERROR("Failed to allocate memory for %zu literals", new_max);
+        }
+        p->literals = temp;
+        p->literals_max_size = new_max;
+    }
+    p->literals[p->literals_size] = v;
+    return (unsigned int) p->literals_size++;
+}
+
+/* Symbols */
+
+static size_t hash_name(const char *name, size_t len){
+    // FNV-1a
+    size_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++){
+        h ^= (unsigned char) name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void rehash(SymbolTable *t, size_t buckets_size){
+    unsigned int *buckets = (unsigned int *)calloc(buckets_size, sizeof(unsigned int));
+    if (!buckets){
+        ERROR("Failed to allocate memory for %zu symbol buckets", buckets_size);
+    }
+
+    for (size_t id = 0; id < t->size; id++){
+        size_t b = hash_name(t->names[id], strlen(t->names[id])) & (buckets_size - 1);
+        while (buckets[b]){
+            b = (b + 1) & (buckets_size - 1);
+        }
+        buckets[b] = (unsigned int) id + 1;
+    }
+
+    free(t->buckets);
+    t->buckets = buckets;
+    t->buckets_size = buckets_size;
+}
+
+/**
+ * @brief Gets the id of a list name, giving it the next free id if it is new
+ * 
+ * @param t The symbol table
+ * @param name The name to intern (need not be NUL terminated). It is copied if new.
+ * @param len The length of the name
+ * @return The id of the name
+ */
+unsigned int intern(SymbolTable *t, const char *name, size_t len){
+    // Keep the load factor at most 1/2
+    if ((t->size + 1) * 2 > t->buckets_size){
+        rehash(t, t->buckets_size ? t->buckets_size * 2 : 64);
+    }
+
+    size_t b = hash_name(name, len) & (t->buckets_size - 1);
+    while (t->buckets[b]){
+        const unsigned int id = t->buckets[b] - 1;
+        if (!strncmp(t->names[id], name, len) && t->names[id][len] == '\0'){
+            return id;
+        }
+        b = (b + 1) & (t->buckets_size - 1);
+    }
+
+    if (t->size >= t->max_size){
+        size_t new_max = t->max_size ? t->max_size * 2 : 32;
+        char **temp = (char **)realloc(t->names, new_max * sizeof(char *));
+        if (!temp){
+            ERROR("Failed to allocate memory for %zu symbols", new_max);
+        }
+        t->names = temp;
+        t->max_size = new_max;
+    }
+
+    t->names[t->size] = arena_strndup(&t->arena, name, len);
+    t->buckets[b] = (unsigned int) t->size + 1;
+    return (unsigned int) t->size++;
+}
+
+void free_symbols(SymbolTable t){
+    arena_free(&t.arena);
+    free(t.names);
+    free(t.buckets);
+}
+
+/* Blocks */
+
+static bool is_block_exit(unsigned char op){
+    return op == OP_DIVIDE_BLOCK || op == OP_BREAK || op == OP_BREAK_AND_POP;
+}
+
+static void push_open(OpenBlocks *b, size_t pc){
+    if (b->depth >= b->max_depth){
+        b->max_depth = b->max_depth ? b->max_depth * 2 : 16;
+        size_t *temp = (size_t *)realloc(b->opens, b->max_depth * sizeof(size_t));
+        if (!temp){
+            ERROR("Failed to allocate memory for %zu nested blocks", b->max_depth);
+        }
+        b->opens = temp;
+    }
+    b->opens[b->depth++] = pc;
+}
+
+/**
+ * @brief Frees the blocks that were being matched, then reports a compile error at pc
+ */
+static _Noreturn void blocks_err(const Program *p, OpenBlocks *b, size_t pc, const char *msg){
+    TFREE(b->opens);
+    compile_err(p, pc, "%s", msg);
+}
+
+/**
+ * @brief Matches up blocks, setting the arg of every block instruction to where it jumps:
+ * the instruction after the block's ) for (, |, 3 and E, and the block's ( for ).
+ * @details Exits are first pointed at the ( of their innermost block, then once every block
+ * is closed they take over its target.
+ *
+ * @throws Error if a block is never closed or opened, or an exit is outside of any block
+ */
+void link_blocks(Program *p){
+    OpenBlocks b = { 0 };
+
+    for (size_t pc = 0; pc < p->size; pc++){
+        Instruction *ins = &p->code[pc];
+        if (ins->op == OP_OPEN_BLOCK){
+            push_open(&b, pc);
+        } else if (ins->op == OP_CLOSE_BLOCK){
+            if (!b.depth){
+                blocks_err(p, &b, pc, "Block is never opened");
+            }
+            const size_t open = b.opens[--b.depth];
+            ins->arg = (unsigned int) open;
+            p->code[open].arg = (unsigned int) pc + 1;
+        } else if (is_block_exit(ins->op)){
+            if (!b.depth){
+                blocks_err(p, &b, pc, "Block exit is outside of any block");
+            }
+            ins->arg = (unsigned int) b.opens[b.depth - 1];
+        }
+    }
+
+    if (b.depth){
+        blocks_err(p, &b, b.opens[b.depth - 1], "Block is never closed");
+    }
+    free(b.opens);
+
+    for (size_t pc = 0; pc < p->size; pc++){
+        if (is_block_exit(p->code[pc].op)){
+            p->code[pc].arg = p->code[p->code[pc].arg].arg;
+        }
+    }
+}
+
+/**
+ * @brief Links the last instruction of a program that is being compiled a piece at a time.
+ * @details Jumps out of a block are UNLINKED until its ) is added, which then links them.
+ * A program ending with OP_HALT is checked for blocks that are never closed (and b freed).
+ *
+ * @param b The blocks that are open so far
+ * @throws Error if a block is never closed or opened, or an exit is outside of any block
+ */
+void link_last(Program *p, OpenBlocks *b){
+    const size_t pc = p->size - 1;
+    Instruction *ins = &p->code[pc];
+
+    if (ins->op == OP_OPEN_BLOCK){
+        ins->arg = UNLINKED;
+        push_open(b, pc);
+    } else if (ins->op == OP_CLOSE_BLOCK){
+        if (!b->depth){
+            compile_err(p, pc, "Block is never opened");
+        }
+        const size_t open = b->opens[--b->depth];
+        ins->arg = (unsigned int) open;
+        // The exits left are this block's, as inner blocks (skipped over) are linked
+        for (size_t i = open + 1; i < pc; i++){
+            if (p->code[i].op == OP_OPEN_BLOCK){
+                i = p->code[i].arg - 1;
+            } else if (is_block_exit(p->code[i].op)){
+                p->code[i].arg = (unsigned int) pc + 1;
+            }
+        }
+        p->code[open].arg = (unsigned int) pc + 1;
+    } else if (is_block_exit(ins->op)){
+        if (!b->depth){
+            compile_err(p, pc, "Block exit is outside of any block");
+        }
+        ins->arg = UNLINKED;
+    } else if (ins->op == OP_HALT){
+        if (b->depth){
+            compile_err(p, b->opens[b->depth - 1], "Block is never closed");
+        }
+        TFREE(b->opens);
+        *b = (OpenBlocks){ 0 };
+    }
+}
+
+/* Compiling */
+
+/**
+ * @brief Copies a string for a value that outlives the source, inline if it is short
+ */
+static Value source_str(Arena *strings, const char *s, size_t len){
+    if (len < VALUE_INLINE_SIZE) {
+        return str_val(NULL, s, len);
+    }
+    Value v = { .type = VAL_STR, .storage = TKN_BORROWED };
+    v.str = arena_strndup(strings, s, len);
+    return v;
+}
+
+/**
+ * @brief Compiles one lexeme, without touching a program (so it can be done on another
+ * thread to the one building the program, see stream.c).
+ * @details Obfuscation switches are resolved here: while obfuscation is on, an obfuscated
+ * face is pushed as the character it encodes, otherwise it is pushed as the face itself.
+ *
+ * @param obfuscated Whether obfuscation is on, updated by obfuscation switches
+ * @param strings Where long strings are copied to, as they outlive the source
+ * @return false for obfuscation switches, which compile to nothing
+ */
+bool compile_lexeme(const char *s, Lexeme lx, bool *obfuscated, Arena *strings, CompiledLexeme *out){
+    Token t = classify_lexme(s, lx.length, lx.line, lx.column);
+    out->pos = (SourcePos){ .line = lx.line, .column = lx.column };
+
+    if (t.type == EMOTICON) {
+        Emoticon e = t.value.emoticon;
+        if (e.op == OBFUSCATION_ON || e.op == OBFUSCATION_OFF) {
+            *obfuscated = e.op == OBFUSCATION_ON;
+            return false;
+        }
+        out->ins = (Instruction){
+            .op = optype_opcode_table[(unsigned char) e.op],
+            .nose = e.nose
+        };
+        out->value = source_str(strings, s, emoticon_eyes_len(lx.length));
+        return true;
+    }
+
+    out->ins = (Instruction){ .op = OP_PUSH };
+    if (t.type == INT) {
+        out->value = int_val(t.value.i);
+    } else if (t.type == DOUBLE) {
+        out->value = double_val(t.value.d);
+    } else if (t.type == OBFUS && *obfuscated) {
+        out->value = source_str(strings, t.value.str, 1);
+    } else {
+        out->value = source_str(strings, s, lx.length);
+    }
+    return true;
+}
+
+/**
+ * @brief Adds a compiled lexeme (or OP_HALT) to the end of a program, interning its list
+ * name or adding its literal
+ */
+void append_lexeme(Program *p, const CompiledLexeme *c){
+    Instruction ins = c->ins;
+    if (ins.op == OP_PUSH) {
+        ins.arg = add_literal(p, c->value);
+    } else if (ins.op != OP_HALT) {
+        const char *eyes = val_str(&c->value);
+        ins.list = intern(&p->symbols, eyes, strlen(eyes));
+    }
+    emit(p, ins, c->pos.line, c->pos.column);
+}
+
+/**
+ * @brief Compiles the code in a source into a flat instruction array.
+ * @details Literals become OP_PUSH instructions referencing the literal pool.
+ * List names are interned so instructions refer to lists by slot, and blocks are matched
+ * so block instructions jump straight to their targets.
+ * The program always ends with OP_HALT.
+ *
+ * @param src The source, lexed to its end. Nothing in the program refers to it.
+ * @param p Where to compile the program, which should be empty. Free it with free_program,
+ * even after an error (see error.h).
+ */
+void compile_source(Source *src, Program *p){
+    bool obfuscated = false;
+
+    intern(&p->symbols, ":", 1);
+
+    while (true) {
+        skip_ws(src);
+        const Lexeme lx = get_lexme(src);
+        if (!lx.length) {
+            break;
+        }
+
+        CompiledLexeme c;
+        if (compile_lexeme(src->buf + lx.offset, lx, &obfuscated, &p->strings, &c)) {
+            append_lexeme(p, &c);
+        }
+    }
+
+    emit(p, (Instruction){ .op = OP_HALT }, src->line, src->column);
+    link_blocks(p);
+}
+
+/**
+ * @brief Lexes a code file and compiles it (see compile_source)
+ *
+ * @param f The code file
+ * @return The compiled program. Free with free_program.
+ * @throws Error if the code does not compile, after freeing everything compiling it made
+ */
+Program compile(FILE *f){
+    Source src;
+    if (open_source(&src, f)) {
+        ERROR("Could not read the code file");
+    }
+
+    // Caught here to free the source and program, then passed on to the caller's trap
+    ErrorTrap trap;
+    ErrorTrap *const outer = error_trap;
+    error_trap = &trap;
+
+    // Only changed through a pointer, so still up to date after an error longjmps back
+    Program p = { 0 };
+    if (setjmp(trap.env)) {
+        error_trap = outer;
+        close_source(&src);
+        free_program(p);
+        fail("%s", trap.message);
+    }
+    compile_source(&src, &p);
+    error_trap = outer;
+    close_source(&src);
+    return p;
+}
+
+void free_program(Program p){
+    free_symbols(p.symbols);
+    arena_free(&p.strings);
+    free(p.code);
+    free(p.positions);
+    free(p.literals);
+}
@@ -0,0 +1,213 @@
+#ifndef __COMPILE_H__
+#define __COMPILE_H__
+
+#include "lex.h"
+#include "value.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limits.h>
+
+/**
+ * Opcodes of the compiled program. These are dense (unlike Op_Type, whose values are the
+ * mouth characters) so that they can index a dispatch table directly.
+ */
+typedef enum {
+    OP_PUSH,
+    OP_SET_CURRENT,
+    OP_COUNT,
+    OP_REVERSE,
+    OP_ROTATE,
+    OP_MOVE_LEFT,
+    OP_MOVE_RIGHT,
+    OP_COPY_LEFT,
+    OP_COPY_RIGHT,
+    OP_ASSIGN,
+    OP_INSERT,
+    OP_EXPLODE_LEFT,
+    OP_EXPLODE_RIGHT,
+    OP_IMPLODE_LEFT,
+    OP_IMPLODE_RIGHT,
+    OP_PRINT,
+    OP_PRINT_AND_POP,
+    OP_INPUT,
+    OP_MATHS_LEFT,
+    OP_MATHS_RIGHT,
+    OP_COMPARE_LEFT,
+    OP_COMPARE_RIGHT,
+    OP_OPEN_BLOCK,
+    OP_CLOSE_BLOCK,
+    OP_DIVIDE_BLOCK,
+    OP_BREAK,
+    OP_BREAK_AND_POP,
+    OP_HALT,
+    // Made by the optimiser (see optimise.c)
+    OP_PUSH_FACE,
+    OP_ROTATE_BY,
+    OP_MOVE_LEFT_N,
+    OP_MOVE_RIGHT_N,
+    OP_MATHS_CONST_RIGHT,
+    OP_COMPARE_CONST_RIGHT,
+    // Guards in front of the ( of a loop the optimiser recognised
+    OP_LOOP_COUNT_DOWN,
+    OP_LOOP_ROTATE,
+    OP_LOOP_DRAIN,
+    NUM_OPCODES
+} Opcode;
+
+static const char *const opcode_names[NUM_OPCODES] = {
+    [OP_PUSH] = "OP_PUSH",
+    [OP_SET_CURRENT] = "OP_SET_CURRENT",
+    [OP_COUNT] = "OP_COUNT",
+    [OP_REVERSE] = "OP_REVERSE",
+    [OP_ROTATE] = "OP_ROTATE",
+    [OP_MOVE_LEFT] = "OP_MOVE_LEFT",
+    [OP_MOVE_RIGHT] = "OP_MOVE_RIGHT",
+    [OP_COPY_LEFT] = "OP_COPY_LEFT",
+    [OP_COPY_RIGHT] = "OP_COPY_RIGHT",
+    [OP_ASSIGN] = "OP_ASSIGN",
+    [OP_INSERT] = "OP_INSERT",
+    [OP_EXPLODE_LEFT] = "OP_EXPLODE_LEFT",
+    [OP_EXPLODE_RIGHT] = "OP_EXPLODE_RIGHT",
+    [OP_IMPLODE_LEFT] = "OP_IMPLODE_LEFT",
+    [OP_IMPLODE_RIGHT] = "OP_IMPLODE_RIGHT",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_PRINT_AND_POP] = "OP_PRINT_AND_POP",
+    [OP_INPUT] = "OP_INPUT",
+    [OP_MATHS_LEFT] = "OP_MATHS_LEFT",
+    [OP_MATHS_RIGHT] = "OP_MATHS_RIGHT",
+    [OP_COMPARE_LEFT] = "OP_COMPARE_LEFT",
+    [OP_COMPARE_RIGHT] = "OP_COMPARE_RIGHT",
+    [OP_OPEN_BLOCK] = "OP_OPEN_BLOCK",
+    [OP_CLOSE_BLOCK] = "OP_CLOSE_BLOCK",
+    [OP_DIVIDE_BLOCK] = "OP_DIVIDE_BLOCK",
+    [OP_BREAK] = "OP_BREAK",
+    [OP_BREAK_AND_POP] = "OP_BREAK_AND_POP",
+    [OP_HALT] = "OP_HALT",
+    [OP_PUSH_FACE] = "OP_PUSH_FACE",
+    [OP_ROTATE_BY] = "OP_ROTATE_BY",
+    [OP_MOVE_LEFT_N] = "OP_MOVE_LEFT_N",
+    [OP_MOVE_RIGHT_N] = "OP_MOVE_RIGHT_N",
+    [OP_MATHS_CONST_RIGHT] = "OP_MATHS_CONST_RIGHT",
+    [OP_COMPARE_CONST_RIGHT] = "OP_COMPARE_CONST_RIGHT",
+    [OP_LOOP_COUNT_DOWN] = "OP_LOOP_COUNT_DOWN",
+    [OP_LOOP_ROTATE] = "OP_LOOP_ROTATE",
+    [OP_LOOP_DRAIN] = "OP_LOOP_DRAIN",
+};
+
+static const Opcode optype_opcode_table[256] = {
+    [SET_CURRENT] = OP_SET_CURRENT,
+    [COUNT] = OP_COUNT,
+    [REVERSE] = OP_REVERSE,
+    [ROTATE] = OP_ROTATE,
+    [MOVE_LEFT] = OP_MOVE_LEFT,
+    [MOVE_RIGHT] = OP_MOVE_RIGHT,
+    [COPY_LEFT] = OP_COPY_LEFT,
+    [COPY_RIGHT] = OP_COPY_RIGHT,
+    [ASSIGN] = OP_ASSIGN,
+    [INSERT] = OP_INSERT,
+    [EXPLODE_LEFT] = OP_EXPLODE_LEFT,
+    [EXPLODE_RIGHT] = OP_EXPLODE_RIGHT,
+    [IMPLODE_LEFT] = OP_IMPLODE_LEFT,
+    [IMPLODE_RIGHT] = OP_IMPLODE_RIGHT,
+    [PRINT] = OP_PRINT,
+    [PRINT_AND_POP] = OP_PRINT_AND_POP,
+    [INPUT] = OP_INPUT,
+    [MATHS_LEFT] = OP_MATHS_LEFT,
+    [MATHS_RIGHT] = OP_MATHS_RIGHT,
+    [COMPARE_LEFT] = OP_COMPARE_LEFT,
+    [COMPARE_RIGHT] = OP_COMPARE_RIGHT,
+    [OPEN_BLOCK] = OP_OPEN_BLOCK,
+    [CLOSE_BLOCK] = OP_CLOSE_BLOCK,
+    [DIVIDE_BLOCK] = OP_DIVIDE_BLOCK,
+    [BREAK] = OP_BREAK,
+    [BREAK_AND_POP] = OP_BREAK_AND_POP,
+};
+
+// Slot of the list that is current when a program starts (named ':')
+#define DEFAULT_LIST 0
+
+typedef struct {
+    unsigned char op;
+    char nose;
+    // Index into Program.literals for OP_PUSH, or where a block instruction jumps to
+    unsigned int arg;
+    // Slot of the list the emoticon operates on (its interned eyes)
+    unsigned int list;
+} Instruction;
+
+typedef struct {
+    unsigned int line;
+    unsigned int column;
+} SourcePos;
+
+/**
+ * Interned list names. Each distinct name gets a dense id (its index in names), found
+ * through an open addressing hash table of ids + 1 (0 marks an empty bucket).
+ */
+typedef struct {
+    char **names;
+    size_t size;
+    size_t max_size;
+
+    unsigned int *buckets;
+    size_t buckets_size;
+
+    // Holds the names
+    Arena arena;
+} SymbolTable;
+
+typedef struct {
+    Instruction *code;
+    // Where each instruction came from, only needed for diagnostics
+    SourcePos *positions;
+    size_t size;
+    size_t max_size;
+
+    SymbolTable symbols;
+
+    // Long literal strings live in the strings arena, so literals are never freed
+    Value *literals;
+    size_t literals_size;
+    size_t literals_max_size;
+    Arena strings;
+} Program;
+
+/**
+ * A lexeme compiled on its own, before it is added to a program. value is the literal of
+ * an OP_PUSH, or the list name (eyes) of an emoticon.
+ */
+typedef struct {
+    Instruction ins;
+    SourcePos pos;
+    Value value;
+} CompiledLexeme;
+
+// The arg of a block jump whose target has not been compiled yet (see link_last)
+#define UNLINKED UINT_MAX
+
+// The ( of the blocks that are open in a program being compiled
+typedef struct {
+    size_t *opens;
+    size_t depth;
+    size_t max_depth;
+} OpenBlocks;
+
+unsigned int intern(SymbolTable *t, const char *name, size_t len);
+unsigned int add_literal(Program *p, Value v);
+void link_blocks(Program *p);
+void link_last(Program *p, OpenBlocks *b);
+void free_symbols(SymbolTable t);
+
+bool compile_lexeme(const char *s, Lexeme lx, bool *obfuscated, Arena *strings, CompiledLexeme *out);
+void append_lexeme(Program *p, const CompiledLexeme *c);
+void compile_source(Source *src, Program *p);
+Program compile(FILE *f);
+void free_program(Program p);
+
+static inline SourcePos ins_pos(const Program *p, const Instruction *ins){
+    return p->positions[ins - p->code];
+}
+
+#endif
@@ -1,40 +1,129 @@
-// #include "lex.h"
-// #include "error.h"
+#include "interpret.h"
+#include "optimise.h"
+#include "cache.h"
+#include "batch.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-
-FILE* codefile;
-
-int main(void){
-    // const char *obs_emoticons[] = {
-    //     ":)`", "8)`", "B)`", ":]`", "8]`", "B]`", ":[`", "8[`", "B[`", ":(`", "8(`", "B(`",
-    //     ":)-", "8)-", "B)-", ":]-", "8]-", "B]-", ":[-", "8[-", "B[-", ":(-", "8(-", "B(-",
-    //     ":)~", "8)~", "B)~", ":]~", "8]~", "B]~", ":[~", "8[~", "B[~", ":(~", "8(~", "B(~",
-    // };
-    
-    // for (int i = 0; i < (int)sizeof(OBFUSCATED_CHARS); i++){
-    //     if (deobfuscate_emoticon(obs_emoticons[i]) != OBFUSCATED_CHARS[i]){
-    //         ERROR("Assertion error: '%s' should be deobfuscated to '%c' not '%c'", obs_emoticons[i], OBFUSCATED_CHARS[i], deobfuscate_emoticon(obs_emoticons[i]));
-    //     }
-    // }
-
-    // codefile = fopen("test.txt", "r");
-
-    // printf("ungot %c\n", ungetch());
-    // printf("got %c\n", getch());
-    // printf("got %c\n", getch());
-    // printf("ungot %c\n", ungetch());
-    // printf("got %c\n", getch());
-    
-    // for (int i = 0; i < 30; i++){
-    //     printf("got %c\n", getch());
-    // }
-
-    // printf("ungot %c\n", ungetch());
-    // printf("got %c\n", getch());
-
-    return 0;
-}
\ No newline at end of file
+
+static void usage(const char *prog){
+    fprintf(stderr, "Usage: %s [--opt-level=N] [--jit] [--stream] [--no-cache] [--profile] [--profile-stacks=FILE]\n"
+                    "       %*s [--trace=FILE] [code file]\n"
+                    "       %s [--opt-level=N] [--jit] [--jobs=N] --batch=FILE\n"
+                    "Reads the code from stdin if no file (or '-') is given.\n"
+                    "  --opt-level=N  How much to optimise the program, from 0 (not at all) to %d (default)\n"
+                    "  --jit          Compile hot loops to machine code (x86-64 Linux only)\n"
+                    "  --stream       Start running the code while it is still being read, unoptimised\n"
+                    "  --no-cache     Do not keep the compiled program next to the code file (in a .emoc file)\n"
+                    "  --profile      Report how often each instruction ran and how long it took, to stderr\n"
+                    "  --profile-stacks=FILE  Also write the profile to FILE as collapsed stacks, for flame graphs\n"
+                    "  --trace=FILE   Record every instruction run to FILE, to read with emotrace\n"
+                    "  --batch=FILE   Run every job in FILE, a line each of '<code file> <input file> <output file>'\n"
+                    "  --jobs=N       How many jobs of a batch to run at once (default: one per CPU)\n",
+            prog, (int) strlen(prog), "", prog, OPT_MAX);
+}
+
+int main(int argc, char **argv){
+    const char *path = NULL;
+    int opt_level = OPT_MAX;
+    bool jit = false;
+    bool stream = false;
+    bool use_cache = true;
+    bool profile = false;
+    const char *profile_stacks = NULL;
+    const char *trace = NULL;
+    const char *batch = NULL;
+    unsigned int workers = batch_default_workers();
+
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--opt-level=", 12)) {
+            char *end = NULL;
+            long level = strtol(argv[i] + 12, &end, 10);
+            if (end == argv[i] + 12 || *end || level < OPT_NONE || level > OPT_MAX) {
+                usage(argv[0]);
+                return 1;
+            }
+            opt_level = (int) level;
+        } else if (!strcmp(argv[i], "--jit")) {
+            jit = true;
+        } else if (!strcmp(argv[i], "--stream")) {
+            stream = true;
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            use_cache = false;
+        } else if (!strcmp(argv[i], "--profile")) {
+            profile = true;
+        } else if (!strncmp(argv[i], "--profile-stacks=", 17) && argv[i][17]) {
+            profile = true;
+            profile_stacks = argv[i] + 17;
+        } else if (!strncmp(argv[i], "--trace=", 8) && argv[i][8]) {
+            trace = argv[i] + 8;
+        } else if (!strncmp(argv[i], "--batch=", 8) && argv[i][8]) {
+            batch = argv[i] + 8;
+        } else if (!strncmp(argv[i], "--jobs=", 7)) {
+            char *end = NULL;
+            long jobs = strtol(argv[i] + 7, &end, 10);
+            if (end == argv[i] + 7 || *end || jobs < 1 || jobs > 4096) {
+                usage(argv[0]);
+                return 1;
+            }
+            workers = (unsigned int) jobs;
+        } else if (!path && (argv[i][0] != '-' || !argv[i][1])) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (batch) {
+        if (path || stream || profile || trace) {
+            usage(argv[0]);
+            return 1;
+        }
+        FILE *list = !strcmp(batch, "-") ? stdin : fopen(batch, "r");
+        if (!list) {
+            fprintf(stderr, "Could not open job list '%s'\n", batch);
+            return 1;
+        }
+        int res = batch_run(list, opt_level, jit, workers);
+        if (list != stdin) {
+            fclose(list);
+        }
+        return res;
+    }
+
+    FILE *codefile;
+    if (!path || !strcmp(path, "-")) {
+        codefile = stdin;
+    } else {
+        codefile = fopen(path, "r");
+        if (!codefile) {
+            fprintf(stderr, "Could not open code file '%s'\n", path);
+            return 1;
+        }
+    }
+
+    // Programs read from stdin have nowhere to be cached
+    char *cache = use_cache && codefile != stdin ? cache_path(path) : NULL;
+
+    int res = interpret((InterpeterOptions){
+        .input = stdin,
+        .output = stdout,
+        .code = codefile,
+        .opt_level = opt_level,
+        .jit = jit,
+        .stream = stream,
+        .cache = cache,
+        .profile = profile,
+        .profile_stacks = profile_stacks,
+        .trace = trace
+    });
+    free(cache);
+
+    if (codefile != stdin) {
+        fclose(codefile);
+    }
+
+    return res;
+}
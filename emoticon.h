@@ -0,0 +1,48 @@
+#ifndef __EMOTICON_H__
+#define __EMOTICON_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * The API of libemoticon, for running Emoticon programs from C without a process each.
+ *
+ * A program is compiled once and can then be run any number of times, by any number of
+ * instances (on any threads) at once. An instance holds the lists a program runs on, and is
+ * meant to be kept in a pool: each run starts from empty lists, but they keep their memory
+ * from the last run, so running the same program again does not allocate until it needs
+ * more than before. emo_reset empties them straight away (say, before the instance goes
+ * back to its pool). An instance must only be used by one thread at a time.
+ *
+ * Nothing here exits the process: errors come back as a status, with their message kept
+ * by the instance until its next call.
+ */
+
+typedef struct EmoProgram EmoProgram;
+typedef struct EmoInstance EmoInstance;
+
+typedef enum {
+    EMO_OK,
+    // The code could not be read or compiled
+    EMO_COMPILE_ERROR,
+    // The program stopped with an error, after writing out what it printed before it
+    EMO_RUNTIME_ERROR
+} EmoStatus;
+
+// Optimisation levels to compile with, from not at all to as much as possible
+#define EMO_OPT_NONE 0
+#define EMO_OPT_MAX 3
+
+EmoInstance *emo_new(bool jit);
+void emo_free(EmoInstance *e);
+const char *emo_error(const EmoInstance *e);
+
+EmoStatus emo_compile(EmoInstance *e, const char *code, size_t size, int opt_level, EmoProgram **out);
+EmoStatus emo_compile_file(EmoInstance *e, FILE *code, int opt_level, EmoProgram **out);
+void emo_free_program(EmoProgram *p);
+
+EmoStatus emo_run(EmoInstance *e, const EmoProgram *p, FILE *input, FILE *output);
+void emo_reset(EmoInstance *e);
+
+#endif
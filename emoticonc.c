@@ -0,0 +1,266 @@
+#include "compile.h"
+#include "optimise.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+static void usage(const char *prog){
+    fprintf(stderr, "Usage: %s [--opt-level=N] [code file] [-o output file]\n"
+                    "Translates an Emoticon program into C, to be compiled against the runtime.\n"
+                    "Reads the code from stdin if no file (or '-') is given, and writes to stdout\n"
+                    "if no output file is given.\n"
+                    "  --opt-level=N  How much to optimise the program, from 0 (not at all) to %d (default)\n",
+            prog, OPT_MAX);
+}
+
+/* Emitting */
+
+static void emit_string(FILE *out, const char *s){
+    fputc('"', out);
+    for (; *s; s++){
+        const unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\' || c == '?'){
+            fprintf(out, "\\%c", c);
+        } else if (c < ' ' || c > '~'){
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void emit_literal(FILE *out, const Value *v){
+    switch (v->type) {
+        case VAL_INT:
+            fprintf(out, "int_val(%d)", v->i);
+            break;
+        case VAL_DOUBLE:
+            if (isnan(v->d)){
+                fprintf(out, "double_val(NAN)");
+            } else if (isinf(v->d)){
+                fprintf(out, "double_val(%sHUGE_VAL)", v->d < 0 ? "-" : "");
+            } else {
+                fprintf(out, "double_val(%a)", v->d);
+            }
+            break;
+        default: {
+            const char *s = val_str(v);
+            if (strlen(s) < VALUE_INLINE_SIZE){
+                fprintf(out, "str_val(NULL, ");
+                emit_string(out, s);
+                fprintf(out, ", %zu)", strlen(s));
+            } else {
+                // Long literals are never freed, like those of compiled programs
+                fprintf(out, "(Value){ .str = (char *) ");
+                emit_string(out, s);
+                fprintf(out, ", .type = VAL_STR, .storage = TKN_BORROWED }");
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Where an instruction jumps to, if it does
+ */
+static bool jump_target(const Program *p, size_t pc, size_t *target){
+    switch (p->code[pc].op) {
+        case OP_OPEN_BLOCK:
+        case OP_CLOSE_BLOCK:
+        case OP_DIVIDE_BLOCK:
+        case OP_BREAK:
+        case OP_BREAK_AND_POP:
+            *target = p->code[pc].arg;
+            return true;
+        case OP_LOOP_COUNT_DOWN:
+        case OP_LOOP_ROTATE:
+        case OP_LOOP_DRAIN:
+            // Guards skip the loop after them
+            *target = p->code[pc + 1].arg;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Writes the statement running one instruction
+ */
+static void emit_instruction(FILE *out, const Program *p, size_t pc){
+    const Instruction *ins = &p->code[pc];
+    size_t target = 0;
+    jump_target(p, pc, &target);
+
+    switch (ins->op) {
+        case OP_SET_CURRENT:
+            fprintf(out, "    s.current = %u;\n", ins->list);
+            break;
+        case OP_REVERSE:
+            fprintf(out, "    lreverse(&s.lists[%u].list);\n", ins->list);
+            break;
+        case OP_ROTATE_BY:
+            fprintf(out, "    lrotate(&s.lists[%u].list, %d);\n", ins->list, p->literals[ins->arg].i);
+            break;
+        case OP_OPEN_BLOCK:
+        case OP_DIVIDE_BLOCK:
+            fprintf(out, "    if (!test_truthy(&s, &code[%zu])) goto L%zu;\n", pc, target);
+            break;
+        case OP_BREAK:
+            fprintf(out, "    if (test_truthy(&s, &code[%zu])) goto L%zu;\n", pc, target);
+            break;
+        case OP_BREAK_AND_POP:
+            fprintf(out, "    if (test_break_and_pop(&s, &code[%zu])) goto L%zu;\n", pc, target);
+            break;
+        case OP_CLOSE_BLOCK:
+            fprintf(out, "    goto L%zu;\n", target);
+            break;
+        case OP_LOOP_COUNT_DOWN:
+        case OP_LOOP_ROTATE:
+        case OP_LOOP_DRAIN:
+            fprintf(out, "    if (guard_%s(&s, &code[%zu])) goto L%zu;\n", opcode_names[ins->op], pc, target);
+            break;
+        case OP_HALT:
+            fprintf(out, "    runtime_stop(&s);\n    return 0;\n");
+            break;
+        default:
+            fprintf(out, "    step_%s(&s, &code[%zu]);\n", opcode_names[ins->op], pc);
+            break;
+    }
+}
+
+/**
+ * @brief Translates a compiled program into C: a main function running the instructions
+ * in order, with blocks as gotos. The instructions are kept as data for the runtime,
+ * which reports errors at their source positions.
+ */
+static void emit_program(FILE *out, const Program *p, const char *source){
+    fprintf(out, "/* Generated by emoticonc from %s. Do not edit. */\n\n", source);
+    fprintf(out, "#include \"runtime.h\"\n#include \"interpret.h\"\n\n#include <math.h>\n\n");
+
+    fprintf(out, "static char *names[] = {\n");
+    for (size_t i = 0; i < p->symbols.size; i++){
+        fprintf(out, "    ");
+        emit_string(out, p->symbols.names[i]);
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const Instruction code[] = {\n");
+    for (size_t pc = 0; pc < p->size; pc++){
+        const Instruction *ins = &p->code[pc];
+        fprintf(out, "    { .op = %s, .nose = %d, .arg = %u, .list = %u },\n",
+                opcode_names[ins->op], ins->nose, ins->arg, ins->list);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static SourcePos positions[] = {\n");
+    for (size_t pc = 0; pc < p->size; pc++){
+        fprintf(out, "    { %u, %u },\n", p->positions[pc].line, p->positions[pc].column);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static Value literals[%zu];\n\n", p->literals_size ? p->literals_size : 1);
+
+    bool *targets = (bool *)calloc(p->size, sizeof(bool));
+    if (!targets){
+        ERROR("Failed to allocate memory for a program of %zu instructions", p->size);
+    }
+    for (size_t pc = 0; pc < p->size; pc++){
+        size_t target;
+        if (jump_target(p, pc, &target)){
+            targets[target] = true;
+        }
+    }
+
+    fprintf(out, "int main(void){\n");
+    for (size_t i = 0; i < p->literals_size; i++){
+        fprintf(out, "    literals[%zu] = ", i);
+        emit_literal(out, &p->literals[i]);
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "\n    const Program p = {\n"
+                 "        .code = (Instruction *) code,\n"
+                 "        .positions = positions,\n"
+                 "        .size = %zu,\n"
+                 "        .symbols = { .names = names, .size = %zu },\n"
+                 "        .literals = literals,\n"
+                 "        .literals_size = %zu\n"
+                 "    };\n"
+                 "    RunState s;\n"
+                 "    runtime_start(&s, &p, stdin, stdout);\n\n",
+            p->size, p->symbols.size, p->literals_size);
+
+    for (size_t pc = 0; pc < p->size; pc++){
+        if (targets[pc]){
+            fprintf(out, "L%zu:\n", pc);
+        }
+        emit_instruction(out, p, pc);
+    }
+    fprintf(out, "}\n");
+
+    free(targets);
+}
+
+int main(int argc, char **argv){
+    const char *path = NULL;
+    const char *out_path = NULL;
+    int opt_level = OPT_MAX;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--opt-level=", 12)) {
+            char *end = NULL;
+            long level = strtol(argv[i] + 12, &end, 10);
+            if (end == argv[i] + 12 || *end || level < OPT_NONE || level > OPT_MAX) {
+                usage(argv[0]);
+                return 1;
+            }
+            opt_level = (int) level;
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc && !out_path) {
+            out_path = argv[++i];
+        } else if (!path && (argv[i][0] != '-' || !argv[i][1])) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *codefile = stdin;
+    if (path && strcmp(path, "-")) {
+        codefile = fopen(path, "r");
+        if (!codefile) {
+            fprintf(stderr, "Could not open code file '%s'\n", path);
+            return 1;
+        }
+    }
+
+    Program p = compile(codefile);
+    optimise(&p, opt_level);
+    if (codefile != stdin) {
+        fclose(codefile);
+    }
+
+    FILE *out = stdout;
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            fprintf(stderr, "Could not open output file '%s'\n", out_path);
+            free_program(p);
+            return 1;
+        }
+    }
+
+    emit_program(out, &p, path && strcmp(path, "-") ? path : "stdin");
+
+    free_program(p);
+    if (out != stdout && fclose(out)) {
+        fprintf(stderr, "Could not write output file '%s'\n", out_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,228 @@
+#include "trace.h"
+#include "compile.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// How many spans of the trace list growth is summarised over, by default
+#define DEFAULT_SPANS 10
+#define MAX_SPANS 100
+
+static void usage(const char *prog){
+    fprintf(stderr, "Usage: %s [--records] [--spans=N] trace file\n"
+                    "Decodes a trace written by emoticon --trace, summarising how each list grew.\n"
+                    "  --records      Also print every instruction run, with where it is in the code\n"
+                    "  --spans=N      How many parts of the trace to show list sizes at, from 1 to %d (default %d)\n",
+            prog, MAX_SPANS, DEFAULT_SPANS);
+}
+
+typedef struct {
+    TraceHeader header;
+    TraceInstruction *code;
+    // The list names, NUL terminated one after another, and where each starts
+    char *names;
+    char **symbols;
+    uint64_t records_size;
+} TraceFile;
+
+// How a list grew, as seen while it was the current list
+typedef struct {
+    uint32_t size;
+    uint32_t peak;
+    // Index of the instruction that first made it its peak size
+    uint32_t peak_index;
+    bool seen;
+} ListHistory;
+
+/**
+ * @brief Reads everything in a trace file before its records, leaving f at the first
+ *
+ * @return 0 on success, or 1 if it is not a trace file (which is printed)
+ */
+static int read_trace(FILE *f, TraceFile *t){
+    *t = (TraceFile){ 0 };
+    TraceHeader *h = &t->header;
+    if (fread(h, sizeof(*h), 1, f) != 1 || memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic))){
+        fprintf(stderr, "Not a trace file\n");
+        return 1;
+    }
+    if (h->version != TRACE_VERSION){
+        fprintf(stderr, "Trace file is version %u, but this reads version %d\n", h->version, TRACE_VERSION);
+        return 1;
+    }
+
+    t->code = (TraceInstruction *)malloc((h->code_size ? h->code_size : 1) * sizeof(TraceInstruction));
+    t->names = (char *)malloc(h->names_size ? h->names_size : 1);
+    t->symbols = (char **)malloc((h->symbols_size ? h->symbols_size : 1) * sizeof(char *));
+    if (!t->code || !t->names || !t->symbols){
+        ERROR("Failed to allocate memory for a trace of %llu instructions", (unsigned long long) h->code_size);
+    }
+    if (fread(t->code, sizeof(TraceInstruction), h->code_size, f) != h->code_size ||
+            fread(t->names, 1, h->names_size, f) != h->names_size){
+        fprintf(stderr, "Trace file is cut short\n");
+        return 1;
+    }
+
+    size_t at = 0;
+    for (size_t i = 0; i < h->symbols_size; i++){
+        const char *end = at < h->names_size ? memchr(t->names + at, '\0', h->names_size - at) : NULL;
+        if (!end){
+            fprintf(stderr, "Trace file is damaged\n");
+            return 1;
+        }
+        t->symbols[i] = t->names + at;
+        at = (size_t) (end - t->names) + 1;
+    }
+
+    // Everything after is records
+    const long start = ftell(f);
+    if (start < 0 || fseek(f, 0, SEEK_END)){
+        fprintf(stderr, "Could not read the trace file\n");
+        return 1;
+    }
+    t->records_size = (uint64_t) (ftell(f) - start) / sizeof(TraceRecord);
+    fseek(f, start, SEEK_SET);
+    return 0;
+}
+
+static void free_trace(TraceFile *t){
+    free(t->code);
+    free(t->names);
+    free(t->symbols);
+}
+
+static void print_instruction(const TraceFile *t, uint32_t index){
+    const TraceInstruction *ins = &t->code[index];
+    printf("%6u:%-6u %-24s", ins->line, ins->column, ins->op < NUM_OPCODES ? opcode_names[ins->op] : "?");
+}
+
+/**
+ * @brief Prints how big each list was at the end of each span, and at its biggest. Lists
+ * are only seen while they are current, so a list changed through another's face shows
+ * the size it had when it was last current.
+ */
+static void print_growth(const TraceFile *t, const ListHistory *lists, const uint32_t *spans, unsigned int spans_size){
+    printf("\nList sizes (when last current) at the end of each %u%% of the trace:\n", 100 / spans_size);
+    printf("%-16s %10s  %-38s", "list", "peak", "first peaked at");
+    for (unsigned int i = 1; i <= spans_size; i++){
+        printf(" %9u%%", i * 100 / spans_size);
+    }
+    printf("\n");
+
+    for (size_t l = 0; l < t->header.symbols_size; l++){
+        if (!lists[l].seen){
+            continue;
+        }
+        printf("%-16s %10u  ", t->symbols[l], lists[l].peak);
+        print_instruction(t, lists[l].peak_index);
+        for (unsigned int i = 0; i < spans_size; i++){
+            printf(" %10u", spans[l * spans_size + i]);
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * @brief Reads every record of a trace, printing each if records is set, then summarises
+ * how the lists grew
+ *
+ * @return 0, or 1 if the trace is damaged
+ */
+static int decode(FILE *f, const TraceFile *t, bool records, unsigned int spans_size){
+    const size_t symbols = t->header.symbols_size;
+    ListHistory *lists = (ListHistory *)calloc(symbols ? symbols : 1, sizeof(ListHistory));
+    uint32_t *spans = (uint32_t *)calloc((symbols ? symbols : 1) * spans_size, sizeof(uint32_t));
+    TraceRecord *buf = (TraceRecord *)malloc(TRACE_BUFFER_RECORDS * sizeof(TraceRecord));
+    if (!lists || !spans || !buf){
+        ERROR("Failed to allocate memory for decoding a trace");
+    }
+
+    printf("Trace: %llu instructions run, of %llu in the program\n",
+           (unsigned long long) t->records_size, (unsigned long long) t->header.code_size);
+    int res = 0;
+    uint64_t seen = 0;
+    unsigned int span = 0;
+    size_t got;
+    while (!res && (got = fread(buf, sizeof(TraceRecord), TRACE_BUFFER_RECORDS, f)) > 0){
+        for (size_t i = 0; i < got; i++, seen++){
+            const TraceRecord *r = &buf[i];
+            if (r->index >= t->header.code_size || r->list >= symbols){
+                fprintf(stderr, "Trace file is damaged at record %llu\n", (unsigned long long) seen);
+                res = 1;
+                break;
+            }
+
+            ListHistory *l = &lists[r->list];
+            if (!l->seen || r->size > l->peak){
+                l->peak = r->size;
+                l->peak_index = r->index;
+            }
+            l->size = r->size;
+            l->seen = true;
+            if (records){
+                printf("%12llu ", (unsigned long long) seen);
+                print_instruction(t, r->index);
+                printf(" %-16s %u\n", t->symbols[r->list], r->size);
+            }
+
+            // Every list's size is noted at the end of each span
+            while (span < spans_size && (seen + 1) * spans_size >= (span + 1) * t->records_size){
+                for (size_t j = 0; j < symbols; j++){
+                    spans[j * spans_size + span] = lists[j].size;
+                }
+                span++;
+            }
+        }
+    }
+
+    if (!res){
+        print_growth(t, lists, spans, spans_size);
+    }
+    free(lists);
+    free(spans);
+    free(buf);
+    return res;
+}
+
+int main(int argc, char **argv){
+    const char *path = NULL;
+    bool records = false;
+    unsigned int spans = DEFAULT_SPANS;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--records")) {
+            records = true;
+        } else if (!strncmp(argv[i], "--spans=", 8)) {
+            char *end = NULL;
+            long n = strtol(argv[i] + 8, &end, 10);
+            if (end == argv[i] + 8 || *end || n < 1 || n > MAX_SPANS) {
+                usage(argv[0]);
+                return 1;
+            }
+            spans = (unsigned int) n;
+        } else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Could not open trace file '%s'\n", path);
+        return 1;
+    }
+    TraceFile t;
+    int res = read_trace(f, &t) || decode(f, &t, records, spans);
+    free_trace(&t);
+    fclose(f);
+    return res;
+}
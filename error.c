@@ -0,0 +1,35 @@
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <setjmp.h>
+
+_Thread_local ErrorTrap *error_trap = NULL;
+
+/**
+ * @brief Reports an error: to the error trap of this thread if it has one, otherwise by
+ * printing it and exiting
+ */
+void fail(const char *msg, ...){
+    va_list args;
+    va_start(args, msg);
+    if (error_trap){
+        vsnprintf(error_trap->message, ERROR_MESSAGE_SIZE, msg, args);
+        va_end(args);
+        longjmp(error_trap->env, 1);
+    }
+    vfprintf(stderr, msg, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(1);
+}
+
+/**
+ * @brief Reports an error at a place in the source, as "<kind>message (line l, col c)"
+ */
+void fail_at(const char *kind, unsigned int line, unsigned int column, const char *msg, va_list args){
+    char message[ERROR_MESSAGE_SIZE];
+    vsnprintf(message, sizeof(message), msg, args);
+    fail("%s%s (line %u, col %u)", kind, message, line, column);
+}
@@ -3,9 +3,27 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <setjmp.h>
 
-#define ERROR(msg, ...) {fprintf(\
-    stderr, "[Error]" __FILE__ "@%d:" msg "\n", __LINE__ __VA_OPT__(,) __VA_ARGS__); exit(1);}
+// Longest error message (including the terminator) kept by an ErrorTrap
+#define ERROR_MESSAGE_SIZE 512
+
+/**
+ * Catches errors on the thread that set error_trap to it, instead of them ending the
+ * process: fail longjmps back to env with the error's message.
+ */
+typedef struct {
+    jmp_buf env;
+    char message[ERROR_MESSAGE_SIZE];
+} ErrorTrap;
+
+extern _Thread_local ErrorTrap *error_trap;
+
+_Noreturn void fail(const char *msg, ...);
+_Noreturn void fail_at(const char *kind, unsigned int line, unsigned int column, const char *msg, va_list args);
+
+#define ERROR(msg, ...) fail("[Error]" __FILE__ "@%d:" msg, __LINE__ __VA_OPT__(,) __VA_ARGS__)
 
 #define TFREE(v) {\
     if (v) {\
@@ -14,4 +32,4 @@
     }\
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,1352 @@
+#include "interpret.h"
+#include "compile.h"
+#include "optimise.h"
+#include "runtime.h"
+#include "jit.h"
+#include "stream.h"
+#include "cache.h"
+#include "profile.h"
+#include "trace.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <stdint.h>
+
+// Threaded dispatch (computed goto) when the compiler supports it, otherwise a switch
+#if defined(__GNUC__) && !defined(EMOTICON_SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+/* Output */
+
+/**
+ * @brief Writes out everything printed so far
+ */
+static void flush_output(RunState *s){
+    if (s->output_size){
+        fwrite(s->output_buffer, 1, s->output_size, s->output);
+        s->output_size = 0;
+    }
+    fflush(s->output);
+}
+
+/**
+ * @brief Prints a value and a newline into the output buffer, flushing it when full
+ */
+static void print(RunState *s, const Value v){
+    size_t len = val_write(&v, s->output_buffer + s->output_size, OUTPUT_BUFFER_SIZE - s->output_size);
+    if (len >= OUTPUT_BUFFER_SIZE - s->output_size){
+        flush_output(s);
+        len = val_write(&v, s->output_buffer, OUTPUT_BUFFER_SIZE);
+        if (len >= OUTPUT_BUFFER_SIZE){
+            // Too long to buffer
+            fputs(val_str(&v), s->output);
+            fputc('\n', s->output);
+            return;
+        }
+    }
+    // The newline goes over the terminator
+    s->output_buffer[s->output_size + len] = '\n';
+    s->output_size += len + 1;
+}
+
+/* Error */
+
+static _Noreturn void run_err(RunState *s, const Instruction *ins, const char *msg, ...) {
+    const SourcePos pos = ins_pos(s->program, ins);
+    flush_output(s);
+    va_list args;
+    va_start(args, msg);
+    fail_at("Runtime Error: ", pos.line, pos.column, msg, args);
+}
+
+/* Lists */
+
+/**
+ * @brief Makes sure every list slot below a count exists. New slots start as empty lists
+ * that only allocate once something is inserted.
+ */
+static void grow_lists(RunState *s, size_t count){
+    size_t new_max = s->lists_max_size ? s->lists_max_size : 8;
+    while (new_max < count){
+        new_max *= 2;
+    }
+
+    if (new_max > s->lists_max_size){
+        EmoList *temp = (EmoList *)realloc(s->lists, new_max * sizeof(EmoList));
+        if (!temp){
+            ERROR("Failed to allocate memory for %zu lists", new_max);
+        }
+        s->lists = temp;
+        s->lists_max_size = new_max;
+    }
+
+    for (; s->lists_size < count; s->lists_size++){
+        s->lists[s->lists_size] = (EmoList){
+            .name = s->program->symbols.names[s->lists_size],
+            .list = { .pool = &s->pool }
+        };
+    }
+}
+
+/**
+ * @brief Gets the slot of an instruction's list, creating it if it first appears at runtime
+ */
+static inline size_t list_slot(RunState *s, unsigned int id){
+    if (id >= s->lists_size){
+        grow_lists(s, (size_t) id + 1);
+    }
+    return id;
+}
+
+/**
+ * @brief Frees every list, releasing all runtime strings at once with the pool
+ */
+static void free_lists(RunState *s){
+    for (size_t i = 0; i < s->lists_size; i++){
+        lrelease(s->lists[i].list);
+    }
+    TFREE(s->lists);
+    s->lists_size = 0;
+    s->lists_max_size = 0;
+    pool_destroy(&s->pool);
+    TFREE(s->scratch);
+    s->scratch_size = 0;
+}
+
+static void push(RunState *s, size_t li, Value v, const Instruction *ins){
+    List *l = &s->lists[li].list;
+    if (linsert(l, l->size, v)){
+        run_err(s, ins, "Could not grow list '%s' to %zu elements", s->lists[li].name, l->size + 1);
+    }
+}
+
+static Value pop(RunState *s, size_t li, const Instruction *ins){
+    List *l = &s->lists[li].list;
+    Value v;
+    if (lpop(l, l->size - 1, &v)){
+        run_err(s, ins, "Cannot pop from empty list '%s'", s->lists[li].name);
+    }
+    return v;
+}
+
+static void clear(RunState *s, size_t li){
+    lfree(s->lists[li].list);
+    s->lists[li].list = (List){ .pool = &s->pool };
+}
+
+static void drop(RunState *s, Value v){
+    free_val(&s->pool, v);
+}
+
+/**
+ * @brief Makes sure the s->scratch buffer holds at least size bytes
+ */
+static void reserve_scratch(RunState *s, size_t size){
+    if (size <= s->scratch_size){
+        return;
+    }
+
+    size_t new_size = s->scratch_size ? s->scratch_size : 256;
+    while (new_size < size){
+        new_size *= 2;
+    }
+    char *temp = (char *)realloc(s->scratch, new_size);
+    if (!temp){
+        ERROR("Failed to allocate a buffer of %zu bytes", new_size);
+    }
+    s->scratch = temp;
+    s->scratch_size = new_size;
+}
+
+/**
+ * @brief Appends the text of a value to the s->scratch buffer at len
+ *
+ * @return The new length of the string in the s->scratch buffer
+ */
+static size_t append_scratch(RunState *s, size_t len, const Value v){
+    char buf[VALUE_TEXT_SIZE];
+    const char *str = val_text(&v, buf);
+    const size_t slen = strlen(str);
+    reserve_scratch(s, len + slen + 1);
+    memcpy(s->scratch + len, str, slen + 1);
+    return len + slen;
+}
+
+/* Values */
+
+static bool truthy_val(const Value v){
+    switch (v.type) {
+        case VAL_INT:
+            return v.i != 0;
+        case VAL_DOUBLE:
+            return v.d != 0;
+        case VAL_STR:
+            return val_str(&v)[0] != '\0';
+        default:
+            return true;
+    }
+}
+
+/**
+ * @brief Whether the last element of a list is true. Empty lists are false.
+ */
+static bool truthy(RunState *s, size_t li){
+    const List l = s->lists[li].list;
+    Value v;
+    if (lget(l, l.size - 1, &v)){
+        return false;
+    }
+    return truthy_val(v);
+}
+
+/**
+ * @brief Applies a maths operator (one of `+ - * / %`) to two values.
+ * @details `+` concatenates if either value is not a number, see val_maths for numbers.
+ */
+static Value maths(RunState *s, const Instruction *ins, const Value op, const Value a, const Value b){
+    char buf[VALUE_TEXT_SIZE];
+    const char *ops = val_text(&op, buf);
+    if (op.type != VAL_STR || !ops[0] || ops[1]){
+        run_err(s, ins, "Invalid maths operator '%s'", ops);
+    }
+
+    const char o = ops[0];
+
+    if (o == '+' && (!is_number(a) || !is_number(b))){
+        const size_t len = append_scratch(s, append_scratch(s, 0, a), b);
+        return str_val(&s->pool, s->scratch, len);
+    }
+
+    if (!is_number(a) || !is_number(b)){
+        run_err(s, ins, "Maths operator '%c' needs numeric operands", o);
+    }
+
+    Value res = int_val(0);
+    switch (val_maths(o, a, b, &res)) {
+        case MATHS_BAD_OPERATOR:
+            run_err(s, ins, "Invalid maths operator '%c'", o);
+            break;
+        case MATHS_DIVIDE_BY_ZERO:
+            run_err(s, ins, "Division by zero");
+            break;
+        case MATHS_NOT_INTEGER:
+            run_err(s, ins, "Maths operator '%%' needs integer operands");
+            break;
+        default:
+            break;
+    }
+    return res;
+}
+
+/**
+ * @brief Compares two values with a comparison operator, see val_compare
+ */
+static Value compare(RunState *s, const Instruction *ins, const Value op, const Value a, const Value b){
+    Value res;
+    if (val_compare(op, a, b, &res)){
+        char buf[VALUE_TEXT_SIZE];
+        run_err(s, ins, "Invalid comparison operator '%s'", val_text(&op, buf));
+    }
+    return res;
+}
+
+/**
+ * @brief Pushes each character of a value onto a list as a separate string
+ */
+static void explode(RunState *s, const Instruction *ins, Value v, size_t dest){
+    const size_t len = append_scratch(s, 0, v);
+    drop(s, v);
+    List *l = &s->lists[dest].list;
+    if (lappend_chars(l, s->scratch, len)){
+        run_err(s, ins, "Could not grow list '%s' to %zu elements", s->lists[dest].name, l->size + len);
+    }
+}
+
+/**
+ * @brief Joins every element of a list into a single string, emptying the list
+ */
+static Value implode(RunState *s, size_t src){
+    const List l = s->lists[src].list;
+    size_t len = 0;
+    reserve_scratch(s, l.chars ? l.size + 1 : 1);
+    s->scratch[0] = '\0';
+
+    // A packed list already holds the string
+    if (!lget_chars(l, s->scratch)){
+        len = l.size;
+        s->scratch[len] = '\0';
+    } else {
+        for (size_t i = 0; i < l.size; i++){
+            Value v;
+            lget(l, i, &v);
+            len = append_scratch(s, len, v);
+        }
+    }
+
+    clear(s, src);
+    return str_val(&s->pool, s->scratch, len);
+}
+
+/**
+ * @brief Reads a line of input as an int, a double or a string
+ *
+ * @return false on end of input
+ */
+static bool read_input(RunState *s, FILE *f, Value *dest){
+    ssize_t len = getline(&s->scratch, &s->scratch_size, f);
+    if (len < 0){
+        return false;
+    }
+
+    char *line = s->scratch;
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')){
+        line[--len] = '\0';
+    }
+
+    char *end = NULL;
+    long ival = strtol(line, &end, 10);
+    if (len > 0 && end == line + len && ival <= INT_MAX && ival >= INT_MIN){
+        *dest = int_val((int) ival);
+        return true;
+    }
+
+    double dval = strtod(line, &end);
+    if (len > 0 && end == line + len){
+        *dest = double_val(dval);
+        return true;
+    }
+
+    *dest = str_val(&s->pool, line, (size_t) len);
+    return true;
+}
+
+/* Loops */
+
+/**
+ * @brief Gets the count of a counting loop: the int at the top of a list, if it is the
+ * current list (so the loop's maths takes from and gives back to it)
+ *
+ * @return The count as unsigned (which is how many steps it takes to count down to 0,
+ * wrapping around), or SIZE_MAX if the loop cannot be replaced
+ */
+static size_t count_down(RunState *s, size_t li, size_t current){
+    const List l = s->lists[li].list;
+    Value v;
+    if (li != current || lget(l, l.size - 1, &v) || v.type != VAL_INT){
+        return SIZE_MAX;
+    }
+    return (unsigned int) v.i;
+}
+
+/* Steps */
+
+// Steps are instructions that always go on to the next one (see runtime.h)
+
+void step_OP_PUSH(RunState *s, const Instruction *ins){
+    push(s, s->current, s->program->literals[ins->arg], ins);
+}
+
+void step_OP_SET_CURRENT(RunState *s, const Instruction *ins){
+    s->current = list_slot(s, ins->list);
+}
+
+void step_OP_COUNT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const size_t n = s->lists[face].list.size;
+    if (n > INT_MAX){
+        run_err(s, ins, "Size of list '%s' does not fit in an int", s->lists[face].name);
+    }
+    push(s, s->current, int_val((int) n), ins);
+}
+
+void step_OP_REVERSE(RunState *s, const Instruction *ins){
+    lreverse(&s->lists[list_slot(s, ins->list)].list);
+}
+
+void step_OP_ROTATE(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const Value n = pop(s, s->current, ins);
+    if (n.type != VAL_INT){
+        run_err(s, ins, "Rotate amount must be an int");
+    }
+    lrotate(&s->lists[face].list, n.i);
+}
+
+void step_OP_MOVE_LEFT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    push(s, s->current, pop(s, face, ins), ins);
+}
+
+void step_OP_MOVE_RIGHT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    push(s, face, pop(s, s->current, ins), ins);
+}
+
+void step_OP_COPY_LEFT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    if (face != s->current){
+        lfree(s->lists[s->current].list);
+        s->lists[s->current].list = lcopy(&s->lists[face].list);
+    }
+}
+
+void step_OP_COPY_RIGHT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    if (face != s->current){
+        lfree(s->lists[face].list);
+        s->lists[face].list = lcopy(&s->lists[s->current].list);
+    }
+}
+
+void step_OP_ASSIGN(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const Value t = pop(s, s->current, ins);
+    clear(s, face);
+    push(s, face, t, ins);
+}
+
+void step_OP_INSERT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const Value ind = pop(s, s->current, ins);
+    const Value v = pop(s, s->current, ins);
+    if (ind.type != VAL_INT){
+        run_err(s, ins, "Insert index must be an int");
+    }
+    if (ind.i < 0 || linsert(&s->lists[face].list, (size_t) ind.i, v)){
+        run_err(s, ins, "Index %d is out of bounds for list '%s' of size %zu",
+                ind.i, s->lists[face].name, s->lists[face].list.size);
+    }
+}
+
+void step_OP_EXPLODE_LEFT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    explode(s, ins, pop(s, face, ins), s->current);
+}
+
+void step_OP_EXPLODE_RIGHT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    explode(s, ins, pop(s, s->current, ins), face);
+}
+
+void step_OP_IMPLODE_LEFT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    push(s, s->current, implode(s, face), ins);
+}
+
+void step_OP_IMPLODE_RIGHT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    push(s, face, implode(s, s->current), ins);
+}
+
+void step_OP_PRINT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const List l = s->lists[face].list;
+    Value v;
+    if (lget(l, l.size - 1, &v)){
+        run_err(s, ins, "Cannot print from empty list '%s'", s->lists[face].name);
+    }
+    print(s, v);
+}
+
+void step_OP_PRINT_AND_POP(RunState *s, const Instruction *ins){
+    const Value t = pop(s, list_slot(s, ins->list), ins);
+    print(s, t);
+    drop(s, t);
+}
+
+void step_OP_INPUT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    Value v;
+    flush_output(s);
+    if (read_input(s, s->input, &v)){
+        push(s, face, v, ins);
+    }
+}
+
+void step_OP_MATHS_LEFT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const Value op = pop(s, face, ins);
+    const Value b = pop(s, face, ins);
+    const Value a = pop(s, face, ins);
+    push(s, s->current, maths(s, ins, op, a, b), ins);
+    drop(s, op);
+    drop(s, b);
+    drop(s, a);
+}
+
+void step_OP_MATHS_RIGHT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const Value op = pop(s, s->current, ins);
+    const Value b = pop(s, s->current, ins);
+    const Value a = pop(s, s->current, ins);
+    push(s, face, maths(s, ins, op, a, b), ins);
+    drop(s, op);
+    drop(s, b);
+    drop(s, a);
+}
+
+void step_OP_COMPARE_LEFT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const Value op = pop(s, face, ins);
+    const Value b = pop(s, face, ins);
+    const Value a = pop(s, face, ins);
+    push(s, s->current, compare(s, ins, op, a, b), ins);
+    drop(s, op);
+    drop(s, b);
+    drop(s, a);
+}
+
+void step_OP_COMPARE_RIGHT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const Value op = pop(s, s->current, ins);
+    const Value b = pop(s, s->current, ins);
+    const Value a = pop(s, s->current, ins);
+    push(s, face, compare(s, ins, op, a, b), ins);
+    drop(s, op);
+    drop(s, b);
+    drop(s, a);
+}
+
+void step_OP_PUSH_FACE(RunState *s, const Instruction *ins){
+    push(s, list_slot(s, ins->list), s->program->literals[ins->arg], ins);
+}
+
+void step_OP_ROTATE_BY(RunState *s, const Instruction *ins){
+    lrotate(&s->lists[list_slot(s, ins->list)].list, s->program->literals[ins->arg].i);
+}
+
+void step_OP_MOVE_LEFT_N(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    for (unsigned int i = 0; i < ins->arg; i++){
+        push(s, s->current, pop(s, face, ins), ins);
+    }
+}
+
+void step_OP_MOVE_RIGHT_N(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    for (unsigned int i = 0; i < ins->arg; i++){
+        push(s, face, pop(s, s->current, ins), ins);
+    }
+}
+
+// b op :} where b and op are literals, at arg and arg + 1
+void step_OP_MATHS_CONST_RIGHT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const Value a = pop(s, s->current, ins);
+    push(s, face, maths(s, ins, s->program->literals[ins->arg + 1], a, s->program->literals[ins->arg]), ins);
+    drop(s, a);
+}
+
+void step_OP_COMPARE_CONST_RIGHT(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const Value a = pop(s, s->current, ins);
+    push(s, face, compare(s, ins, s->program->literals[ins->arg + 1], a, s->program->literals[ins->arg]), ins);
+    drop(s, a);
+}
+
+// Whether ( | and 3 leave (or skip) their block: whether the top of the face list is true
+bool test_truthy(RunState *s, const Instruction *ins){
+    return truthy(s, list_slot(s, ins->list));
+}
+
+// E pops the top of the face list and leaves the block if it was true
+bool test_break_and_pop(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    bool brk = false;
+    if (s->lists[face].list.size){
+        const Value t = pop(s, face, ins);
+        brk = truthy_val(t);
+        drop(s, t);
+    }
+    return brk;
+}
+
+/* Loop guards */
+
+// Guards come right before the ( of their loop, and do the whole loop if they return true
+
+// : ( 1 - :} : ) sets the count to 0
+bool guard_OP_LOOP_COUNT_DOWN(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    const size_t n = count_down(s, face, s->current);
+    if (n == SIZE_MAX){
+        return false;
+    }
+    if (n){
+        drop(s, pop(s, face, ins));
+        push(s, face, int_val(0), ins);
+    }
+    return true;
+}
+
+// : ( n ;@ 1 - :} : ) rotates ; by n times the count, and sets the count to 0
+bool guard_OP_LOOP_ROTATE(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    // arg is where the rotate is, counting from the (
+    const Instruction *rotate = ins + 1 + ins->arg;
+    const size_t n = count_down(s, face, s->current);
+    if (n == SIZE_MAX || n > INT_MAX){
+        return false;
+    }
+    if (n){
+        const long long amount = (long long) s->program->literals[rotate->arg].i * (long long) n;
+        lrotate(&s->lists[list_slot(s, rotate->list)].list, amount);
+        drop(s, pop(s, face, ins));
+        push(s, face, int_val(0), ins);
+    }
+    return true;
+}
+
+// : ( :< : ) moves the true elements at the top of : to the current list
+bool guard_OP_LOOP_DRAIN(RunState *s, const Instruction *ins){
+    const size_t face = list_slot(s, ins->list);
+    if (face == s->current){
+        return false;
+    }
+
+    List *l = &s->lists[face].list;
+    size_t n = 0;
+    Value v;
+    while (!lget(*l, l->size - 1 - n, &v) && truthy_val(v)){
+        n++;
+    }
+    if (lmove(l, &s->lists[s->current].list, n)){
+        run_err(s, ins, "Could not grow list '%s' to %zu elements", s->lists[s->current].name,
+                s->lists[s->current].list.size + 1);
+    }
+    return true;
+}
+
+static const JitHooks jit_hooks = {
+    .steps = {
+        [OP_PUSH] = step_OP_PUSH,
+        [OP_SET_CURRENT] = step_OP_SET_CURRENT,
+        [OP_COUNT] = step_OP_COUNT,
+        [OP_REVERSE] = step_OP_REVERSE,
+        [OP_ROTATE] = step_OP_ROTATE,
+        [OP_MOVE_LEFT] = step_OP_MOVE_LEFT,
+        [OP_MOVE_RIGHT] = step_OP_MOVE_RIGHT,
+        [OP_COPY_LEFT] = step_OP_COPY_LEFT,
+        [OP_COPY_RIGHT] = step_OP_COPY_RIGHT,
+        [OP_ASSIGN] = step_OP_ASSIGN,
+        [OP_INSERT] = step_OP_INSERT,
+        [OP_EXPLODE_LEFT] = step_OP_EXPLODE_LEFT,
+        [OP_EXPLODE_RIGHT] = step_OP_EXPLODE_RIGHT,
+        [OP_IMPLODE_LEFT] = step_OP_IMPLODE_LEFT,
+        [OP_IMPLODE_RIGHT] = step_OP_IMPLODE_RIGHT,
+        [OP_PRINT] = step_OP_PRINT,
+        [OP_PRINT_AND_POP] = step_OP_PRINT_AND_POP,
+        [OP_INPUT] = step_OP_INPUT,
+        [OP_MATHS_LEFT] = step_OP_MATHS_LEFT,
+        [OP_MATHS_RIGHT] = step_OP_MATHS_RIGHT,
+        [OP_COMPARE_LEFT] = step_OP_COMPARE_LEFT,
+        [OP_COMPARE_RIGHT] = step_OP_COMPARE_RIGHT,
+        [OP_PUSH_FACE] = step_OP_PUSH_FACE,
+        [OP_ROTATE_BY] = step_OP_ROTATE_BY,
+        [OP_MOVE_LEFT_N] = step_OP_MOVE_LEFT_N,
+        [OP_MOVE_RIGHT_N] = step_OP_MOVE_RIGHT_N,
+        [OP_MATHS_CONST_RIGHT] = step_OP_MATHS_CONST_RIGHT,
+        [OP_COMPARE_CONST_RIGHT] = step_OP_COMPARE_CONST_RIGHT,
+    },
+    .truthy = test_truthy,
+    .break_and_pop = test_break_and_pop
+};
+
+/* Running */
+
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/**
+ * @brief Runs a compiled program.
+ * @details Emoticons operate on the list named by their eyes (the face list) and the
+ * current list, which literals are pushed onto. The end of a list is its top.
+ * `LEFT` operations move data from the face list into the current list, `RIGHT`
+ * operations move data from the current list into the face list.
+ *
+ * @param jit The program's JIT (see jit.h), or NULL to only interpret it. The caller sets
+ * it up and frees it, so that it is freed even if the program stops with an error.
+ */
+static void run(const Program *p, RunState *s, Jit *jit){
+#ifdef THREADED_DISPATCH
+    static const void *dispatch_table[NUM_OPCODES] = {
+        [OP_PUSH] = &&do_OP_PUSH,
+        [OP_SET_CURRENT] = &&do_OP_SET_CURRENT,
+        [OP_COUNT] = &&do_OP_COUNT,
+        [OP_REVERSE] = &&do_OP_REVERSE,
+        [OP_ROTATE] = &&do_OP_ROTATE,
+        [OP_MOVE_LEFT] = &&do_OP_MOVE_LEFT,
+        [OP_MOVE_RIGHT] = &&do_OP_MOVE_RIGHT,
+        [OP_COPY_LEFT] = &&do_OP_COPY_LEFT,
+        [OP_COPY_RIGHT] = &&do_OP_COPY_RIGHT,
+        [OP_ASSIGN] = &&do_OP_ASSIGN,
+        [OP_INSERT] = &&do_OP_INSERT,
+        [OP_EXPLODE_LEFT] = &&do_OP_EXPLODE_LEFT,
+        [OP_EXPLODE_RIGHT] = &&do_OP_EXPLODE_RIGHT,
+        [OP_IMPLODE_LEFT] = &&do_OP_IMPLODE_LEFT,
+        [OP_IMPLODE_RIGHT] = &&do_OP_IMPLODE_RIGHT,
+        [OP_PRINT] = &&do_OP_PRINT,
+        [OP_PRINT_AND_POP] = &&do_OP_PRINT_AND_POP,
+        [OP_INPUT] = &&do_OP_INPUT,
+        [OP_MATHS_LEFT] = &&do_OP_MATHS_LEFT,
+        [OP_MATHS_RIGHT] = &&do_OP_MATHS_RIGHT,
+        [OP_COMPARE_LEFT] = &&do_OP_COMPARE_LEFT,
+        [OP_COMPARE_RIGHT] = &&do_OP_COMPARE_RIGHT,
+        [OP_OPEN_BLOCK] = &&do_OP_OPEN_BLOCK,
+        [OP_CLOSE_BLOCK] = &&do_OP_CLOSE_BLOCK,
+        [OP_DIVIDE_BLOCK] = &&do_OP_DIVIDE_BLOCK,
+        [OP_BREAK] = &&do_OP_BREAK,
+        [OP_BREAK_AND_POP] = &&do_OP_BREAK_AND_POP,
+        [OP_HALT] = &&do_OP_HALT,
+        [OP_PUSH_FACE] = &&do_OP_PUSH_FACE,
+        [OP_ROTATE_BY] = &&do_OP_ROTATE_BY,
+        [OP_MOVE_LEFT_N] = &&do_OP_MOVE_LEFT_N,
+        [OP_MOVE_RIGHT_N] = &&do_OP_MOVE_RIGHT_N,
+        [OP_MATHS_CONST_RIGHT] = &&do_OP_MATHS_CONST_RIGHT,
+        [OP_COMPARE_CONST_RIGHT] = &&do_OP_COMPARE_CONST_RIGHT,
+        [OP_LOOP_COUNT_DOWN] = &&do_OP_LOOP_COUNT_DOWN,
+        [OP_LOOP_ROTATE] = &&do_OP_LOOP_ROTATE,
+        [OP_LOOP_DRAIN] = &&do_OP_LOOP_DRAIN,
+    };
+#endif
+
+    const Instruction *code = p->code;
+    const Instruction *ins = code;
+    size_t pc = 0;
+
+
+#define FETCH() (ins = &code[pc++])
+#define STEP(op) TARGET(op) { step_##op(s, ins); DISPATCH(); }
+
+#ifdef THREADED_DISPATCH
+#define TARGET(op) do_##op:
+#define DISPATCH() goto *dispatch_table[FETCH()->op]
+    DISPATCH();
+#else
+#define TARGET(op) case op:
+#define DISPATCH() continue
+    while (true) {
+        switch (FETCH()->op) {
+#endif
+
+    STEP(OP_PUSH)
+    STEP(OP_SET_CURRENT)
+    STEP(OP_COUNT)
+    STEP(OP_REVERSE)
+    STEP(OP_ROTATE)
+    STEP(OP_MOVE_LEFT)
+    STEP(OP_MOVE_RIGHT)
+    STEP(OP_COPY_LEFT)
+    STEP(OP_COPY_RIGHT)
+    STEP(OP_ASSIGN)
+    STEP(OP_INSERT)
+    STEP(OP_EXPLODE_LEFT)
+    STEP(OP_EXPLODE_RIGHT)
+    STEP(OP_IMPLODE_LEFT)
+    STEP(OP_IMPLODE_RIGHT)
+    STEP(OP_PRINT)
+    STEP(OP_PRINT_AND_POP)
+    STEP(OP_INPUT)
+    STEP(OP_MATHS_LEFT)
+    STEP(OP_MATHS_RIGHT)
+    STEP(OP_COMPARE_LEFT)
+    STEP(OP_COMPARE_RIGHT)
+
+    // ( enters its block while the top of the face list is true
+    TARGET(OP_OPEN_BLOCK) {
+        if (jit){
+            const JitEntry entry = jit_entry(jit, pc - 1);
+            if (entry){
+                pc = entry(s);
+                DISPATCH();
+            }
+        }
+        if (!test_truthy(s, ins)){
+            pc = ins->arg;
+        }
+        DISPATCH();
+    }
+
+    // ) loops back to its (
+    TARGET(OP_CLOSE_BLOCK) {
+        pc = ins->arg;
+        DISPATCH();
+    }
+
+    // | leaves the block if the top of the face list is false
+    TARGET(OP_DIVIDE_BLOCK) {
+        if (!test_truthy(s, ins)){
+            pc = ins->arg;
+        }
+        DISPATCH();
+    }
+
+    // 3 leaves the block if the top of the face list is true
+    TARGET(OP_BREAK) {
+        if (test_truthy(s, ins)){
+            pc = ins->arg;
+        }
+        DISPATCH();
+    }
+
+    TARGET(OP_BREAK_AND_POP) {
+        if (test_break_and_pop(s, ins)){
+            pc = ins->arg;
+        }
+        DISPATCH();
+    }
+
+    TARGET(OP_HALT) {
+        return;
+    }
+
+    /* Superinstructions */
+
+    STEP(OP_PUSH_FACE)
+    STEP(OP_ROTATE_BY)
+    STEP(OP_MOVE_LEFT_N)
+    STEP(OP_MOVE_RIGHT_N)
+    STEP(OP_MATHS_CONST_RIGHT)
+    STEP(OP_COMPARE_CONST_RIGHT)
+
+    /* Loops (see recognise_loops). pc is at the ( of the loop, whose arg is its exit. */
+
+    TARGET(OP_LOOP_COUNT_DOWN) {
+        if (guard_OP_LOOP_COUNT_DOWN(s, ins)){
+            pc = code[pc].arg;
+        }
+        DISPATCH();
+    }
+
+    TARGET(OP_LOOP_ROTATE) {
+        if (guard_OP_LOOP_ROTATE(s, ins)){
+            pc = code[pc].arg;
+        }
+        DISPATCH();
+    }
+
+    TARGET(OP_LOOP_DRAIN) {
+        if (guard_OP_LOOP_DRAIN(s, ins)){
+            pc = code[pc].arg;
+        }
+        DISPATCH();
+    }
+
+#ifndef THREADED_DISPATCH
+        default:
+            run_err(s, ins, "Invalid opcode %d", ins->op);
+        }
+    }
+#endif
+
+#undef FETCH
+#undef STEP
+#undef TARGET
+#undef DISPATCH
+}
+
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+/* Streaming */
+
+/**
+ * @brief Waits for a streamed program to have been compiled up to pc, writing out what
+ * has been printed before going to sleep
+ */
+static const Instruction *stream_fetch(RunState *s, Stream *st, size_t pc){
+    while (pc >= st->program.size){
+        if (!stream_take(st, false)){
+            flush_output(s);
+            stream_take(st, true);
+        }
+    }
+    return &st->program.code[pc];
+}
+
+/**
+ * @brief Gets where a block instruction of a streamed program jumps to, waiting for its
+ * block to be compiled if it has not been yet
+ */
+static size_t stream_target(RunState *s, Stream *st, size_t pc){
+    while (st->program.code[pc].arg == UNLINKED){
+        if (!stream_take(st, false)){
+            flush_output(s);
+            stream_take(st, true);
+        }
+    }
+    return st->program.code[pc].arg;
+}
+
+/**
+ * @brief Runs a program as it is compiled, only waiting for more of it to reach the next
+ * instruction or a jump out of a block that has not been closed yet. Behaves as run does.
+ */
+static void run_stream(Stream *st, RunState *s){
+    size_t pc = 0;
+    while (true) {
+        const Instruction *ins = stream_fetch(s, st, pc++);
+        switch (ins->op) {
+            case OP_OPEN_BLOCK:
+            case OP_DIVIDE_BLOCK:
+                if (!test_truthy(s, ins)){
+                    pc = stream_target(s, st, pc - 1);
+                }
+                break;
+            case OP_BREAK:
+                if (test_truthy(s, ins)){
+                    pc = stream_target(s, st, pc - 1);
+                }
+                break;
+            case OP_BREAK_AND_POP:
+                if (test_break_and_pop(s, ins)){
+                    pc = stream_target(s, st, pc - 1);
+                }
+                break;
+            case OP_CLOSE_BLOCK:
+                pc = ins->arg;
+                break;
+            case OP_HALT:
+                return;
+            default:
+                // The optimiser never runs, so everything else is a step
+                if (!jit_hooks.steps[ins->op]){
+                    run_err(s, ins, "Invalid opcode %d", ins->op);
+                }
+                jit_hooks.steps[ins->op](s, ins);
+        }
+    }
+}
+
+/* Profiling and tracing */
+
+/**
+ * @brief Runs a compiled program as run does, counting and timing every instruction into
+ * pr, and recording each into t (either may be NULL). It is a loop of its own so that run
+ * does nothing extra when neither is wanted, and it never uses the JIT, so that every
+ * instruction is seen.
+ */
+static void run_instrumented(const Program *p, RunState *s, Profile *pr, Trace *t){
+    const Instruction *code = p->code;
+    size_t pc = 0;
+    uint64_t start = pr ? profile_clock() : 0;
+    while (true) {
+        const size_t at = pc++;
+        const Instruction *ins = &code[at];
+        switch (ins->op) {
+            case OP_OPEN_BLOCK:
+            case OP_DIVIDE_BLOCK:
+                if (!test_truthy(s, ins)){
+                    pc = ins->arg;
+                }
+                break;
+            case OP_BREAK:
+                if (test_truthy(s, ins)){
+                    pc = ins->arg;
+                }
+                break;
+            case OP_BREAK_AND_POP:
+                if (test_break_and_pop(s, ins)){
+                    pc = ins->arg;
+                }
+                break;
+            case OP_CLOSE_BLOCK:
+                pc = ins->arg;
+                break;
+            case OP_LOOP_COUNT_DOWN:
+                if (guard_OP_LOOP_COUNT_DOWN(s, ins)){
+                    pc = code[pc].arg;
+                }
+                break;
+            case OP_LOOP_ROTATE:
+                if (guard_OP_LOOP_ROTATE(s, ins)){
+                    pc = code[pc].arg;
+                }
+                break;
+            case OP_LOOP_DRAIN:
+                if (guard_OP_LOOP_DRAIN(s, ins)){
+                    pc = code[pc].arg;
+                }
+                break;
+            case OP_HALT:
+                if (pr){
+                    pr->counts[at]++;
+                }
+                if (t){
+                    trace_record(t, at, s->current, s->lists[s->current].list.size);
+                }
+                return;
+            default:
+                if (!jit_hooks.steps[ins->op]){
+                    run_err(s, ins, "Invalid opcode %d", ins->op);
+                }
+                jit_hooks.steps[ins->op](s, ins);
+        }
+
+        if (t){
+            trace_record(t, at, s->current, s->lists[s->current].list.size);
+        }
+        if (pr){
+            const uint64_t end = profile_clock();
+            pr->counts[at]++;
+            pr->times[at] += end - start;
+            start = end;
+        }
+    }
+}
+
+/* Runtime */
+
+/**
+ * @brief Sets up a state for running a program, starting with ':' as the current list.
+ * The state must stay where it is until runtime_stop, as its lists point into it.
+ */
+void runtime_start(RunState *s, const Program *p, FILE *input, FILE *output){
+    *s = (RunState){
+        .program = p,
+        .input = input,
+        .output = output,
+        .output_buffer = (char *)malloc(OUTPUT_BUFFER_SIZE)
+    };
+    if (!s->output_buffer){
+        ERROR("Failed to allocate an output buffer of %d bytes", OUTPUT_BUFFER_SIZE);
+    }
+    grow_lists(s, p->symbols.size);
+    s->current = list_slot(s, DEFAULT_LIST);
+}
+
+/**
+ * @brief Empties every list of a state. The lists keep their buffers and the pool its
+ * arena, so a program run on the state again only allocates once it needs more than the
+ * last one did. The state's program does not have to exist any more.
+ */
+void runtime_clear(RunState *s){
+    for (size_t i = 0; i < s->lists_size; i++){
+        lclear(&s->lists[i].list);
+    }
+    // Only once the lists have given their strings back
+    pool_reset(&s->pool);
+    s->current = DEFAULT_LIST;
+    // Programs write out all they print before they end
+    s->output_size = 0;
+}
+
+/**
+ * @brief Empties a state that has run a program, to run a program on it from the start
+ * (as runtime_start would set it up, but keeping its memory)
+ */
+void runtime_reset(RunState *s, const Program *p, FILE *input, FILE *output){
+    runtime_clear(s);
+    for (size_t i = p->symbols.size; i < s->lists_size; i++){
+        lfree(s->lists[i].list);
+    }
+    if (s->lists_size > p->symbols.size){
+        s->lists_size = p->symbols.size;
+    }
+    for (size_t i = 0; i < s->lists_size; i++){
+        s->lists[i].name = p->symbols.names[i];
+    }
+
+    s->program = p;
+    s->input = input;
+    s->output = output;
+    grow_lists(s, p->symbols.size);
+    s->current = list_slot(s, DEFAULT_LIST);
+}
+
+/**
+ * @brief Finishes running a program, flushing its output and freeing its lists
+ */
+void runtime_stop(RunState *s){
+    // With nothing left to write, the output may have been closed already
+    if (s->output_size){
+        flush_output(s);
+    }
+    free_lists(s);
+    TFREE(s->output_buffer);
+}
+
+/* Interpreting */
+
+/**
+ * Everything interpret makes, so that it can all be freed however it ends. It is only
+ * changed through pointers to it, so it is still up to date after an error longjmps back.
+ */
+typedef struct {
+    Source src;
+    Program program;
+    CachedProgram cached;
+    Stream stream;
+    // What the program runs on: own_state, or a state the caller set up
+    RunState *state;
+    RunState own_state;
+    Jit jit;
+    bool jitting;
+    Profile profile;
+    // The program that profile is of, if it is being profiled
+    const Program *profiled;
+    Trace trace;
+    bool tracing;
+    // A program compiled before, for interpret_program
+    const Program *compiled;
+} Run;
+
+static Run *new_run(void){
+    Run *r = (Run *)calloc(1, sizeof(Run));
+    if (!r){
+        ERROR("Failed to allocate memory for running a program");
+    }
+    return r;
+}
+
+/**
+ * @brief Frees everything a run made, but not the run itself
+ */
+static void release_run(Run *r){
+    if (r->jitting){
+        jit_free(&r->jit);
+    }
+    if (r->profiled){
+        profile_free(&r->profile);
+    }
+    if (r->tracing){
+        trace_stop(&r->trace);
+    }
+    if (r->state == &r->own_state){
+        runtime_stop(r->state);
+    }
+    if (r->stream.ring){
+        stream_stop(&r->stream);
+    }
+    if (r->cached.map){
+        cache_free(&r->cached);
+    }
+    close_source(&r->src);
+    free_program(r->program);
+}
+
+static void free_run(Run *r){
+    release_run(r);
+    free(r);
+}
+
+/**
+ * @brief Compiles and optimises o.code (or r->src if there is no o.code) into r->program
+ */
+static void compile_run(Run *r, InterpeterOptions o){
+    if (o.code && open_source(&r->src, o.code)){
+        ERROR("Could not read the code file");
+    }
+    compile_source(&r->src, &r->program);
+    optimise(&r->program, o.opt_level);
+}
+
+/**
+ * @brief Gets a program ready to run: from the cache in o.cache, compiling and caching it
+ * first if the cache is missing or stale, or by compiling o.code
+ */
+static const Program *load_program(Run *r, InterpeterOptions o){
+    if (!o.cache){
+        compile_run(r, o);
+        return &r->program;
+    }
+
+    if (open_source(&r->src, o.code)){
+        ERROR("Could not read the code file");
+    }
+    if (!cache_load(o.cache, &r->src, o.opt_level, &r->cached)){
+        return &r->cached.program;
+    }
+    compile_source(&r->src, &r->program);
+    optimise(&r->program, o.opt_level);
+    // Not being able to cache it only means compiling it again next time
+    cache_save(o.cache, &r->src, o.opt_level, &r->program);
+    return &r->program;
+}
+
+static void interpret_run(Run *r, InterpeterOptions o){
+    const Program *p = r->compiled;
+    if (!p && o.stream && !o.profile && !o.trace && !stream_start(&r->stream, o.code)){
+        runtime_start(&r->own_state, &r->stream.program, o.input, o.output);
+        r->state = &r->own_state;
+        run_stream(&r->stream, r->state);
+        flush_output(r->state);
+        return;
+    }
+
+    if (!p){
+        p = load_program(r, o);
+        close_source(&r->src);
+    }
+    if (!r->state){
+        runtime_start(&r->own_state, p, o.input, o.output);
+        r->state = &r->own_state;
+    }
+    if (o.profile || o.trace){
+        if (o.profile){
+            profile_init(&r->profile, p);
+            r->profiled = p;
+        }
+        if (o.trace){
+            if (trace_start(&r->trace, o.trace, p)){
+                ERROR("Could not open trace file '%s'", o.trace);
+            }
+            r->tracing = true;
+        }
+        run_instrumented(p, r->state, r->profiled ? &r->profile : NULL, r->tracing ? &r->trace : NULL);
+    } else {
+        if (o.jit && jit_available()){
+            jit_init(&r->jit, p, &jit_hooks);
+            r->jitting = true;
+        }
+        run(p, r->state, r->jitting ? &r->jit : NULL);
+    }
+    flush_output(r->state);
+}
+
+/**
+ * @brief Reports the profile of a run (however it ended) to stderr and to o.profile_stacks,
+ * and writes out the rest of its trace
+ */
+static void finish_run(Run *r, InterpeterOptions o){
+    if (r->tracing){
+        r->tracing = false;
+        if (trace_stop(&r->trace)){
+            fprintf(stderr, "Could not write the trace to '%s'\n", o.trace);
+        }
+    }
+    if (!r->profiled){
+        return;
+    }
+    profile_report(&r->profile, r->profiled, stderr);
+    if (o.profile_stacks && profile_write_stacks(&r->profile, r->profiled, o.profile_stacks)){
+        fprintf(stderr, "Could not write the profile to '%s'\n", o.profile_stacks);
+    }
+}
+
+/**
+ * @brief Calls f, catching any error it has instead of exiting
+ *
+ * @param error Where to put the error's message, or NULL to print it
+ * @return 0, or 1 after an error
+ */
+static int trap_errors(Run *r, InterpeterOptions o, void (*f)(Run *r, InterpeterOptions o), char *error){
+    ErrorTrap trap;
+    ErrorTrap *const outer = error_trap;
+    error_trap = &trap;
+
+    int res = 0;
+    if (!setjmp(trap.env)){
+        f(r, o);
+    } else {
+        // What was printed before the error comes before it
+        if (r->state){
+            flush_output(r->state);
+        }
+        if (error){
+            memcpy(error, trap.message, ERROR_MESSAGE_SIZE);
+        } else {
+            fprintf(stderr, "%s\n", trap.message);
+        }
+        res = 1;
+    }
+
+    error_trap = outer;
+    return res;
+}
+
+/**
+ * @brief Compiles the code in o.code and runs it. Errors are printed, and stop the program
+ * rather than the process.
+ *
+ * @return 0, or 1 after an error
+ */
+int interpret(InterpeterOptions o){
+    Run *r = new_run();
+    const int res = trap_errors(r, o, interpret_run, NULL);
+    if (trap_errors(r, o, finish_run, NULL)){
+        free_run(r);
+        return 1;
+    }
+    free_run(r);
+    return res;
+}
+
+/**
+ * @brief Runs a program compiled by interpret_compile. The program is only read, so any
+ * number of threads can run it at once.
+ *
+ * @return 0, or 1 after an error (which is printed)
+ */
+int interpret_program(const Program *p, FILE *input, FILE *output, bool jit){
+    Run *r = new_run();
+    r->compiled = p;
+    const int res = trap_errors(r, (InterpeterOptions){
+        .input = input,
+        .output = output,
+        .jit = jit
+    }, interpret_run, NULL);
+    free_run(r);
+    return res;
+}
+
+/**
+ * @brief Runs a compiled program on a state set up by runtime_start (or runtime_reset),
+ * leaving the state as the program leaves it, to run again or be stopped by the caller
+ *
+ * @param error Where to put the message of an error (ERROR_MESSAGE_SIZE bytes)
+ * @return 0, or 1 after an error
+ */
+int interpret_state(RunState *s, const Program *p, bool jit, char *error){
+    // On the stack, so that running a program again on a state does not allocate
+    Run r = { .state = s, .compiled = p };
+    const int res = trap_errors(&r, (InterpeterOptions){ .jit = jit }, interpret_run, error);
+    release_run(&r);
+    return res;
+}
+
+/**
+ * @brief Compiles and optimises a code file, to run with interpret_program
+ *
+ * @param out The program, to free with free_program
+ * @param error Where to put the message of an error (ERROR_MESSAGE_SIZE bytes), or NULL to
+ * print it
+ * @return 0, or 1 after an error
+ */
+int interpret_compile(FILE *code, int opt_level, Program *out, char *error){
+    Run *r = new_run();
+    const int res = trap_errors(r, (InterpeterOptions){
+        .code = code,
+        .opt_level = opt_level
+    }, compile_run, error);
+    if (!res){
+        *out = r->program;
+        r->program = (Program){ 0 };
+    }
+    free_run(r);
+    return res;
+}
+
+/**
+ * @brief Compiles and optimises code held in memory, as interpret_compile does a file
+ */
+int interpret_compile_string(const char *code, size_t size, int opt_level, Program *out, char *error){
+    Run *r = new_run();
+    r->src = string_source(code, size);
+    const int res = trap_errors(r, (InterpeterOptions){ .opt_level = opt_level }, compile_run, error);
+    if (!res){
+        *out = r->program;
+        r->program = (Program){ 0 };
+    }
+    free_run(r);
+    return res;
+}
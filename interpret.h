@@ -1,22 +1,38 @@
 #ifndef __INTERPRET_H__
 #define __INTERPRET_H__
 
-#include "list.h"
-#include "stdio.h"
+#include "compile.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdbool.h>
 
 typedef struct {
     FILE *input;
     FILE *output;
     FILE *code;
+    // See optimise.h
+    int opt_level;
+    // Compile hot loops to machine code, where supported
+    bool jit;
+    // Start running the code while it is still being read (see stream.h), where supported.
+    // The code is not optimised or JIT compiled, and should not be read from input.
+    bool stream;
+    // Where to cache the compiled program (see cache.h), or NULL to always compile it
+    const char *cache;
+    // Count and time every instruction run, reporting them to stderr when the program ends
+    // (see profile.h). The program is not streamed or JIT compiled.
+    bool profile;
+    // Where to also write the profile as collapsed stacks (for flame graphs), or NULL
+    const char *profile_stacks;
+    // Where to write a record of every instruction run (see trace.h, and emotrace to read
+    // it), or NULL. The program is not streamed or JIT compiled.
+    const char *trace;
 } InterpeterOptions;
 
-typedef struct {
-    char *name;
-    List list;
-} EmoList;
-
-EmoList *lists;
-
 int interpret(InterpeterOptions o);
+int interpret_compile(FILE *code, int opt_level, Program *out, char *error);
+int interpret_program(const Program *p, FILE *input, FILE *output, bool jit);
+int interpret_state(RunState *s, const Program *p, bool jit, char *error);
+int interpret_compile_string(const char *code, size_t size, int opt_level, Program *out, char *error);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,826 @@
+#include "jit.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(EMOTICON_NO_JIT)
+#define HAVE_JIT
+#include <sys/mman.h>
+#endif
+
+// Marks a ( whose loop could not be compiled
+#define JIT_COLD UINT_MAX
+
+// Executable memory holding compiled loops, one mapping each
+struct JitPages {
+    JitPages *next;
+    void *mem;
+    size_t size;
+};
+
+bool jit_available(void){
+#ifdef HAVE_JIT
+    return true;
+#else
+    return false;
+#endif
+}
+
+void jit_init(Jit *j, const Program *p, const JitHooks *hooks){
+    *j = (Jit){
+        .program = p,
+        .hooks = hooks,
+        .heat = (unsigned int *)calloc(p->size, sizeof(unsigned int)),
+        .entries = (JitEntry *)calloc(p->size, sizeof(JitEntry))
+    };
+    if (!j->heat || !j->entries){
+        ERROR("Failed to allocate memory to compile a program of %zu instructions", p->size);
+    }
+}
+
+void jit_free(Jit *j){
+    while (j->pages){
+        JitPages *next = j->pages->next;
+#ifdef HAVE_JIT
+        munmap(j->pages->mem, j->pages->size);
+#endif
+        free(j->pages);
+        j->pages = next;
+    }
+    TFREE(j->heat);
+    TFREE(j->entries);
+}
+
+#ifdef HAVE_JIT
+
+/* Code buffer */
+
+typedef struct {
+    unsigned char *bytes;
+    size_t size;
+    size_t max_size;
+} CodeBuf;
+
+static void emit_bytes(CodeBuf *b, const void *bytes, size_t n){
+    if (b->size + n > b->max_size){
+        size_t new_max = b->max_size ? b->max_size : 256;
+        while (new_max < b->size + n){
+            new_max *= 2;
+        }
+        unsigned char *temp = (unsigned char *)realloc(b->bytes, new_max);
+        if (!temp){
+            ERROR("Failed to allocate %zu bytes of machine code", new_max);
+        }
+        b->bytes = temp;
+        b->max_size = new_max;
+    }
+    memcpy(b->bytes + b->size, bytes, n);
+    b->size += n;
+}
+
+static void emit_u32(CodeBuf *b, uint32_t v){
+    emit_bytes(b, &v, sizeof(v));
+}
+
+static void emit_u64(CodeBuf *b, uint64_t v){
+    emit_bytes(b, &v, sizeof(v));
+}
+
+#define EMIT(b, ...) emit_bytes(b, (const unsigned char[]){ __VA_ARGS__ }, sizeof((const unsigned char[]){ __VA_ARGS__ }))
+
+/* x86-64 encoding */
+
+// Registers by their number in encodings. Compiled code keeps s in rbx, and only uses
+// registers that need no REX prefix to name.
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+
+// Condition codes of jcc and setcc
+enum {
+    CC_B = 0x2,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+    CC_NS = 0x9,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G = 0xF,
+    // jmp, for emit_jump_ahead
+    CC_ALWAYS = -1
+};
+
+// Group 1 operations (the reg field of opcodes 81 and 83)
+enum { ALU_ADD = 0, ALU_AND = 4, ALU_SUB = 5, ALU_CMP = 7 };
+
+// A rel32 to fill in once the code for the instruction at target is placed
+typedef struct {
+    size_t at;
+    size_t target;
+} Fixup;
+
+// Jumps to the slow path of one template at most
+#define MAX_SLOW_JUMPS 32
+
+typedef struct {
+    CodeBuf code;
+    Fixup *fixups;
+    size_t fixups_size;
+    size_t fixups_max_size;
+    // Jumps to the slow path of the template being emitted
+    size_t slow[MAX_SLOW_JUMPS];
+    size_t slow_size;
+} Emitter;
+
+static void add_fixup(Emitter *e, size_t target){
+    if (e->fixups_size >= e->fixups_max_size){
+        e->fixups_max_size = e->fixups_max_size ? e->fixups_max_size * 2 : 16;
+        Fixup *temp = (Fixup *)realloc(e->fixups, e->fixups_max_size * sizeof(Fixup));
+        if (!temp){
+            ERROR("Failed to allocate memory for %zu jumps", e->fixups_max_size);
+        }
+        e->fixups = temp;
+    }
+    e->fixups[e->fixups_size++] = (Fixup){ .at = e->code.size, .target = target };
+    emit_u32(&e->code, 0);
+}
+
+/**
+ * @brief The ModRM byte and displacement for reg and [base + disp] (base cannot be rsp)
+ */
+static void emit_mem(Emitter *e, int reg, int base, size_t disp){
+    EMIT(&e->code, (unsigned char) (0x80 | reg << 3 | base));
+    emit_u32(&e->code, (uint32_t) disp);
+}
+
+/**
+ * @brief op r64, [base + disp], for op 8B (mov), 03 (add) or 3B (cmp)
+ */
+static void emit_load(Emitter *e, unsigned char op, int reg, int base, size_t disp){
+    EMIT(&e->code, 0x48, op);
+    emit_mem(e, reg, base, disp);
+}
+
+// mov [base + disp], r64
+static void emit_store(Emitter *e, int base, size_t disp, int reg){
+    EMIT(&e->code, 0x48, 0x89);
+    emit_mem(e, reg, base, disp);
+}
+
+// alu qword [base + disp], imm32
+static void emit_mem_imm(Emitter *e, int alu, int base, size_t disp, int32_t imm){
+    EMIT(&e->code, 0x48, 0x81);
+    emit_mem(e, alu, base, disp);
+    emit_u32(&e->code, (uint32_t) imm);
+}
+
+// cmp byte [base + disp], imm8
+static void emit_cmp_byte(Emitter *e, int base, size_t disp, unsigned char imm){
+    EMIT(&e->code, 0x80);
+    emit_mem(e, ALU_CMP, base, disp);
+    EMIT(&e->code, imm);
+}
+
+/**
+ * @brief op dst, src on r64s, for op 01 (add), 21 (and), 39 (cmp) or 85 (test)
+ */
+static void emit_reg_op(Emitter *e, unsigned char op, int dst, int src){
+    EMIT(&e->code, 0x48, op, (unsigned char) (0xC0 | src << 3 | dst));
+}
+
+// alu r64, imm32
+static void emit_reg_imm(Emitter *e, int alu, int reg, int32_t imm){
+    EMIT(&e->code, 0x48, 0x81, (unsigned char) (0xC0 | alu << 3 | reg));
+    emit_u32(&e->code, (uint32_t) imm);
+}
+
+/**
+ * @brief A jump (or jcc) forward to code not emitted yet
+ *
+ * @return Where its rel32 is, for land
+ */
+static size_t emit_jump_ahead(Emitter *e, int cc){
+    if (cc == CC_ALWAYS){
+        EMIT(&e->code, 0xE9);
+    } else {
+        EMIT(&e->code, 0x0F, (unsigned char) (0x80 | cc));
+    }
+    const size_t at = e->code.size;
+    emit_u32(&e->code, 0);
+    return at;
+}
+
+/**
+ * @brief Points a jump from emit_jump_ahead at the next code emitted
+ */
+static void land(Emitter *e, size_t at){
+    const uint32_t rel = (uint32_t) (e->code.size - (at + 4));
+    memcpy(e->code.bytes + at, &rel, sizeof(rel));
+}
+
+// jcc back to code already emitted
+static void emit_jump_back(Emitter *e, int cc, size_t to){
+    EMIT(&e->code, 0x0F, (unsigned char) (0x80 | cc));
+    emit_u32(&e->code, (uint32_t) (to - (e->code.size + 4)));
+}
+
+// jcc to the slow path of the template
+static void emit_to_slow(Emitter *e, int cc){
+    if (e->slow_size >= MAX_SLOW_JUMPS){
+        ERROR("Too many jumps to the slow path of a template");
+    }
+    e->slow[e->slow_size++] = emit_jump_ahead(e, cc);
+}
+
+/* Templates */
+
+/**
+ * @brief fn(s, ins), with s kept in rbx
+ */
+static void emit_call(Emitter *e, uintptr_t fn, const Instruction *ins){
+    // mov rdi, rbx
+    EMIT(&e->code, 0x48, 0x89, 0xDF);
+    // mov rsi, ins
+    EMIT(&e->code, 0x48, 0xBE);
+    emit_u64(&e->code, (uint64_t) (uintptr_t) ins);
+    // mov rax, fn; call rax
+    EMIT(&e->code, 0x48, 0xB8);
+    emit_u64(&e->code, (uint64_t) fn);
+    EMIT(&e->code, 0xFF, 0xD0);
+}
+
+/**
+ * @brief Ends a template: its native code skips the slow path, which calls fn to do what
+ * the native code could not
+ */
+static void emit_slow_path(Emitter *e, uintptr_t fn, const Instruction *ins){
+    const size_t done = emit_jump_ahead(e, CC_ALWAYS);
+    for (size_t i = 0; i < e->slow_size; i++){
+        land(e, e->slow[i]);
+    }
+    e->slow_size = 0;
+    emit_call(e, fn, ins);
+    land(e, done);
+}
+
+// Where the fields of a list are, from its EmoList
+#define LIST_FIELD(f) (offsetof(EmoList, list) + offsetof(List, f))
+
+// Whether the EmoList in a slot is at an offset that fits in an imm32
+static bool slot_fits(unsigned int slot){
+    return slot <= INT32_MAX / sizeof(EmoList);
+}
+
+/**
+ * @brief Points reg at the EmoList in a slot. Going to the slow path if it is not made yet
+ * (which list_slot does).
+ */
+static void emit_slot(Emitter *e, int reg, unsigned int slot){
+    // cmp qword [rbx + lists_size], slot; jbe slow
+    emit_mem_imm(e, ALU_CMP, RBX, offsetof(RunState, lists_size), (int32_t) slot);
+    emit_to_slow(e, CC_BE);
+    // mov reg, [rbx + lists]; add reg, slot * sizeof(EmoList)
+    emit_load(e, 0x8B, reg, RBX, offsetof(RunState, lists));
+    emit_reg_imm(e, ALU_ADD, reg, (int32_t) (slot * sizeof(EmoList)));
+}
+
+// Points reg at the EmoList of the current list
+static void emit_current(Emitter *e, int reg){
+    // mov reg, [rbx + current]; imul reg, reg, sizeof(EmoList); add reg, [rbx + lists]
+    emit_load(e, 0x8B, reg, RBX, offsetof(RunState, current));
+    EMIT(&e->code, 0x48, 0x69, (unsigned char) (0xC0 | reg << 3 | reg));
+    emit_u32(&e->code, (uint32_t) sizeof(EmoList));
+    emit_load(e, 0x03, reg, RBX, offsetof(RunState, lists));
+}
+
+/**
+ * @brief Goes to the slow path unless a list is a ring of values, only it has, read in
+ * the order they are stored. That is all the templates handle themselves.
+ */
+static void emit_plain_ring(Emitter *e, int l){
+    static const size_t unset[] = {
+        LIST_FIELD(rope), LIST_FIELD(chars), LIST_FIELD(refs), LIST_FIELD(start_ind)
+    };
+    for (size_t i = 0; i < sizeof(unset) / sizeof(unset[0]); i++){
+        emit_mem_imm(e, ALU_CMP, l, unset[i], 0);
+        emit_to_slow(e, CC_NE);
+    }
+    emit_cmp_byte(e, l, LIST_FIELD(reversed), 0);
+    emit_to_slow(e, CC_NE);
+}
+
+/**
+ * @brief Goes to the slow path unless n more elements fit in a plain ring without it
+ * growing (or becoming a rope, as linsert would make it)
+ */
+static void emit_room(Emitter *e, int l, int tmp, unsigned int n){
+    // mov tmp, [l + size]; add tmp, n; cmp tmp, [l + max_size]; ja slow
+    emit_load(e, 0x8B, tmp, l, LIST_FIELD(size));
+    emit_reg_imm(e, ALU_ADD, tmp, (int32_t) n);
+    emit_load(e, 0x3B, tmp, l, LIST_FIELD(max_size));
+    emit_to_slow(e, CC_A);
+    // cmp tmp, LIST_ROPE_SIZE; ja slow
+    emit_reg_imm(e, ALU_CMP, tmp, LIST_ROPE_SIZE);
+    emit_to_slow(e, CC_A);
+}
+
+/**
+ * @brief Points dest at the element of a plain ring back places before its end (0 for
+ * where the next element goes), clobbering tmp
+ */
+static void emit_element(Emitter *e, int dest, int tmp, int l, int back){
+    // dest = (head + size - back) & (max_size - 1)
+    emit_load(e, 0x8B, dest, l, LIST_FIELD(head));
+    emit_load(e, 0x03, dest, l, LIST_FIELD(size));
+    if (back){
+        emit_reg_imm(e, ALU_SUB, dest, back);
+    }
+    emit_load(e, 0x8B, tmp, l, LIST_FIELD(max_size));
+    emit_reg_imm(e, ALU_SUB, tmp, 1);
+    emit_reg_op(e, 0x21, dest, tmp);
+    // Values are 16 bytes: shl dest, 4; add dest, [l + arr]
+    EMIT(&e->code, 0x48, 0xC1, (unsigned char) (0xE0 | dest), 4);
+    emit_load(e, 0x03, dest, l, LIST_FIELD(arr));
+}
+
+// Goes to the slow path if a list is empty
+static void emit_not_empty(Emitter *e, int l){
+    emit_mem_imm(e, ALU_CMP, l, LIST_FIELD(size), 0);
+    emit_to_slow(e, CC_E);
+}
+
+// Stores a value at [dest], through tmp
+static void emit_store_value(Emitter *e, int dest, int tmp, Value v){
+    uint64_t halves[2];
+    memcpy(halves, &v, sizeof(halves));
+    // mov tmp, imm64; mov [dest], tmp (for each half)
+    for (size_t i = 0; i < 2; i++){
+        EMIT(&e->code, 0x48, (unsigned char) (0xB8 + tmp));
+        emit_u64(&e->code, halves[i]);
+        emit_store(e, dest, i * sizeof(uint64_t), tmp);
+    }
+}
+
+/**
+ * @brief Stores an int at [dest] from the low half of val, which must be a non negative
+ * int (so its high half is 0, as the padding of int_val is)
+ */
+static void emit_store_int(Emitter *e, int dest, int val, int tmp){
+    const Value v = int_val(0);
+    uint64_t halves[2];
+    memcpy(halves, &v, sizeof(halves));
+    emit_store(e, dest, 0, val);
+    EMIT(&e->code, 0x48, (unsigned char) (0xB8 + tmp));
+    emit_u64(&e->code, halves[1]);
+    emit_store(e, dest, sizeof(uint64_t), tmp);
+}
+
+/**
+ * @brief Pushes a literal by storing it straight into the ring (as linsert would, without
+ * copying its string)
+ */
+static void emit_push(Emitter *e, const Instruction *ins, JitStep step, Value v){
+    if (ins->op == OP_PUSH){
+        emit_current(e, RSI);
+    } else {
+        emit_slot(e, RSI, ins->list);
+    }
+    emit_plain_ring(e, RSI);
+    emit_room(e, RSI, RCX, 1);
+    emit_element(e, RAX, RCX, RSI, 0);
+    emit_store_value(e, RAX, RCX, v);
+    emit_mem_imm(e, ALU_ADD, RSI, LIST_FIELD(size), 1);
+    emit_slow_path(e, (uintptr_t) step, ins);
+}
+
+// Pushes the size of the face list onto the current list
+static void emit_count(Emitter *e, const Instruction *ins, JitStep step){
+    emit_slot(e, RDI, ins->list);
+    emit_current(e, RSI);
+    emit_plain_ring(e, RSI);
+    emit_room(e, RSI, RCX, 1);
+    // The step reports a size that does not fit in an int: mov rdx, [rdi + size]; cmp rdx, INT_MAX; ja slow
+    emit_load(e, 0x8B, RDX, RDI, LIST_FIELD(size));
+    emit_reg_imm(e, ALU_CMP, RDX, INT_MAX);
+    emit_to_slow(e, CC_A);
+    emit_element(e, RAX, RCX, RSI, 0);
+    emit_store_int(e, RAX, RDX, RCX);
+    emit_mem_imm(e, ALU_ADD, RSI, LIST_FIELD(size), 1);
+    emit_slow_path(e, (uintptr_t) step, ins);
+}
+
+/**
+ * @brief Rotates the face list by a literal amount, as lrotate does, for lists of any kind
+ */
+static void emit_rotate_by(Emitter *e, const Instruction *ins, JitStep step, int amount){
+    emit_slot(e, RSI, ins->list);
+    // Empty lists stay as they are: mov rcx, [rsi + size]; test rcx, rcx; jz done
+    emit_load(e, 0x8B, RCX, RSI, LIST_FIELD(size));
+    emit_reg_op(e, 0x85, RCX, RCX);
+    const size_t empty = emit_jump_ahead(e, CC_E);
+
+    // rdx = (start_ind + amount) mod size: mov rax, [rsi + start_ind]; add rax, amount;
+    // cqo; idiv rcx; then size is added to a negative remainder
+    emit_load(e, 0x8B, RAX, RSI, LIST_FIELD(start_ind));
+    emit_reg_imm(e, ALU_ADD, RAX, amount);
+    EMIT(&e->code, 0x48, 0x99, 0x48, 0xF7, 0xF9);
+    emit_reg_op(e, 0x85, RDX, RDX);
+    const size_t positive = emit_jump_ahead(e, CC_NS);
+    emit_reg_op(e, 0x01, RDX, RCX);
+    land(e, positive);
+
+    // A full ring folds the rotation into head, and anything else keeps it in start_ind
+    emit_mem_imm(e, ALU_CMP, RSI, LIST_FIELD(rope), 0);
+    const size_t rope = emit_jump_ahead(e, CC_NE);
+    emit_load(e, 0x3B, RCX, RSI, LIST_FIELD(max_size));
+    const size_t partial = emit_jump_ahead(e, CC_NE);
+    // head = (reversed ? head - rdx : head + rdx) & (max_size - 1), with rcx = max_size
+    emit_cmp_byte(e, RSI, LIST_FIELD(reversed), 0);
+    const size_t forwards = emit_jump_ahead(e, CC_E);
+    // neg rdx
+    EMIT(&e->code, 0x48, 0xF7, 0xDA);
+    land(e, forwards);
+    emit_load(e, 0x03, RDX, RSI, LIST_FIELD(head));
+    emit_reg_imm(e, ALU_SUB, RCX, 1);
+    emit_reg_op(e, 0x21, RDX, RCX);
+    emit_store(e, RSI, LIST_FIELD(head), RDX);
+    // and qword [rsi + start_ind], 0
+    emit_mem_imm(e, ALU_AND, RSI, LIST_FIELD(start_ind), 0);
+    const size_t folded = emit_jump_ahead(e, CC_ALWAYS);
+    land(e, rope);
+    land(e, partial);
+    emit_store(e, RSI, LIST_FIELD(start_ind), RDX);
+    land(e, folded);
+    land(e, empty);
+    emit_slow_path(e, (uintptr_t) step, ins);
+}
+
+/**
+ * @brief Moves n elements one at a time from the top of one plain ring to another: from
+ * the face list to the current list for OP_MOVE_LEFT_N, the other way for OP_MOVE_RIGHT_N
+ */
+static void emit_move_n(Emitter *e, const Instruction *ins, JitStep step){
+    // rsi is the list moved from, and rdi the one moved to
+    const bool left = ins->op == OP_MOVE_LEFT_N;
+    emit_slot(e, left ? RSI : RDI, ins->list);
+    emit_current(e, left ? RDI : RSI);
+    // A list moved onto itself is left to the step: cmp rsi, rdi; je slow
+    emit_reg_op(e, 0x39, RSI, RDI);
+    emit_to_slow(e, CC_E);
+    emit_plain_ring(e, RSI);
+    emit_plain_ring(e, RDI);
+    // The step reports running out of elements: cmp qword [rsi + size], n; jb slow
+    emit_mem_imm(e, ALU_CMP, RSI, LIST_FIELD(size), (int32_t) ins->arg);
+    emit_to_slow(e, CC_B);
+    emit_room(e, RDI, RAX, ins->arg);
+
+    // mov edx, n
+    EMIT(&e->code, 0xBA);
+    emit_u32(&e->code, ins->arg);
+    const size_t loop = e->code.size;
+    // movups xmm0, [top of rsi]; then rsi shrinks
+    emit_element(e, RAX, RCX, RSI, 1);
+    EMIT(&e->code, 0x0F, 0x10);
+    emit_mem(e, 0, RAX, 0);
+    emit_mem_imm(e, ALU_SUB, RSI, LIST_FIELD(size), 1);
+    // movups [end of rdi], xmm0; then rdi grows
+    emit_element(e, RAX, RCX, RDI, 0);
+    EMIT(&e->code, 0x0F, 0x11);
+    emit_mem(e, 0, RAX, 0);
+    emit_mem_imm(e, ALU_ADD, RDI, LIST_FIELD(size), 1);
+    // sub edx, 1; jnz loop
+    EMIT(&e->code, 0x83, 0xEA, 0x01);
+    emit_jump_back(e, CC_NE, loop);
+    emit_slow_path(e, (uintptr_t) step, ins);
+}
+
+/**
+ * @brief Sets al to whether the top of the face list is true, as test_truthy does
+ */
+static void emit_truthy(Emitter *e, const Instruction *ins, JitTest test){
+    emit_slot(e, RSI, ins->list);
+    emit_plain_ring(e, RSI);
+    // Empty lists are false: xor eax, eax; cmp qword [rsi + size], 0; je done
+    EMIT(&e->code, 0x31, 0xC0);
+    emit_mem_imm(e, ALU_CMP, RSI, LIST_FIELD(size), 0);
+    const size_t empty = emit_jump_ahead(e, CC_E);
+    emit_element(e, RDX, RCX, RSI, 1);
+    // movzx ecx, byte [rdx + type]
+    EMIT(&e->code, 0x0F, 0xB6);
+    emit_mem(e, RCX, RDX, offsetof(Value, type));
+
+    // Ints are true unless 0: cmp ecx, VAL_INT; jne; cmp dword [rdx], 0; setne al
+    EMIT(&e->code, 0x83, 0xF9, VAL_INT);
+    const size_t not_int = emit_jump_ahead(e, CC_NE);
+    EMIT(&e->code, 0x83);
+    emit_mem(e, ALU_CMP, RDX, 0);
+    EMIT(&e->code, 0x00, 0x0F, 0x95, 0xC0);
+    const size_t was_int = emit_jump_ahead(e, CC_ALWAYS);
+    land(e, not_int);
+
+    // Doubles are true unless they are 0 or -0, which are the only ones that shifting the
+    // sign out of leaves 0: cmp ecx, VAL_DOUBLE; jne; mov rcx, [rdx]; shl rcx, 1; setne al
+    EMIT(&e->code, 0x83, 0xF9, VAL_DOUBLE);
+    const size_t not_double = emit_jump_ahead(e, CC_NE);
+    emit_load(e, 0x8B, RCX, RDX, 0);
+    EMIT(&e->code, 0x48, 0xD1, 0xE1, 0x0F, 0x95, 0xC0);
+    const size_t was_double = emit_jump_ahead(e, CC_ALWAYS);
+    land(e, not_double);
+
+    // Strings are true unless empty, wherever they are stored
+    EMIT(&e->code, 0x83, 0xF9, VAL_STR);
+    emit_to_slow(e, CC_NE);
+    emit_cmp_byte(e, RDX, offsetof(Value, storage), TKN_INLINE);
+    const size_t is_inline = emit_jump_ahead(e, CC_E);
+    // mov rdx, [rdx]
+    emit_load(e, 0x8B, RDX, RDX, 0);
+    land(e, is_inline);
+    emit_cmp_byte(e, RDX, 0, 0);
+    EMIT(&e->code, 0x0F, 0x95, 0xC0);
+
+    land(e, empty);
+    land(e, was_int);
+    land(e, was_double);
+    emit_slow_path(e, (uintptr_t) test, ins);
+}
+
+/**
+ * @brief The condition code for a comparison operator, as val_compare reads it
+ *
+ * @return The code, or -1 if it is not an operator
+ */
+static int compare_cc(const Value *op){
+    static const struct {
+        const char *op;
+        int cc;
+    } ops[] = {
+        { "=", CC_E }, { "!=", CC_NE }, { "<", CC_L }, { ">", CC_G }, { "<=", CC_LE }, { ">=", CC_GE }
+    };
+    for (size_t i = 0; op->type == VAL_STR && i < sizeof(ops) / sizeof(ops[0]); i++){
+        if (!strcmp(val_str(op), ops[i].op)){
+            return ops[i].cc;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Compares an int popped from the current list with an int literal b, pushing
+ * whether the condition cc holds onto the face list
+ */
+static void emit_compare_const(Emitter *e, const Instruction *ins, JitStep step, int b, int cc){
+    emit_current(e, RSI);
+    emit_slot(e, RDI, ins->list);
+    emit_plain_ring(e, RSI);
+    emit_not_empty(e, RSI);
+    emit_element(e, RDX, RCX, RSI, 1);
+    // cmp byte [rdx + type], VAL_INT; jne slow
+    emit_cmp_byte(e, RDX, offsetof(Value, type), VAL_INT);
+    emit_to_slow(e, CC_NE);
+    // mov eax, [rdx]; cmp eax, b; setcc al; movzx eax, al
+    EMIT(&e->code, 0x8B);
+    emit_mem(e, RAX, RDX, 0);
+    EMIT(&e->code, 0x3D);
+    emit_u32(&e->code, (uint32_t) b);
+    EMIT(&e->code, 0x0F, (unsigned char) (0x90 | cc), 0xC0, 0x0F, 0xB6, 0xC0);
+
+    // Pushed back onto the same list, the result takes the place of the int
+    emit_reg_op(e, 0x39, RSI, RDI);
+    const size_t other = emit_jump_ahead(e, CC_NE);
+    emit_store_int(e, RDX, RAX, RCX);
+    const size_t replaced = emit_jump_ahead(e, CC_ALWAYS);
+    land(e, other);
+    emit_plain_ring(e, RDI);
+    emit_room(e, RDI, RCX, 1);
+    emit_mem_imm(e, ALU_SUB, RSI, LIST_FIELD(size), 1);
+    emit_element(e, RDX, RCX, RDI, 0);
+    emit_store_int(e, RDX, RAX, RCX);
+    emit_mem_imm(e, ALU_ADD, RDI, LIST_FIELD(size), 1);
+    land(e, replaced);
+    emit_slow_path(e, (uintptr_t) step, ins);
+}
+
+/**
+ * @brief Sets al to whether the top of the face list is true, for ( | and 3
+ */
+static void emit_test(Emitter *e, const Jit *j, const Instruction *ins){
+    if (slot_fits(ins->list)){
+        emit_truthy(e, ins, j->hooks->truthy);
+    } else {
+        emit_call(e, (uintptr_t) j->hooks->truthy, ins);
+    }
+}
+
+/**
+ * @brief Jumps to the code for target if the test just emitted (leaving its result in al)
+ * gave jump_if
+ */
+static void emit_branch(Emitter *e, bool jump_if, size_t target){
+    // test al, al; jnz/jz rel32
+    EMIT(&e->code, 0x84, 0xC0, 0x0F, jump_if ? 0x85 : 0x84);
+    add_fixup(e, target);
+}
+
+/**
+ * @brief Leaves the compiled code, telling the interpreter to carry on at pc
+ */
+static void emit_exit(Emitter *e, size_t pc, size_t epilogue){
+    // mov eax, pc; jmp epilogue
+    EMIT(&e->code, 0xB8);
+    emit_u32(&e->code, (uint32_t) pc);
+    EMIT(&e->code, 0xE9);
+    emit_u32(&e->code, (uint32_t) (epilogue - (e->code.size + 4)));
+}
+
+/**
+ * @brief Emits the native template of an instruction, if it has one
+ *
+ * @return Whether it did
+ */
+static bool emit_template(Emitter *e, const Jit *j, const Instruction *ins){
+    const Program *p = j->program;
+    const JitStep step = j->hooks->steps[ins->op];
+    if (!step || !slot_fits(ins->list)){
+        return false;
+    }
+
+    switch (ins->op) {
+        case OP_PUSH:
+        case OP_PUSH_FACE:
+            emit_push(e, ins, step, p->literals[ins->arg]);
+            return true;
+        case OP_COUNT:
+            emit_count(e, ins, step);
+            return true;
+        case OP_ROTATE_BY:
+            emit_rotate_by(e, ins, step, p->literals[ins->arg].i);
+            return true;
+        case OP_MOVE_LEFT_N:
+        case OP_MOVE_RIGHT_N:
+            if (ins->arg > INT32_MAX){
+                return false;
+            }
+            emit_move_n(e, ins, step);
+            return true;
+        case OP_COMPARE_CONST_RIGHT: {
+            const Value *b = &p->literals[ins->arg];
+            const int cc = compare_cc(&p->literals[ins->arg + 1]);
+            if (b->type != VAL_INT || cc < 0){
+                return false;
+            }
+            emit_compare_const(e, ins, step, b->i, cc);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Turns machine code into a function, in memory that is executable but not writable
+ */
+static JitEntry install(Jit *j, const CodeBuf *b){
+    JitPages *page = (JitPages *)malloc(sizeof(JitPages));
+    void *mem = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!page || mem == MAP_FAILED){
+        free(page);
+        return NULL;
+    }
+    memcpy(mem, b->bytes, b->size);
+    if (mprotect(mem, b->size, PROT_READ | PROT_EXEC)){
+        munmap(mem, b->size);
+        free(page);
+        return NULL;
+    }
+
+    *page = (JitPages){ .next = j->pages, .mem = mem, .size = b->size };
+    j->pages = page;
+
+    JitEntry entry;
+    memcpy(&entry, &mem, sizeof(entry));
+    return entry;
+}
+
+/**
+ * @brief Compiles the loop from a ( to its ) by stitching together a template for each
+ * instruction. Literals, list slots and jump targets are immediates in the code.
+ *
+ * Pushing a literal, counting, rotating by a literal, moving n elements, comparing with a
+ * literal and the tests of ( | and 3 are native code. Each of these works on plain rings
+ * directly, and calls its step (or test) only for the cases that need list functions:
+ * ropes, shared or packed lists, and lists that must grow. Every other instruction calls
+ * its step, blocks inside the loop become native jumps, and jumps out of the loop and
+ * instructions without a step return to the interpreter.
+ */
+static JitEntry compile_loop(Jit *j, size_t open){
+    const Program *p = j->program;
+    const size_t close = p->code[open].arg - 1;
+    if (close >= UINT32_MAX){
+        return NULL;
+    }
+
+    Emitter e = { 0 };
+    size_t *offsets = (size_t *)malloc((close - open + 1) * sizeof(size_t));
+    if (!offsets){
+        ERROR("Failed to allocate memory to compile %zu instructions", close - open + 1);
+    }
+
+    // push rbx; mov rbx, rdi; jmp over the epilogue
+    EMIT(&e.code, 0x53, 0x48, 0x89, 0xFB, 0xEB, 0x02);
+    // pop rbx; ret
+    const size_t epilogue = e.code.size;
+    EMIT(&e.code, 0x5B, 0xC3);
+
+    for (size_t pc = open; pc <= close; pc++){
+        const Instruction *ins = &p->code[pc];
+        offsets[pc - open] = e.code.size;
+
+        switch (ins->op) {
+            case OP_OPEN_BLOCK:
+            case OP_DIVIDE_BLOCK:
+                emit_test(&e, j, ins);
+                emit_branch(&e, false, ins->arg);
+                break;
+            case OP_BREAK:
+                emit_test(&e, j, ins);
+                emit_branch(&e, true, ins->arg);
+                break;
+            case OP_BREAK_AND_POP:
+                emit_call(&e, (uintptr_t) j->hooks->break_and_pop, ins);
+                emit_branch(&e, true, ins->arg);
+                break;
+            case OP_CLOSE_BLOCK:
+                // jmp rel32
+                EMIT(&e.code, 0xE9);
+                add_fixup(&e, ins->arg);
+                break;
+            case OP_SET_CURRENT:
+                // mov qword [rbx], list
+                if (ins->list <= INT32_MAX){
+                    EMIT(&e.code, 0x48, 0xC7, 0x03);
+                    emit_u32(&e.code, ins->list);
+                    break;
+                }
+                emit_exit(&e, pc, epilogue);
+                break;
+            default:
+                if (emit_template(&e, j, ins)){
+                    break;
+                }
+                if (j->hooks->steps[ins->op]){
+                    emit_call(&e, (uintptr_t) j->hooks->steps[ins->op], ins);
+                } else {
+                    emit_exit(&e, pc, epilogue);
+                }
+                break;
+        }
+    }
+
+    // Jumps out of the loop go through an exit each
+    for (size_t i = 0; i < e.fixups_size; i++){
+        const size_t target = e.fixups[i].target;
+        size_t dest;
+        if (target >= open && target <= close){
+            dest = offsets[target - open];
+        } else {
+            dest = e.code.size;
+            emit_exit(&e, target, epilogue);
+        }
+        const uint32_t rel = (uint32_t) (dest - (e.fixups[i].at + 4));
+        memcpy(e.code.bytes + e.fixups[i].at, &rel, sizeof(rel));
+    }
+
+    JitEntry entry = install(j, &e.code);
+    free(offsets);
+    free(e.fixups);
+    free(e.code.bytes);
+    return entry;
+}
+
+#endif
+
+/**
+ * @brief Gets the compiled code for the loop starting at a (, counting it as entered once
+ * more and compiling it once it is hot
+ *
+ * @return The code, or NULL if the interpreter should run the loop
+ */
+JitEntry jit_entry(Jit *j, size_t open){
+    if (j->entries[open] || j->heat[open] == JIT_COLD){
+        return j->entries[open];
+    }
+    if (++j->heat[open] < JIT_HOT_LOOP){
+        return NULL;
+    }
+
+#ifdef HAVE_JIT
+    j->entries[open] = compile_loop(j, open);
+#endif
+    if (!j->entries[open]){
+        j->heat[open] = JIT_COLD;
+    }
+    return j->entries[open];
+}
@@ -0,0 +1,49 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "compile.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// How many times a loop has to be entered before it is compiled
+#define JIT_HOT_LOOP 16
+
+// Runs an instruction that always goes on to the next one
+typedef void (*JitStep)(RunState *s, const Instruction *ins);
+// Whether a block instruction leaves (or skips) its block
+typedef bool (*JitTest)(RunState *s, const Instruction *ins);
+// Compiled code for a loop, entered at its (. Returns where the interpreter carries on.
+typedef size_t (*JitEntry)(RunState *s);
+
+/**
+ * What compiled code calls back into the interpreter for
+ */
+typedef struct {
+    // NULL for instructions that are left to the interpreter
+    JitStep steps[NUM_OPCODES];
+    // Whether the top of the face list is true, for ( | and 3
+    JitTest truthy;
+    // Pops the top of the face list, giving whether it was true, for E
+    JitTest break_and_pop;
+} JitHooks;
+
+typedef struct JitPages JitPages;
+
+typedef struct {
+    const Program *program;
+    const JitHooks *hooks;
+    // How many times each ( has been entered, until its loop is compiled
+    unsigned int *heat;
+    // The compiled loop starting at each (, if any
+    JitEntry *entries;
+    JitPages *pages;
+} Jit;
+
+bool jit_available(void);
+void jit_init(Jit *j, const Program *p, const JitHooks *hooks);
+JitEntry jit_entry(Jit *j, size_t open);
+void jit_free(Jit *j);
+
+#endif
@@ -9,160 +9,339 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <pthread.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(EMOTICON_NO_SIMD)
+#define HAVE_SIMD_SCAN
+#include <immintrin.h>
+#endif
 
 /* Error */
 
 void lex_err(unsigned int lineno, unsigned int columnno, const char* msg, ...) {
     va_list args;
     va_start(args, msg);
-    vfprintf(stderr, msg, args);
-    fprintf(stderr, " (line %u, col %u)\n", lineno, columnno);
-    va_end(args);
-    exit(1);
+    fail_at("", lineno, columnno, msg, args);
 }
 
 /* Tokenizing */
 
+/*
+ * An obfuscated face is eyes, a mouth and a beard, and encodes OBFUSCATED_CHARS[eyes +
+ * mouth * 3 + beard * 12] (OBFUSCATED_EMO lists them in that order). Each table gives its
+ * part's term of that sum, plus one so that 0 can mean the character is not that part:
+ * their sum, less 3, is a perfect hash of the 36 faces.
+ */
+static const unsigned char obfuscated_eyes[256] = { [':'] = 1, ['8'] = 2, ['B'] = 3 };
+static const unsigned char obfuscated_mouths[256] = { [')'] = 1, [']'] = 4, ['['] = 7, ['('] = 10 };
+static const unsigned char obfuscated_beards[256] = { ['`'] = 1, ['-'] = 13, ['~'] = 25 };
+
+/**
+ * @brief Gets the index in OBFUSCATED_CHARS of the character an obfuscated face encodes
+ *
+ * @return The index, or -1 if it is not an obfuscated face
+ */
+static int obfuscated_index(const char face[3]){
+    const unsigned char eyes = obfuscated_eyes[(unsigned char) face[0]];
+    const unsigned char mouth = obfuscated_mouths[(unsigned char) face[1]];
+    const unsigned char beard = obfuscated_beards[(unsigned char) face[2]];
+    const int index = eyes + mouth + beard - 3;
+    // The last face is the terminator of OBFUSCATED_CHARS, so is not obfuscated
+    return eyes && mouth && beard && index < (int) sizeof(OBFUSCATED_CHARS) - 1 ? index : -1;
+}
+
 char deobfuscate_emoticon(const char face[3]){
-    int obs_index;
+    const int index = obfuscated_index(face);
+    return index < 0 ? '\0' : OBFUSCATED_CHARS[index];
+}
 
-    switch(face[2]){
-        case '`':
-            obs_index = 0;
-            break;
-        case '-':
-            obs_index = 12;
-            break;
-        case '~':
-            obs_index = 24;
-            break;
-        default:
-            // ERROR("Lexing Error: Obfusticated emoticon '%s' cannot have beard '%c'", 
-            //     face, face[2]);
-            // break;
-            return '\0';
-    }
+/*
+ * Numbers are recognised by a DFA over character classes, in one pass over the lexeme,
+ * accepting exactly what strtol (for INT) or strtod (for DOUBLE) would read all of. The
+ * forms only strtod reads (inf, nan, hex, leading spaces) end in NUM_OTHER, to be left to
+ * strtol and strtod themselves.
+ */
+typedef enum {
+    CHAR_OTHER,
+    CHAR_DIGIT,
+    CHAR_SIGN,
+    CHAR_DOT,
+    CHAR_EXPONENT,
+    // May start (or be in) a number that only strtod reads
+    CHAR_SPECIAL,
+    NUM_CHAR_CLASSES
+} NumberChar;
+
+static const unsigned char number_chars[256] = {
+    ['0'] = CHAR_DIGIT, ['1'] = CHAR_DIGIT, ['2'] = CHAR_DIGIT, ['3'] = CHAR_DIGIT,
+    ['4'] = CHAR_DIGIT, ['5'] = CHAR_DIGIT, ['6'] = CHAR_DIGIT, ['7'] = CHAR_DIGIT,
+    ['8'] = CHAR_DIGIT, ['9'] = CHAR_DIGIT,
+    ['+'] = CHAR_SIGN, ['-'] = CHAR_SIGN,
+    ['.'] = CHAR_DOT,
+    ['e'] = CHAR_EXPONENT, ['E'] = CHAR_EXPONENT,
+    [' '] = CHAR_SPECIAL, ['\t'] = CHAR_SPECIAL, ['\n'] = CHAR_SPECIAL, ['\v'] = CHAR_SPECIAL,
+    ['\f'] = CHAR_SPECIAL, ['\r'] = CHAR_SPECIAL,
+    ['i'] = CHAR_SPECIAL, ['I'] = CHAR_SPECIAL, ['n'] = CHAR_SPECIAL, ['N'] = CHAR_SPECIAL,
+    ['x'] = CHAR_SPECIAL, ['X'] = CHAR_SPECIAL,
+};
+
+typedef enum {
+    // Not a number, so a string
+    NUM_NONE,
+    NUM_START,
+    NUM_SIGN,
+    // Digits, maybe signed: an INT
+    NUM_INT,
+    // A dot with no digits before it
+    NUM_DOT,
+    // Digits with a dot in or after them: a DOUBLE
+    NUM_FRACTION,
+    NUM_EXPONENT,
+    NUM_EXPONENT_SIGN,
+    // A DOUBLE with an exponent
+    NUM_EXPONENT_DIGITS,
+    // Left to strtol and strtod
+    NUM_OTHER,
+    NUM_STATES
+} NumberState;
+
+static const unsigned char number_dfa[NUM_STATES][NUM_CHAR_CLASSES] = {
+    [NUM_START] = {
+        [CHAR_DIGIT] = NUM_INT, [CHAR_SIGN] = NUM_SIGN, [CHAR_DOT] = NUM_DOT, [CHAR_SPECIAL] = NUM_OTHER
+    },
+    [NUM_SIGN] = { [CHAR_DIGIT] = NUM_INT, [CHAR_DOT] = NUM_DOT, [CHAR_SPECIAL] = NUM_OTHER },
+    [NUM_INT] = {
+        [CHAR_DIGIT] = NUM_INT, [CHAR_DOT] = NUM_FRACTION, [CHAR_EXPONENT] = NUM_EXPONENT,
+        [CHAR_SPECIAL] = NUM_OTHER
+    },
+    [NUM_DOT] = { [CHAR_DIGIT] = NUM_FRACTION },
+    [NUM_FRACTION] = { [CHAR_DIGIT] = NUM_FRACTION, [CHAR_EXPONENT] = NUM_EXPONENT },
+    [NUM_EXPONENT] = { [CHAR_DIGIT] = NUM_EXPONENT_DIGITS, [CHAR_SIGN] = NUM_EXPONENT_SIGN },
+    [NUM_EXPONENT_SIGN] = { [CHAR_DIGIT] = NUM_EXPONENT_DIGITS },
+    [NUM_EXPONENT_DIGITS] = { [CHAR_DIGIT] = NUM_EXPONENT_DIGITS },
+    // NUM_NONE and NUM_OTHER stay as they are
+    [NUM_OTHER] = { NUM_OTHER, NUM_OTHER, NUM_OTHER, NUM_OTHER, NUM_OTHER, NUM_OTHER },
+};
+
+// Ints of at most this many digits cannot overflow while they are scanned
+#define SCANNED_INT_DIGITS 9
 
-    switch(face[1]){
-        case ')':
-            obs_index += 0;
-            break;
-        case ']':
-            obs_index += 3;
-            break;
-        case '[':
-            obs_index += 6;
-            break;
-        case '(':
-            obs_index += 9;
-            break;
-        default:
-            // ERROR("Lexing Error: Obfusticated emoticon '%s' cannot have mouth '%c'", 
-            //     face, face[1]);
-            // break;
-            return '\0';
-    }
+/**
+ * @brief Reads a number with strtol, or failing that strtod
+ *
+ * @param may_be_int Whether to try strtol, rather than only strtod
+ * @return Whether all of the lexeme is a number (which is put into t)
+ */
+static bool parse_number(const char *s, size_t len, bool may_be_int, Token *t){
+    // Numbers are parsed from a NUL terminated copy, on the stack unless it is huge
+    char small[64];
+    char *num = len < sizeof(small) ? small : (char *) malloc(len + 1);
+    assert(num);
+    memcpy(num, s, len);
+    num[len] = '\0';
 
-    switch(face[0]){
-        case ':':
-            obs_index += 0;
-            break;
-        case '8':
-            obs_index += 1;
-            break;
-        case 'B':
-            obs_index += 2;
-            break;
-        default:
-            // ERROR("Lexing Error: Obfusticated emoticon '%s' cannot have eyes '%c'", 
-            //     face, face[0]);
-            // break;
-            return '\0';
+    // May be a int
+    char *end = NULL;
+    long ival = may_be_int ? strtol(num, &end, 10) : 0;
+    if (may_be_int && end == num + len){
+        if (num != small) {
+            free(num);
+        }
+        if (ival > INT_MAX || ival < INT_MIN){
+            lex_err(t->line, t->column, "Integer value %ld overflow bounds [%d, %d]", ival, INT_MIN, INT_MAX);
+        }
+        t->type = INT;
+        t->value.i = (int) ival;
+        return true;
     }
 
-    if (obs_index < 0 || obs_index > (int)sizeof(OBFUSCATED_CHARS)){
-        ERROR("Internal Error: Face '%s' resulted in obfuscated character of index %d "
-                "(should be less that %zu)", face, obs_index, sizeof(OBFUSCATED_CHARS));
+    // May be a double
+    end = NULL;
+    double dval = strtod(num, &end);
+    bool is_double = end == num + len;
+    if (num != small) {
+        free(num);
     }
-
-    return OBFUSCATED_CHARS[obs_index];
+    if (is_double){
+        t->type = DOUBLE;
+        t->value.d = dval;
+    }
+    return is_double;
 }
 
-Token lex_token(const char *s, unsigned int lineno, unsigned int columnno){
+/**
+ * @brief Classifies a lexeme without copying anything out of it.
+ * @details String payloads borrow from their source and are not NUL terminated:
+ * STR values point to the lexeme itself, OBFUS values point to the single character
+ * they encode, and emoticon eyes are left NULL (they are the first
+ * emoticon_eyes_len(len) characters of the lexeme).
+ * 
+ * @param s The lexeme (need not be NUL terminated)
+ * @param len The length of the lexeme
+ * @return The classified token
+ */
+Token classify_lexme(const char *s, size_t len, unsigned int lineno, unsigned int columnno){
     Token t = (Token){
+        .storage = TKN_BORROWED,
         .column = columnno,
         .line = lineno,
     };
 
-    size_t tkn_len = strlen(s);
-
     // May be obfuscated char
-    if (tkn_len == 3) {
-        char dbf = deobfuscate_emoticon(s);
-        if (dbf) {
+    if (len == 3) {
+        const int obfuscated = obfuscated_index(s);
+        if (obfuscated >= 0) {
             t.type = OBFUS;
-            t.value.str = (char *)calloc(2, sizeof(char));
-            t.value.str[0] = dbf;
+            t.value.str = (char *) &OBFUSCATED_CHARS[obfuscated];
             return t;
         }
     }
 
     // May be obfustication switch
-    if (!strcmp("^_^", s) || !strcmp("^__^", s)){
+    if ((len == 3 && !memcmp("^_^", s, 3)) || (len == 4 && !memcmp("^__^", s, 4))){
         t.type = EMOTICON;
         t.value.emoticon = (Emoticon){
             .eyes = NULL,
             .nose = '\0',
             // ^_^ = on, ^__^ = off
-            .op = tkn_len == 3 ? OBFUSCATION_ON : OBFUSCATION_OFF
+            .op = len == 3 ? OBFUSCATION_ON : OBFUSCATION_OFF
         };
         return t;
     }
 
     // May be other operation
-    if (tkn_len >= 2 && mouth_optype_table[(int) s[tkn_len - 1]]) {
+    if (len >= 2 && mouth_optype_table[(unsigned char) s[len - 1]]) {
         t.type = EMOTICON;
 
         // Note: 2 character emoticons are valid: eyes are first character and mouth is second
         t.value.emoticon = (Emoticon){
-            .op = (Op_Type) s[tkn_len - 1], // Enum values are the same as the mouth characters
-            .nose = tkn_len > 2 ? s[tkn_len - 2] : '\0',
-            .eyes = strndup(s, tkn_len > 2 ? tkn_len - 2 : 1)
+            .op = (Op_Type) s[len - 1], // Enum values are the same as the mouth characters
+            .nose = len > 2 ? s[len - 2] : '\0',
+            .eyes = NULL
         };
-
-        // Terminate reused string early so eyes don't include nose/mouth
         return t;
     }
 
-    // May be a int
-
-    char *end = NULL;
-    long ival = strtol(s, &end, 10);
-    if (end == s + strlen(s)){
-        if (ival > INT_MAX || ival < INT_MIN){
-            lex_err(lineno, columnno, "Integer value %ld overflow bounds [%d, %d]", ival, INT_MIN, INT_MAX);
+    // May be a number. Its digits are added up as they are scanned, which is its value if
+    // it turns out to be an int.
+    unsigned char state = NUM_START;
+    unsigned int ival = 0;
+    for (size_t i = 0; i < len && state != NUM_NONE; i++){
+        const unsigned char c = (unsigned char) s[i];
+        const unsigned char class = number_chars[c];
+        state = number_dfa[state][class];
+        if (class == CHAR_DIGIT){
+            ival = ival * 10 + (unsigned int) (c - '0');
         }
-        t.type = INT;
-        t.value.i = (int) ival;
-        return t;
     }
 
-    // May be a double
-    end = NULL;
-    double dval = strtod(s, &end);
-    if (end == s + strlen(s)){
-        t.type = DOUBLE;
-        t.value.d = dval;
+    switch (state) {
+        case NUM_INT:
+            // Longer ints may overflow, which strtol reports
+            if (len - (s[0] == '-' || s[0] == '+') <= SCANNED_INT_DIGITS){
+                t.type = INT;
+                t.value.i = s[0] == '-' ? -(int) ival : (int) ival;
+                return t;
+            }
+            break;
+        // An empty lexeme is read by strtol as 0
+        case NUM_START:
+        case NUM_FRACTION:
+        case NUM_EXPONENT_DIGITS:
+        case NUM_OTHER:
+            break;
+        default:
+            state = NUM_NONE;
+            break;
+    }
+    if (state != NUM_NONE && parse_number(s, len, state != NUM_FRACTION && state != NUM_EXPONENT_DIGITS, &t)){
         return t;
     }
 
     // Otherwise, treat as a string
     t.type = STR;
-    t.value.str = strdup(s);
+    t.value.str = (char *) s;
     return t;
 }
 
+/**
+ * @brief Makes a STR token, storing the string inline if it fits
+ * 
+ * @param pool The pool to allocate a long string from (or NULL for malloc)
+ * @param s The string (need not be NUL terminated)
+ * @param len The length of the string
+ */
+Token str_tkn(StrPool *pool, const char *s, size_t len, unsigned int lineno, unsigned int columnno){
+    Token t = (Token){
+        .type = STR,
+        .line = lineno,
+        .column = columnno
+    };
+
+    if (len < INLINE_STR_SIZE) {
+        t.storage = TKN_INLINE;
+        memcpy(t.value.inline_str, s, len);
+        t.value.inline_str[len] = '\0';
+    } else {
+        t.value.str = pool ? pool_strndup(pool, s, len) : strndup(s, len);
+    }
+    return t;
+}
+
+/**
+ * @brief Lexes a lexeme into a self contained token, copying its strings out of the source
+ * @details Short strings and eyes are stored inline, so only long ones allocate.
+ * 
+ * @param s The lexeme (need not be NUL terminated)
+ * @param len The length of the lexeme
+ * @return The token. Free with free_tkn.
+ */
+Token lex_lexme(const char *s, size_t len, unsigned int lineno, unsigned int columnno){
+    Token t = classify_lexme(s, len, lineno, columnno);
+    switch (t.type) {
+        case OBFUS:
+            t.storage = TKN_INLINE;
+            t.value.inline_str[0] = *t.value.str;
+            t.value.inline_str[1] = '\0';
+            break;
+        case STR:
+            t = str_tkn(NULL, s, len, lineno, columnno);
+            break;
+        case EMOTICON:
+            if (t.value.emoticon.op != OBFUSCATION_ON && t.value.emoticon.op != OBFUSCATION_OFF) {
+                const size_t eyes_len = emoticon_eyes_len(len);
+                if (eyes_len < INLINE_EYES_SIZE) {
+                    t.storage = TKN_INLINE;
+                    memcpy(t.value.emoticon.inline_eyes, s, eyes_len);
+                    t.value.emoticon.inline_eyes[eyes_len] = '\0';
+                } else {
+                    t.storage = TKN_HEAP;
+                    t.value.emoticon.eyes = strndup(s, eyes_len);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    return t;
+}
+
+Token lex_token(const char *s, unsigned int lineno, unsigned int columnno){
+    return lex_lexme(s, strlen(s), lineno, columnno);
+}
+
 void free_tkn(Token t) {
+    if (t.storage != TKN_HEAP) {
+        return;
+    }
+
     if ((t.type == OBFUS || t.type == STR) && t.value.str) {
         free(t.value.str);
         t.value.str = NULL;
@@ -175,19 +354,21 @@ void free_tkn(Token t) {
 }
 
 Token copy_tkn(const Token t){
-    Token newt = (Token){
-        .column = t.column,
-        .line = t.line,
-        .type = t.type,
-        .value = t.value
-    };
+    // Inline and borrowed strings are copied along with the token
+    Token newt = t;
+    if (t.storage != TKN_HEAP) {
+        return newt;
+    }
+
     switch (t.type) {
         case OBFUS:
         case STR:
             newt.value.str = strdup(t.value.str);
             return newt;
         case EMOTICON:
-            newt.value.emoticon.eyes = strdup(t.value.emoticon.eyes);
+            if (t.value.emoticon.eyes) {
+                newt.value.emoticon.eyes = strdup(t.value.emoticon.eyes);
+            }
             return newt;
         default:
             return newt;
@@ -200,18 +381,20 @@ bool token_eq(const Token a, const Token b) {
     }
 
     if (a.type == OBFUS || a.type == STR) {
-        return !strcmp(a.value.str, b.value.str);
+        return !strcmp(tkn_str(&a), tkn_str(&b));
     } else if (a.type == INT) {
         return a.value.i == b.value.i;
     } else if (a.type == DOUBLE) {
         return a.value.d == b.value.d;
     } else if (a.type == EMOTICON) {
         Emoticon ae = a.value.emoticon;
-        Emoticon be = a.value.emoticon;
+        Emoticon be = b.value.emoticon;
+        const char *aeyes = tkn_eyes(&a);
+        const char *beyes = tkn_eyes(&b);
 
-        if (ae.eyes && be.eyes && strcmp(ae.eyes, be.eyes)){
+        if (aeyes && beyes && strcmp(aeyes, beyes)){
             return false;
-        } else if ((!ae.eyes || !be.eyes) && ae.eyes != be.eyes) {
+        } else if ((!aeyes || !beyes) && aeyes != beyes) {
             return false;
         }
 
@@ -225,14 +408,14 @@ bool token_eq(const Token a, const Token b) {
 char *token2str(const Token t) {
     switch (t.type) {
         case STR:
-            return strdup(t.value.str);
+            return strdup(tkn_str(&t));
         case OBFUS:
             for (int i = 0; i < (int) sizeof(OBFUSCATED_CHARS) - 1; i++) {
-                if (OBFUSCATED_CHARS[i] == t.value.str[0]) {
+                if (OBFUSCATED_CHARS[i] == tkn_str(&t)[0]) {
                     return strdup(OBFUSCATED_EMO[i]);
                 }
             }
-            ERROR("Tried to detokenize obfuscated emoticon with invalid value '%s'", t.value.str);
+            ERROR("Tried to detokenize obfuscated emoticon with invalid value '%s'", tkn_str(&t));
         case EMOTICON: {
             Emoticon e = t.value.emoticon;
             if (e.op == OBFUSCATION_OFF || e.op == OBFUSCATION_ON) {
@@ -240,9 +423,9 @@ char *token2str(const Token t) {
             }
             char *res = (char *)calloc(1000, sizeof(char));
             if (e.nose) {
-                sprintf(res, "%s%c%c", e.eyes, e.nose, e.op);
+                sprintf(res, "%s%c%c", tkn_eyes(&t), e.nose, e.op);
             } else {
-                sprintf(res, "%s%c", e.eyes, e.op);
+                sprintf(res, "%s%c", tkn_eyes(&t), e.op);
             }
             return res;
         }
@@ -287,50 +470,316 @@ char *format_token(const Token t) {
 /* Lexing the file */
 
 /**
- * @brief Skips white space in file.
- * @details the character after the whitespace, so getch will be that character.
- * This also means any ungot character will be overwritten.
+ * @brief Loads a whole code file into memory.
+ * @details Regular files are mapped read-only where mmap is available, anything else
+ * (pipes, terminals) is read into a single buffer. Lexing starts at the file's current
+ * position.
  * 
+ * @param src The source to initialise
+ * @param f The code file
+ * @return `0` on success, `1` if the file could not be read
  */
-void skip_ws(FILE *f, unsigned int *line, unsigned int *col) {
-    int c;
-    while (isspace(c = getc(f)) && !feof(f)){
-        if (c == '\n'){
-            *col = 0;
-            *line += 1;
-        } else {
-            *col += 1;
+int open_source(Source *src, FILE *f){
+    *src = (Source){ .scan_level = best_scan_level() };
+
+#ifdef HAVE_MMAP
+    struct stat st;
+    const int fd = fileno(f);
+    const off_t offset = ftello(f);
+    if (fd >= 0 && offset >= 0 && !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > offset) {
+        void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+            src->buf = (const char *) map;
+            src->size = (size_t) st.st_size;
+            src->pos = (size_t) offset;
+            src->mapped = true;
+            // Leave the file as if it had been read, like the buffered path below
+            fseeko(f, 0, SEEK_END);
+            return 0;
+        }
+    }
+#endif
+
+    size_t max_size = 4096;
+    char *buf = (char *) malloc(max_size);
+    if (!buf) {
+        return 1;
+    }
+
+    size_t size = 0;
+    size_t n;
+    while ((n = fread(buf + size, sizeof(char), max_size - size - 1, f)) > 0) {
+        size += n;
+        if (size + 1 >= max_size) {
+            char *temp = (char *) realloc(buf, max_size * 2);
+            if (!temp) {
+                free(buf);
+                return 1;
+            }
+            buf = temp;
+            max_size *= 2;
         }
     }
-    ungetc(c, f);
+
+    if (ferror(f)) {
+        free(buf);
+        return 1;
+    }
+
+    buf[size] = '\0';
+    src->buf = buf;
+    src->size = size;
+    src->owned = true;
+    return 0;
 }
 
 /**
- * @brief Get the full string tokenized
- * 
- * @return Full character string
- * @throws Exits with an assertion error if data cannot be (re)allocated
+ * @brief Makes a source lexing a string in place (the string is not copied or freed)
  */
-char *get_lexme(FILE *f, unsigned int *col){
-    char *token = (char *) calloc(51, sizeof(char));
-    assert(token);
-    size_t curr_size = 0;
-    size_t max_size = 51;
-
-    int c;
-    while (!isspace((c = getc(f))) && !feof(f)) {
-        token[curr_size++] = c;
-        *col += 1;
-        if (curr_size >= max_size) {
-            char *temp = (char *) realloc(token, max_size * 2);
-            assert(temp);
-            token = temp;
-            max_size *= 2;
+Source string_source(const char *s, size_t len){
+    return (Source){
+        .buf = s,
+        .size = len,
+        .scan_level = best_scan_level()
+    };
+}
+
+void close_source(Source *src){
+#ifdef HAVE_MMAP
+    if (src->mapped) {
+        munmap((void *) src->buf, src->size);
+        *src = (Source){ 0 };
+        return;
+    }
+#endif
+    if (src->owned) {
+        free((void *) src->buf);
+    }
+    *src = (Source){ 0 };
+}
+
+/* Scanning */
+
+/*
+ * Whitespace is exactly what isspace accepts in the C locale: ' ' and '\t' to '\r'.
+ * A whitespace scanner returns the end of the run of whitespace starting at pos, adding
+ * the newlines in it to *newlines and setting *line_start to just after the last one.
+ * A lexeme scanner returns the end of the run of non-whitespace starting at pos.
+ */
+typedef size_t (*WsScanner)(const char *buf, size_t pos, size_t size,
+                            unsigned int *newlines, size_t *line_start);
+typedef size_t (*LexmeScanner)(const char *buf, size_t pos, size_t size);
+
+static inline bool is_ws(unsigned char c){
+    return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
+}
+
+static size_t scan_ws_scalar(const char *buf, size_t pos, size_t size,
+                             unsigned int *newlines, size_t *line_start){
+    while (pos < size && is_ws((unsigned char) buf[pos])){
+        if (buf[pos] == '\n'){
+            *newlines += 1;
+            *line_start = pos + 1;
+        }
+        pos++;
+    }
+    return pos;
+}
+
+static size_t scan_lexme_scalar(const char *buf, size_t pos, size_t size){
+    while (pos < size && !is_ws((unsigned char) buf[pos])){
+        pos++;
+    }
+    return pos;
+}
+
+#ifdef HAVE_SIMD_SCAN
+
+/*
+ * Bytes are classified a vector at a time into whitespace and newline bitmasks. '\t' to
+ * '\r' are found with one signed compare by shifting that range down to [-128, -124].
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i ws_mask_sse2(__m128i v){
+    const __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    const __m128i ctrl = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8(0x77)), _mm_set1_epi8(-123));
+    return _mm_or_si128(space, ctrl);
+}
+
+__attribute__((target("sse2")))
+static size_t scan_ws_sse2(const char *buf, size_t pos, size_t size,
+                           unsigned int *newlines, size_t *line_start){
+    while (pos + 16 <= size){
+        const __m128i v = _mm_loadu_si128((const __m128i *) (buf + pos));
+        const unsigned int ws = (unsigned int) _mm_movemask_epi8(ws_mask_sse2(v));
+        unsigned int nl = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+
+        const unsigned int run = ws == 0xFFFF ? 16 : (unsigned int) __builtin_ctz(~ws);
+        nl &= (1U << run) - 1;
+        if (nl){
+            *newlines += (unsigned int) __builtin_popcount(nl);
+            *line_start = pos + (31 - __builtin_clz(nl)) + 1;
+        }
+
+        pos += run;
+        if (run < 16){
+            return pos;
+        }
+    }
+    return scan_ws_scalar(buf, pos, size, newlines, line_start);
+}
+
+__attribute__((target("sse2")))
+static size_t scan_lexme_sse2(const char *buf, size_t pos, size_t size){
+    while (pos + 16 <= size){
+        const __m128i v = _mm_loadu_si128((const __m128i *) (buf + pos));
+        const unsigned int ws = (unsigned int) _mm_movemask_epi8(ws_mask_sse2(v));
+        if (ws){
+            return pos + (size_t) __builtin_ctz(ws);
+        }
+        pos += 16;
+    }
+    return scan_lexme_scalar(buf, pos, size);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ws_mask_avx2(__m256i v){
+    const __m256i space = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    const __m256i ctrl = _mm256_cmpgt_epi8(_mm256_set1_epi8(-123),
+                                           _mm256_add_epi8(v, _mm256_set1_epi8(0x77)));
+    return _mm256_or_si256(space, ctrl);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_ws_avx2(const char *buf, size_t pos, size_t size,
+                           unsigned int *newlines, size_t *line_start){
+    while (pos + 32 <= size){
+        const __m256i v = _mm256_loadu_si256((const __m256i *) (buf + pos));
+        const unsigned int ws = (unsigned int) _mm256_movemask_epi8(ws_mask_avx2(v));
+        unsigned int nl = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+
+        const unsigned int run = ws == 0xFFFFFFFF ? 32 : (unsigned int) __builtin_ctz(~ws);
+        if (run < 32){
+            nl &= (1U << run) - 1;
+        }
+        if (nl){
+            *newlines += (unsigned int) __builtin_popcount(nl);
+            *line_start = pos + (31 - __builtin_clz(nl)) + 1;
+        }
+
+        pos += run;
+        if (run < 32){
+            return pos;
         }
     }
+    return scan_ws_sse2(buf, pos, size, newlines, line_start);
+}
 
-    ungetc(c, f);
-    token[curr_size] = '\0';
-    return token;
+__attribute__((target("avx2")))
+static size_t scan_lexme_avx2(const char *buf, size_t pos, size_t size){
+    while (pos + 32 <= size){
+        const __m256i v = _mm256_loadu_si256((const __m256i *) (buf + pos));
+        const unsigned int ws = (unsigned int) _mm256_movemask_epi8(ws_mask_avx2(v));
+        if (ws){
+            return pos + (size_t) __builtin_ctz(ws);
+        }
+        pos += 32;
+    }
+    return scan_lexme_sse2(buf, pos, size);
 }
 
+#endif
+
+typedef struct {
+    WsScanner ws;
+    LexmeScanner lexme;
+} Scanners;
+
+// The scanners of each level. Sources made some other way than open_source or
+// string_source (so SCAN_UNSET) are scanned one byte at a time.
+static const Scanners scanners[] = {
+    [SCAN_UNSET] = { scan_ws_scalar, scan_lexme_scalar },
+    [SCAN_SCALAR] = { scan_ws_scalar, scan_lexme_scalar },
+#ifdef HAVE_SIMD_SCAN
+    [SCAN_SSE2] = { scan_ws_sse2, scan_lexme_sse2 },
+    [SCAN_AVX2] = { scan_ws_avx2, scan_lexme_avx2 },
+#endif
+};
+
+// The CPU is only asked once, however many threads open sources
+static ScanLevel best_level = SCAN_UNSET;
+static pthread_once_t best_level_once = PTHREAD_ONCE_INIT;
+
+static void find_best_scan_level(void){
+    best_level = SCAN_SCALAR;
+#ifdef HAVE_SIMD_SCAN
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+        best_level = SCAN_AVX2;
+    } else if (__builtin_cpu_supports("sse2")){
+        best_level = SCAN_SSE2;
+    }
+#endif
+}
+
+/**
+ * @brief The best scanning level the CPU supports
+ */
+ScanLevel best_scan_level(void){
+    pthread_once(&best_level_once, find_best_scan_level);
+    return best_level;
+}
+
+/**
+ * @brief Selects the scanners skip_ws and get_lexme use for a source
+ * 
+ * @param level The level to use. It is lowered to the best level the CPU supports, and
+ * SCAN_UNSET is the best level.
+ * @return The level actually used
+ */
+ScanLevel set_scan_level(Source *src, ScanLevel level){
+    const ScanLevel best = best_scan_level();
+    if (level == SCAN_UNSET || level > best){
+        level = best;
+    }
+    src->scan_level = level;
+    return level;
+}
+
+/**
+ * @brief Skips white space in the source, keeping track of the line and column.
+ */
+void skip_ws(Source *src) {
+    unsigned int newlines = 0;
+    size_t line_start = 0;
+    const size_t end = scanners[src->scan_level].ws(src->buf, src->pos, src->size, &newlines, &line_start);
+
+    if (newlines){
+        src->line += newlines;
+        src->column = (unsigned int) (end - line_start);
+    } else {
+        src->column += (unsigned int) (end - src->pos);
+    }
+    src->pos = end;
+}
+
+/**
+ * @brief Gets the next lexeme as a slice of the source
+ * 
+ * @return The lexeme, which has length 0 at the end of the source
+ */
+Lexeme get_lexme(Source *src){
+    Lexeme lx = {
+        .offset = src->pos,
+        .line = src->line,
+        .column = src->column
+    };
+
+    const size_t end = scanners[src->scan_level].lexme(src->buf, src->pos, src->size);
+    lx.length = end - src->pos;
+    src->column += (unsigned int) lx.length;
+    src->pos = end;
+    return lx;
+}
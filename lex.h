@@ -3,8 +3,9 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 
-extern FILE* codefile;
+#include "arena.h"
 
 static const char OBFUSCATED_CHARS[] = "ABCDEFGHIJKLMNOPQSTUVWXYZ0123456789";
 
@@ -74,12 +75,30 @@ static const Op_Type mouth_optype_table[256] = {
     ['E'] = BREAK_AND_POP,
 };
 
+// Longest strings (including the terminator) stored inline in a token
+#define INLINE_EYES_SIZE 8
+#define INLINE_STR_SIZE 16
+
 typedef struct {
+    union {
+        char* eyes;
+        char inline_eyes[INLINE_EYES_SIZE];
+    };
     Op_Type op;
     char nose;
-    char* eyes;
 } Emoticon;
 
+// Where the string payload (str or eyes) of a token lives
+typedef enum {
+    // Owned by the token: malloced, or from the pool of the list holding it
+    TKN_HEAP,
+    // Owned by something that outlives the token (such as an arena), so it is shared by
+    // copies and never freed through the token
+    TKN_BORROWED,
+    // In the token itself (inline_str or inline_eyes)
+    TKN_INLINE
+} TokenStorage;
+
 typedef struct {
     enum {
         STR,
@@ -88,8 +107,10 @@ typedef struct {
         INT,
         DOUBLE
     } type;
+    TokenStorage storage;
     union {
         char* str;
+        char inline_str[INLINE_STR_SIZE];
         Emoticon emoticon;
         int i;
         double d;
@@ -98,12 +119,69 @@ typedef struct {
     unsigned int column;
 } Token;
 
+// The string of a STR or OBFUS token, wherever it is stored
+static inline const char *tkn_str(const Token *t){
+    return t->storage == TKN_INLINE ? t->value.inline_str : t->value.str;
+}
+
+// The eyes of an EMOTICON token (NULL for obfuscation switches), wherever they are stored
+static inline const char *tkn_eyes(const Token *t){
+    return t->storage == TKN_INLINE ? t->value.emoticon.inline_eyes : t->value.emoticon.eyes;
+}
+
+// Implementations of whitespace/lexeme scanning, chosen at runtime from what the CPU supports
+typedef enum {
+    SCAN_UNSET,
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+} ScanLevel;
+
+/**
+ * A whole code file held in memory (mapped or read into one buffer), lexed in place.
+ */
+typedef struct {
+    const char *buf;
+    size_t size;
+    size_t pos;
+    unsigned int line;
+    unsigned int column;
+    // Whether buf is mapped (unmapped on close) or owned (freed on close)
+    bool mapped;
+    bool owned;
+    // The scanners it is lexed with, the best the CPU supports unless set_scan_level changes it
+    ScanLevel scan_level;
+} Source;
+
+/**
+ * A lexeme as a slice of its Source
+ */
+typedef struct {
+    size_t offset;
+    size_t length;
+    unsigned int line;
+    unsigned int column;
+} Lexeme;
+
+// Eyes are everything but the nose and mouth (or everything but the mouth for 2 characters)
+#define emoticon_eyes_len(len) ((len) > 2 ? (len) - 2 : 1)
+
 char deobfuscate_emoticon(const char face[3]);
 
-void skip_ws(FILE *f, unsigned int *line, unsigned int *col);
-char *get_lexme(FILE *f, unsigned int *col);
+ScanLevel best_scan_level(void);
+ScanLevel set_scan_level(Source *src, ScanLevel level);
+
+int open_source(Source *src, FILE *f);
+Source string_source(const char *s, size_t len);
+void close_source(Source *src);
+
+void skip_ws(Source *src);
+Lexeme get_lexme(Source *src);
+Token classify_lexme(const char *s, size_t len, unsigned int lineno, unsigned int columnno);
+Token lex_lexme(const char *s, size_t len, unsigned int lineno, unsigned int columnno);
 Token lex_token(const char *s, unsigned int lineno, unsigned int columnno);
 
+Token str_tkn(StrPool *pool, const char *s, size_t len, unsigned int lineno, unsigned int columnno);
 void free_tkn(Token t);
 bool token_eq(Token a, Token b);
 Token copy_tkn(const Token t);
@@ -0,0 +1,159 @@
+#include "emoticon.h"
+#include "interpret.h"
+#include "optimise.h"
+#include "runtime.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(EMO_OPT_NONE == OPT_NONE && EMO_OPT_MAX == OPT_MAX, "emoticon.h should match optimise.h");
+
+struct EmoProgram {
+    Program program;
+};
+
+struct EmoInstance {
+    RunState state;
+    // Whether state has been set up by runtime_start, so only needs resetting from now on
+    bool started;
+    bool jit;
+    char error[ERROR_MESSAGE_SIZE];
+};
+
+/**
+ * @brief Makes an instance to run programs on
+ *
+ * @param jit Whether to compile hot loops to machine code, where supported
+ * @return The instance (free it with emo_free), or NULL if there was not the memory for it
+ */
+EmoInstance *emo_new(bool jit){
+    EmoInstance *e = (EmoInstance *)calloc(1, sizeof(EmoInstance));
+    if (e){
+        e->jit = jit;
+    }
+    return e;
+}
+
+void emo_free(EmoInstance *e){
+    if (!e){
+        return;
+    }
+    if (e->started){
+        runtime_stop(&e->state);
+    }
+    free(e);
+}
+
+/**
+ * @brief Gets the message of the error of the instance's last call, or "" if it had none
+ */
+const char *emo_error(const EmoInstance *e){
+    return e->error;
+}
+
+static EmoProgram *new_program(EmoInstance *e){
+    EmoProgram *p = (EmoProgram *)calloc(1, sizeof(EmoProgram));
+    if (!p){
+        snprintf(e->error, sizeof(e->error), "Failed to allocate memory for a program");
+    }
+    return p;
+}
+
+static EmoStatus compiled(EmoProgram *p, int res, EmoProgram **out){
+    if (res){
+        free(p);
+        return EMO_COMPILE_ERROR;
+    }
+    *out = p;
+    return EMO_OK;
+}
+
+/**
+ * @brief Compiles (and optimises) code held in memory
+ *
+ * @param opt_level From EMO_OPT_NONE to EMO_OPT_MAX
+ * @param out The program, to free with emo_free_program once nothing is running it
+ */
+EmoStatus emo_compile(EmoInstance *e, const char *code, size_t size, int opt_level, EmoProgram **out){
+    e->error[0] = '\0';
+    EmoProgram *p = new_program(e);
+    if (!p){
+        return EMO_COMPILE_ERROR;
+    }
+    return compiled(p, interpret_compile_string(code, size, opt_level, &p->program, e->error), out);
+}
+
+/**
+ * @brief Compiles (and optimises) the rest of a code file, as emo_compile does code in memory
+ */
+EmoStatus emo_compile_file(EmoInstance *e, FILE *code, int opt_level, EmoProgram **out){
+    e->error[0] = '\0';
+    EmoProgram *p = new_program(e);
+    if (!p){
+        return EMO_COMPILE_ERROR;
+    }
+    return compiled(p, interpret_compile(code, opt_level, &p->program, e->error), out);
+}
+
+void emo_free_program(EmoProgram *p){
+    if (!p){
+        return;
+    }
+    free_program(p->program);
+    free(p);
+}
+
+/**
+ * @brief Sets up the instance's state to run a program from the start: for the first time,
+ * or by emptying what the last program left
+ *
+ * @return 0, or 1 if there was not the memory for it (with the error in e->error)
+ */
+static int prepare(EmoInstance *e, const Program *p, FILE *input, FILE *output){
+    ErrorTrap trap;
+    ErrorTrap *const outer = error_trap;
+    error_trap = &trap;
+
+    int res = 0;
+    if (!setjmp(trap.env)){
+        if (e->started){
+            runtime_reset(&e->state, p, input, output);
+        } else {
+            runtime_start(&e->state, p, input, output);
+            e->started = true;
+        }
+    } else {
+        memcpy(e->error, trap.message, sizeof(e->error));
+        res = 1;
+    }
+
+    error_trap = outer;
+    return res;
+}
+
+/**
+ * @brief Runs a program on an instance, starting from empty lists
+ *
+ * @param input Read by the program's input emoticons
+ * @param output Gets everything the program prints, written out by the time this returns
+ */
+EmoStatus emo_run(EmoInstance *e, const EmoProgram *p, FILE *input, FILE *output){
+    e->error[0] = '\0';
+    if (prepare(e, &p->program, input, output) ||
+            interpret_state(&e->state, &p->program, e->jit, e->error)){
+        return EMO_RUNTIME_ERROR;
+    }
+    return EMO_OK;
+}
+
+/**
+ * @brief Empties the instance's lists, keeping their memory for the next run. The program
+ * it last ran may already have been freed.
+ */
+void emo_reset(EmoInstance *e){
+    e->error[0] = '\0';
+    if (e->started){
+        runtime_clear(&e->state);
+    }
+}
@@ -2,32 +2,546 @@
 #include "error.h"
 
 #include <stdio.h>
+#include <string.h>
 
-#define CONV_IND(l, i) ((l->start_ind + (i)) % l->size)
+// Physical index of the ring element j places after head
+#define PHYS_IND(l, j) (((l)->head + (j)) & ((l)->max_size - 1))
+
+static size_t round_pow2(size_t size){
+    size_t res = 1;
+    while (res < size){
+        res *= 2;
+    }
+    return res;
+}
+
+/* Rope */
+
+static RopeNode *rope_node(bool leaf){
+    RopeNode *n = (RopeNode *)malloc(sizeof(RopeNode));
+    if (!n){
+        ERROR("Failed to allocate memory for a rope node");
+    }
+    n->size = 0;
+    n->count = 0;
+    n->refs = 1;
+    n->leaf = leaf;
+    return n;
+}
+
+/**
+ * @brief Gets a node that only the caller refers to, copying it if it is shared.
+ * The copy shares the children of the original, or copies the elements if it is a leaf.
+ */
+static RopeNode *rope_unshare(RopeNode *n, StrPool *pool){
+    if (n->refs == 1){
+        return n;
+    }
+
+    RopeNode *res = rope_node(n->leaf);
+    res->size = n->size;
+    res->count = n->count;
+    for (unsigned int i = 0; i < n->count; i++){
+        if (n->leaf){
+            res->values[i] = copy_val(pool, n->values[i]);
+        } else {
+            res->children[i] = n->children[i];
+            res->children[i]->refs++;
+        }
+    }
+    n->refs--;
+    return res;
+}
+
+/**
+ * @brief Finds the child of an inner node holding the element j elements into it (or, when
+ * inserting, the child to insert at j in)
+ *
+ * @param j Set to how far into the child the element is
+ */
+static unsigned int rope_child(const RopeNode *n, size_t *j, bool inserting){
+    // Searching from the nearer end keeps accesses to either end of the list cheap
+    if (*j < n->size / 2){
+        unsigned int c = 0;
+        while (c + 1 < n->count && *j >= n->children[c]->size + inserting){
+            *j -= n->children[c]->size;
+            c++;
+        }
+        return c;
+    }
+
+    unsigned int c = n->count - 1;
+    size_t from_end = n->size - *j;
+    while (c > 0 && from_end > n->children[c]->size){
+        from_end -= n->children[c]->size;
+        c--;
+    }
+    *j = n->children[c]->size - from_end;
+    return c;
+}
+
+static Value *rope_at(RopeNode *n, size_t j){
+    while (!n->leaf){
+        n = n->children[rope_child(n, &j, false)];
+    }
+    return &n->values[j];
+}
+
+static void leaf_insert(RopeNode *n, size_t j, Value el){
+    memmove(n->values + j + 1, n->values + j, (n->count - j) * sizeof(Value));
+    n->values[j] = el;
+    n->count++;
+    n->size++;
+}
+
+/**
+ * @brief Inserts an element j elements into a rope node, splitting the node if it is full.
+ * The node must not be shared.
+ *
+ * @return The new right half of the node if it was split, NULL otherwise
+ */
+static RopeNode *rope_insert(RopeNode *n, size_t j, Value el, StrPool *pool){
+    if (n->leaf){
+        if (n->count < ROPE_LEAF_SIZE){
+            leaf_insert(n, j, el);
+            return NULL;
+        }
+
+        // Appending to a full node starts a new one rather than leaving two half full
+        const unsigned int half = j == ROPE_LEAF_SIZE ? ROPE_LEAF_SIZE : ROPE_LEAF_SIZE / 2;
+        RopeNode *right = rope_node(true);
+        memcpy(right->values, n->values + half, (ROPE_LEAF_SIZE - half) * sizeof(Value));
+        right->count = ROPE_LEAF_SIZE - half;
+        right->size = right->count;
+        n->count = half;
+        n->size = half;
+
+        if (j >= half){
+            leaf_insert(right, j - half, el);
+        } else {
+            leaf_insert(n, j, el);
+        }
+        return right;
+    }
+
+    const unsigned int c = rope_child(n, &j, true);
+    n->children[c] = rope_unshare(n->children[c], pool);
+    RopeNode *split = rope_insert(n->children[c], j, el, pool);
+    n->size++;
+    if (!split){
+        return NULL;
+    }
+
+    RopeNode *target = n;
+    RopeNode *right = NULL;
+    unsigned int pos = c + 1;
+    if (n->count == ROPE_FANOUT){
+        const unsigned int half = pos == ROPE_FANOUT ? ROPE_FANOUT : ROPE_FANOUT / 2;
+        right = rope_node(false);
+        memcpy(right->children, n->children + half, (ROPE_FANOUT - half) * sizeof(RopeNode *));
+        right->count = ROPE_FANOUT - half;
+        n->count = half;
+        if (pos > ROPE_FANOUT / 2){
+            target = right;
+            pos -= half;
+        }
+    }
+
+    memmove(target->children + pos + 1, target->children + pos, (target->count - pos) * sizeof(RopeNode *));
+    target->children[pos] = split;
+    target->count++;
+
+    if (right){
+        for (unsigned int i = 0; i < right->count; i++){
+            right->size += right->children[i]->size;
+        }
+        n->size -= right->size;
+    }
+    return right;
+}
+
+/**
+ * @brief Removes the element j elements into a rope node. Emptied nodes are freed, and
+ * small leaves are merged into their neighbours. The node must not be shared.
+ */
+static void rope_remove(RopeNode *n, size_t j, Value *dest, StrPool *pool){
+    if (n->leaf){
+        *dest = n->values[j];
+        memmove(n->values + j, n->values + j + 1, (n->count - j - 1) * sizeof(Value));
+        n->count--;
+        n->size--;
+        return;
+    }
+
+    const unsigned int c = rope_child(n, &j, false);
+    n->children[c] = rope_unshare(n->children[c], pool);
+    rope_remove(n->children[c], j, dest, pool);
+    n->size--;
+
+    RopeNode *child = n->children[c];
+    if (child->count == 0){
+        free(child);
+        memmove(n->children + c, n->children + c + 1, (n->count - c - 1) * sizeof(RopeNode *));
+        n->count--;
+    } else if (child->leaf && child->count < ROPE_LEAF_SIZE / 4 && n->count > 1){
+        const unsigned int lo = c + 1 < n->count ? c : c - 1;
+        if (n->children[lo]->count + n->children[lo + 1]->count <= ROPE_LEAF_SIZE / 2){
+            RopeNode *a = n->children[lo] = rope_unshare(n->children[lo], pool);
+            RopeNode *b = n->children[lo + 1] = rope_unshare(n->children[lo + 1], pool);
+            memcpy(a->values + a->count, b->values, b->count * sizeof(Value));
+            a->count += b->count;
+            a->size += b->size;
+            free(b);
+            memmove(n->children + lo + 1, n->children + lo + 2, (n->count - lo - 2) * sizeof(RopeNode *));
+            n->count--;
+        }
+    }
+}
+
+/**
+ * @brief Builds a rope of full leaves from an array of values
+ */
+static RopeNode *rope_build(const Value *arr, size_t size){
+    size_t count = (size + ROPE_LEAF_SIZE - 1) / ROPE_LEAF_SIZE;
+    if (!count){
+        return rope_node(true);
+    }
+
+    RopeNode **level = (RopeNode **)malloc(count * sizeof(RopeNode *));
+    if (!level){
+        ERROR("Failed to allocate memory for a rope of %zu elements", size);
+    }
+
+    for (size_t i = 0; i < count; i++){
+        RopeNode *leaf = rope_node(true);
+        const size_t n = size - i * ROPE_LEAF_SIZE < ROPE_LEAF_SIZE ? size - i * ROPE_LEAF_SIZE : ROPE_LEAF_SIZE;
+        memcpy(leaf->values, arr + i * ROPE_LEAF_SIZE, n * sizeof(Value));
+        leaf->count = (unsigned int) n;
+        leaf->size = n;
+        level[i] = leaf;
+    }
+
+    while (count > 1){
+        const size_t parents = (count + ROPE_FANOUT - 1) / ROPE_FANOUT;
+        for (size_t i = 0; i < parents; i++){
+            RopeNode *parent = rope_node(false);
+            for (size_t c = i * ROPE_FANOUT; c < count && c < (i + 1) * ROPE_FANOUT; c++){
+                parent->children[parent->count++] = level[c];
+                parent->size += level[c]->size;
+            }
+            level[i] = parent;
+        }
+        count = parents;
+    }
+
+    RopeNode *root = level[0];
+    free(level);
+    return root;
+}
+
+/**
+ * @brief Moves the elements of a rope node into an array in order. Elements of shared
+ * nodes are copied instead (everything below a shared node is shared too).
+ *
+ * @return The number of elements moved
+ */
+static size_t rope_flatten(const RopeNode *n, Value *dest, StrPool *pool, bool shared){
+    shared = shared || n->refs > 1;
+    if (n->leaf){
+        for (unsigned int i = 0; i < n->count; i++){
+            dest[i] = shared ? copy_val(pool, n->values[i]) : n->values[i];
+        }
+        return n->count;
+    }
+
+    size_t len = 0;
+    for (unsigned int i = 0; i < n->count; i++){
+        len += rope_flatten(n->children[i], dest + len, pool, shared);
+    }
+    return len;
+}
+
+/**
+ * @brief Drops a reference to a rope node, freeing it and everything below it that is not
+ * shared if it was the last one
+ *
+ * @param pool The pool of the strings of the elements
+ * @param elements Whether to free the elements too
+ */
+static void rope_free(RopeNode *n, StrPool *pool, bool elements){
+    if (--n->refs){
+        return;
+    }
+
+    for (unsigned int i = 0; i < n->count; i++){
+        if (!n->leaf){
+            rope_free(n->children[i], pool, elements);
+        } else if (elements){
+            free_val(pool, n->values[i]);
+        }
+    }
+    free(n);
+}
+
+/* Storage */
+
+// Lists are stored either way as a sequence of elements, which rotation and reversal
+// are applied on top of. These work on indices into that sequence.
+
+static inline bool is_char_val(const Value *v){
+    if (v->type != VAL_STR){
+        return false;
+    }
+    const char *s = val_str(v);
+    return s[0] && !s[1];
+}
+
+static inline Value storage_get(const List *l, size_t j){
+    if (l->rope){
+        return *rope_at(l->rope, j);
+    }
+    return l->chars ? char_val(l->chars[PHYS_IND(l, j)]) : l->arr[PHYS_IND(l, j)];
+}
+
+/**
+ * @brief Moves a ring element from one physical index to another
+ */
+static inline void ring_move(List *l, size_t to, size_t from){
+    if (l->chars){
+        l->chars[to] = l->chars[from];
+    } else {
+        l->arr[to] = l->arr[from];
+    }
+}
+
+/**
+ * @brief Converts a list index into the index of its element in storage
+ */
+static inline size_t storage_ind(const List *l, size_t ind){
+    size_t j = l->start_ind + ind;
+    if (j >= l->size){
+        j -= l->size;
+    }
+    return l->reversed ? l->size - 1 - j : j;
+}
+
+/**
+ * @brief Gives a ring its own copy of its elements if it shares them with other lists
+ */
+static void ring_unshare(List *l){
+    if (!l->refs){
+        return;
+    }
+
+    if (--*l->refs == 0){
+        free(l->refs);
+        l->refs = NULL;
+        return;
+    }
+
+    l->refs = NULL;
+    if (l->chars){
+        char *chars = (char *)malloc(l->max_size);
+        if (!chars){
+            ERROR("Failed to allocate memory for a copy of list of size %zu", l->size);
+        }
+        memcpy(chars, l->chars, l->max_size);
+        l->chars = chars;
+        return;
+    }
+
+    Value *arr = (Value *)malloc(l->max_size * sizeof(Value));
+    if (!arr){
+        ERROR("Failed to allocate memory for a copy of list of size %zu", l->size);
+    }
+    for (size_t j = 0; j < l->size; j++){
+        arr[PHYS_IND(l, j)] = copy_val(l->pool, l->arr[PHYS_IND(l, j)]);
+    }
+    l->arr = arr;
+}
+
+/**
+ * @brief Turns a packed ring into a ring of values, keeping its layout
+ */
+static void unpack(List *l){
+    Value *arr = (Value *)malloc(l->max_size * sizeof(Value));
+    if (!arr){
+        ERROR("Failed to allocate memory to unpack a list of size %zu", l->size);
+    }
+    for (size_t j = 0; j < l->size; j++){
+        arr[PHYS_IND(l, j)] = char_val(l->chars[PHYS_IND(l, j)]);
+    }
+
+    if (!l->refs || !--*l->refs){
+        free(l->refs);
+        free(l->chars);
+    }
+    l->refs = NULL;
+    l->chars = NULL;
+    l->arr = arr;
+}
+
+/**
+ * @brief Doubles the capacity of a ring, moving its elements to the start of the new
+ * array in list order (so that head and start_ind are 0, and it is not reversed)
+ *
+ * @return `0` on success, `1` if the memory could not be allocated (the list is unchanged)
+ */
+static int grow(List *l){
+    const size_t new_max = l->max_size ? l->max_size * 2 : 4;
+    if (l->chars){
+        char *new_chars = (char *)malloc(new_max);
+        if (!new_chars){
+            return 1;
+        }
+        lget_chars(*l, new_chars);
+        free(l->chars);
+        l->chars = new_chars;
+    } else {
+        Value *new_arr = (Value *)malloc(new_max * sizeof(Value));
+        if (!new_arr){
+            return 1;
+        }
+        for (size_t i = 0; i < l->size; i++){
+            new_arr[i] = l->arr[PHYS_IND(l, storage_ind(l, i))];
+        }
+        free(l->arr);
+        l->arr = new_arr;
+    }
+
+    l->max_size = new_max;
+    l->head = 0;
+    l->start_ind = 0;
+    l->reversed = false;
+    return 0;
+}
+
+static void to_rope(List *l){
+    Value *flat = (Value *)malloc(l->size * sizeof(Value));
+    if (!flat){
+        ERROR("Failed to allocate memory to convert a list of size %zu to a rope", l->size);
+    }
+    for (size_t j = 0; j < l->size; j++){
+        flat[j] = l->arr[PHYS_IND(l, j)];
+    }
+
+    l->rope = rope_build(flat, l->size);
+    free(flat);
+    TFREE(l->arr);
+    l->max_size = 0;
+    l->head = 0;
+}
+
+static void to_ring(List *l){
+    const size_t max_size = round_pow2(l->size ? l->size : 1);
+    Value *arr = (Value *)malloc(max_size * sizeof(Value));
+    if (!arr){
+        ERROR("Failed to allocate memory to convert a list of size %zu to a ring", l->size);
+    }
+
+    rope_flatten(l->rope, arr, l->pool, false);
+    rope_free(l->rope, l->pool, false);
+    l->rope = NULL;
+    l->arr = arr;
+    l->max_size = max_size;
+    l->head = 0;
+}
+
+/**
+ * @brief Inserts an element j elements into a ring, shifting elements towards whichever
+ * end is nearer. There must be room for it.
+ */
+static void ring_insert(List *l, size_t j, Value el){
+    if (j < l->size - j) {
+        l->head = (l->head - 1) & (l->max_size - 1);
+        for (size_t i = 0; i < j; i++){
+            ring_move(l, PHYS_IND(l, i), PHYS_IND(l, i + 1));
+        }
+    } else {
+        for (size_t i = l->size; i > j; i--){
+            ring_move(l, PHYS_IND(l, i), PHYS_IND(l, i - 1));
+        }
+    }
+
+    if (l->chars){
+        l->chars[PHYS_IND(l, j)] = val_str(&el)[0];
+        free_val(l->pool, el);
+    } else {
+        l->arr[PHYS_IND(l, j)] = el;
+    }
+}
+
+/**
+ * @brief Removes the element j elements into a ring, shifting elements from whichever
+ * end is nearer
+ */
+static void ring_remove(List *l, size_t j, Value *dest){
+    *dest = storage_get(l, j);
+
+    if (j < l->size - 1 - j) {
+        for (size_t i = j; i > 0; i--){
+            ring_move(l, PHYS_IND(l, i), PHYS_IND(l, i - 1));
+        }
+        l->head = (l->head + 1) & (l->max_size - 1);
+    } else {
+        for (size_t i = j; i + 1 < l->size; i++){
+            ring_move(l, PHYS_IND(l, i), PHYS_IND(l, i + 1));
+        }
+    }
+}
+
+/**
+ * @brief Moves the elements of a ring into list order from head, so that start_ind is 0,
+ * moving whichever of the elements before or after its start are fewer around the ring.
+ * The ring must not be shared.
+ */
+static void ring_normalise(List *l){
+    // How far the stored elements have to rotate left. Rotation is applied before reversal,
+    // so reversed lists rotate their storage the other way.
+    const size_t r = l->reversed ? l->size - l->start_ind : l->start_ind;
+    if (r <= l->size - r){
+        // The first r elements go after the last, into slots that are free or already moved
+        for (size_t i = 0; i < r; i++){
+            ring_move(l, PHYS_IND(l, l->size + i), PHYS_IND(l, i));
+        }
+        l->head = (l->head + r) & (l->max_size - 1);
+    } else {
+        const size_t back = l->size - r;
+        for (size_t i = 1; i <= back; i++){
+            ring_move(l, PHYS_IND(l, (size_t) 0 - i), PHYS_IND(l, l->size - i));
+        }
+        l->head = (l->head - back) & (l->max_size - 1);
+    }
+    l->start_ind = 0;
+}
+
+/* List */
 
 /**
  * @brief Creates a new List given an optional underlying list and a size
  * 
  * @param arr The underlying array to use, or NULL to automatically create a new array.
+ * The list takes ownership of it, and may reallocate it to a power of two size.
  * @param size The size of the new List. If arr is NULL, this is the max size, and the actual size is set to 0.
  * @return The new List.
  * 
  * @throws Error if the function failed to allocate memory
  */
-List create_list(Token *arr, size_t size){
+List create_list(Value *arr, size_t size){
     List l = (List){
         .size = arr ? size : 0,
-        .max_size = size,
-        .start_ind = 0
+        .max_size = size ? round_pow2(size) : 0,
+        .pool = NULL
     };
 
     if (arr) {
-        l.arr = arr;
+        l.arr = l.max_size == size ? arr : (Value *)realloc(arr, l.max_size * sizeof(Value));
     } else {
-        l.arr = (Token *)calloc(l.max_size, sizeof(Token));
-        if (!l.arr){
-            ERROR("Failed to allocate memory for a list of max_size %zu", l.max_size);
-        }
+        l.arr = l.max_size ? (Value *)calloc(l.max_size, sizeof(Value)) : NULL;
+    }
+
+    if (l.max_size && !l.arr){
+        ERROR("Failed to allocate memory for a list of max_size %zu", l.max_size);
     }
 
     return l;
@@ -35,7 +549,10 @@ List create_list(Token *arr, size_t size){
 
 
 /**
- * Inserts an element at an index into a list
+ * Inserts an element at an index into a list. Small lists shift elements towards
+ * whichever end of the list is nearer, so inserting at either end is O(1) (amortized).
+ * A rotated ring is first moved back into list order, which is O(min(k, n - k)) for a
+ * rotation by k, once. Large lists are ropes, where inserting anywhere is O(log n).
  * 
  * ### Parameters ###
  * `l` - List to insert into
@@ -48,110 +565,217 @@ List create_list(Token *arr, size_t size){
  * `1` - Out of bounds of list
  * `2` - Could not allocate enough memory for the new list. (The original will not be changed)
  */
-int linsert(List *l, size_t ind, Token el){
-
-    // TODO: Insert end
+int linsert(List *l, size_t ind, Value el){
     if (ind > l->size){
         return 1;
     }
 
-    if (ind == 0 && l->size == 0){
-        if (l->max_size == 0) {
-            Token *new_arr = (Token *)calloc(1, sizeof(Token));
-            if (!new_arr){
-                return 2;
-            }
-            l->arr = new_arr;
-        }
-
-        l->arr[0] = el;
-        l->size++;
+    if (l->rope){
+        l->rope = rope_unshare(l->rope, l->pool);
+    } else {
+        ring_unshare(l);
+    }
 
-        return 0;
-    } else if (l->size >= l->max_size) {
+    if (l->chars && !is_char_val(&el)){
+        unpack(l);
+    }
 
-        // Try to allocate more memory (2x original best, original + 1 otherwise)
-        Token *new_arr = (Token *)calloc(l->max_size * 2, sizeof(Token));
-        if (!new_arr){
-            new_arr = (Token *)calloc(l->max_size + 1, sizeof(Token));
-            if (!new_arr) {
-                // fprintf(stderr, "Could not allocate more space for list array of size %zu", l->max_size + 1);
-                return 2;
-            }
-            l->max_size += 1;
-        } else {
-            l->max_size *= 2;
-        }
-
-        // Transfer old array to new array, such that start_ind == 0
-        // Also include newly inserted element
-        for (size_t i = 0; i <= l->size; i++){
-            if (i < ind){
-                new_arr[i] = l->arr[CONV_IND(l, i)];
-            } else if (i == ind) {
-                new_arr[i] = el;
-            } else {
-                new_arr[i] = l->arr[CONV_IND(l, i - 1)];
-            }
-        }
-        l->size += 1;
-        TFREE(l->arr);
+    if (!l->rope && !l->chars && l->size >= LIST_ROPE_SIZE){
+        to_rope(l);
+    } else if (!l->rope && l->size == l->max_size && grow(l)){
+        return 2;
+    }
+    if (!l->rope && l->start_ind){
+        ring_normalise(l);
+    }
 
-        l->arr = new_arr;
-        l->start_ind = 0;
-        return 0;
-    } else {
-        l->size += 1;
+    // Where the element goes in the rotated order. Inserting at the end of a rotated list
+    // puts it just before its first element.
+    size_t p = l->start_ind + ind;
+    if (l->start_ind && p >= l->size){
+        p -= l->size;
+    }
 
-        const size_t ci = CONV_IND(l, ind);
-        for (size_t i = l->size - 1; i >= ci; i--){
-            l->arr[i + 1] = l->arr[i];
-        }
-        l->arr[ci] = el;
-        
-        if (ci < l->start_ind){
-            l->start_ind += 1;
+    const size_t j = l->reversed ? l->size - p : p;
+    if (l->rope){
+        RopeNode *split = rope_insert(l->rope, j, el, l->pool);
+        if (split){
+            RopeNode *root = rope_node(false);
+            root->children[0] = l->rope;
+            root->children[1] = split;
+            root->count = 2;
+            root->size = l->rope->size + split->size;
+            l->rope = root;
         }
+    } else {
+        ring_insert(l, j, el);
+    }
 
-        return 0;
+    if (ind == 0){
+        l->start_ind = p;
+    } else if (l->start_ind >= p){
+        l->start_ind += 1;
     }
+    l->size += 1;
+
+    return 0;
 }
 
-int lremove(List *l, size_t ind){
+/**
+ * @brief Removes an element from a list without freeing it. Popping either end of a small
+ * list is O(1) (after moving a rotated ring back into list order, as linsert does), and
+ * popping anywhere in a large list is O(log n).
+ * 
+ * @param l The list to remove from
+ * @param ind The index of the element to remove
+ * @param dest A pointer to the variable to put the removed element in
+ * @return `1` if out of bounds, `0` otherwise 
+ */
+int lpop(List *l, size_t ind, Value *dest){
     
     if (ind >= l->size){
         return 1;
     }
 
-    const size_t ci = CONV_IND(l, ind);
-    free_tkn(l->arr[ci]);
-    for (size_t i = ci; i < l->size - 1; i++){
-        l->arr[i] = l->arr[i + 1];
+    if (!l->rope){
+        ring_unshare(l);
+        if (l->start_ind){
+            ring_normalise(l);
+        }
+    }
+
+    size_t p = l->start_ind + ind;
+    if (p >= l->size){
+        p -= l->size;
+    }
+
+    const size_t j = l->reversed ? l->size - 1 - p : p;
+    if (l->rope){
+        l->rope = rope_unshare(l->rope, l->pool);
+        rope_remove(l->rope, j, dest, l->pool);
+        while (!l->rope->leaf && l->rope->count == 1){
+            RopeNode *root = l->rope;
+            l->rope = root->children[0];
+            free(root);
+        }
+    } else {
+        ring_remove(l, j, dest);
     }
 
-    if (ci < l->start_ind){
+    if (l->start_ind > p){
         l->start_ind -= 1;
     }
 
     l->size -= 1;
+    if (l->start_ind >= l->size){
+        l->start_ind = 0;
+    }
+
+    if (l->rope && l->size < LIST_ROPE_SIZE / 4){
+        to_ring(l);
+    }
 
     return 0;
 }
 
+int lremove(List *l, size_t ind){
+    Value t;
+    if (lpop(l, ind, &t)){
+        return 1;
+    }
+
+    free_val(l->pool, t);
+    return 0;
+}
+
 /**
- * @brief Gets a token from a list and stores it in a variable
+ * @brief Gets a value from a list and stores it in a variable
  * 
  * @param l The list to get from
  * @param ind The index of the element to get
  * @param dest A pointer to the variable to put the result in
  * @return `1` if out of bounds, `0` otherwise 
  */
-int lget(List l, size_t ind, Token *dest){
+int lget(List l, size_t ind, Value *dest){
     if (ind >= l.size){
         return 1;
     }
 
-    *dest = l.arr[(l.start_ind + ind) % l.size];
+    *dest = storage_get(&l, storage_ind(&l, ind));
+    return 0;
+}
+
+/**
+ * @brief Appends the characters of a string to a list, each as a single character string.
+ * An empty list becomes packed, holding the characters as bytes until something else is
+ * inserted into it.
+ *
+ * @param l The list to append to
+ * @param s The string (need not be NUL terminated)
+ * @param len The length of the string
+ * @return `0` on success, `2` if the list could not grow (as for linsert). An empty list
+ * that could not be packed is left as it was.
+ */
+int lappend_chars(List *l, const char *s, size_t len){
+    if (!l->chars && !l->size && !l->rope && len){
+        char *chars = (char *)malloc(round_pow2(len));
+        if (!chars){
+            return 2;
+        }
+        lrelease(*l);
+        *l = (List){
+            .chars = chars,
+            .max_size = round_pow2(len),
+            .pool = l->pool
+        };
+    }
+
+    // Packed rings are appended to in bulk unless their order is rotated or reversed
+    if (!l->chars || l->start_ind || l->reversed){
+        for (size_t i = 0; i < len; i++){
+            if (linsert(l, l->size, char_val(s[i]))){
+                return 2;
+            }
+        }
+        return 0;
+    }
+
+    ring_unshare(l);
+    while (l->size + len > l->max_size){
+        if (grow(l)){
+            return 2;
+        }
+    }
+
+    const size_t tail = PHYS_IND(l, l->size);
+    const size_t first = len < l->max_size - tail ? len : l->max_size - tail;
+    memcpy(l->chars + tail, s, first);
+    memcpy(l->chars, s + first, len - first);
+    l->size += len;
+    return 0;
+}
+
+/**
+ * @brief Copies the characters of a packed list into a buffer in order
+ *
+ * @param dest Where to put the characters (not NUL terminated). Must hold l.size bytes.
+ * @return `1` if the list is not packed, `0` otherwise
+ */
+int lget_chars(List l, char *dest){
+    if (!l.chars){
+        return 1;
+    }
+
+    if (!l.start_ind && !l.reversed){
+        const size_t first = l.size < l.max_size - l.head ? l.size : l.max_size - l.head;
+        memcpy(dest, l.chars + l.head, first);
+        memcpy(dest + first, l.chars, l.size - first);
+        return 0;
+    }
+
+    for (size_t i = 0; i < l.size; i++){
+        dest[i] = l.chars[PHYS_IND(&l, storage_ind(&l, i))];
+    }
     return 0;
 }
 
@@ -160,51 +784,141 @@ void lrotate(List *l, long long amount){
         return;
     }
 
-    l->start_ind = (l->start_ind + amount) % l->size;
+    const long long size = (long long) l->size;
+    const size_t start = (size_t) ((((long long) l->start_ind + amount) % size + size) % size);
+
+    // A full ring has no gap, so its rotation can be folded into head. Other rings are moved
+    // into the rotated order by the next linsert or lpop.
+    if (!l->rope && l->size == l->max_size){
+        l->head = (l->reversed ? l->head - start : l->head + start) & (l->max_size - 1);
+        l->start_ind = 0;
+    } else {
+        l->start_ind = start;
+    }
 }
 
 void lreverse(List *l){
-    for (size_t i = 0; i < l->size / 2; i++){
-        size_t ci = CONV_IND(l, i);
-        size_t copp = CONV_IND(l, l->size - i - 1);
-        
-        Token temp = l->arr[ci];
-        l->arr[ci] = l->arr[copp];
-        l->arr[copp] = temp;
+    // Reading the elements backwards turns a rotation by n into one by -n
+    l->reversed = !l->reversed;
+    if (l->start_ind){
+        l->start_ind = l->size - l->start_ind;
     }
 }
 
-List lcopy(const List l){
-    List newl = (List){
-        .max_size = l.max_size,
-        .size = l.size,
-        .start_ind = l.start_ind
-    };
-
-    newl.arr = (Token *) calloc(l.max_size, sizeof(Token));
-    if (!newl.arr){
-        newl.arr = (Token *) calloc(l.size, sizeof(Token));
-        if (!newl.arr){
-            ERROR("Failed to allocate memory for a copy of list of size %zu (originally tried %zu)", l.size, l.max_size);
+/**
+ * @brief Copies a list in O(1). The copy shares the storage of the original until either
+ * of them is changed, and then only the changed part is copied (the whole array for rings,
+ * the nodes on the way to the change for ropes).
+ */
+List lcopy(List *l){
+    List newl = *l;
+
+    if (l->rope){
+        l->rope->refs++;
+    } else if (l->arr || l->chars){
+        if (!l->refs){
+            l->refs = (size_t *)malloc(sizeof(size_t));
+            if (!l->refs){
+                ERROR("Failed to allocate memory for a copy of list of size %zu", l->size);
+            }
+            *l->refs = 1;
         }
+        ++*l->refs;
+        newl.refs = l->refs;
     }
 
-    for (size_t i = 0; i < l.size; i++){
-        newl.arr[i] = copy_tkn(l.arr[i]);
+    return newl;
+}
+
+/**
+ * @brief Moves the last n elements of a list onto the end of another, as popping and
+ * pushing them one at a time would (so they end up in reverse order).
+ * Moving all of a list into an empty one (with the same pool) is O(1).
+ *
+ * @return `1` if src has fewer than n elements, `2` if dest could not grow, `0` otherwise
+ */
+int lmove(List *src, List *dest, size_t n){
+    if (n > src->size){
+        return 1;
     }
 
-    return newl;
+    if (n == src->size && !dest->size && src->pool == dest->pool){
+        const List empty = *dest;
+        *dest = *src;
+        lreverse(dest);
+        *src = empty;
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; i++){
+        Value v;
+        lpop(src, src->size - 1, &v);
+        if (linsert(dest, dest->size, v)){
+            free_val(src->pool, v);
+            return 2;
+        }
+    }
+    return 0;
 }
 
 void lfree(List l){
+    if (l.rope){
+        rope_free(l.rope, l.pool, true);
+        return;
+    }
+
+    if (l.refs && --*l.refs){
+        return;
+    }
+    free(l.refs);
+    free(l.chars);
+
     if (l.arr == NULL){
         return;
     }
 
-    for (size_t i = 0; i < l.size; i++){
-        free_tkn(l.arr[i]);
-        l.arr[i] = (Token){ 0 };
+    for (size_t j = 0; j < l.size; j++){
+        free_val(l.pool, l.arr[PHYS_IND(&l, j)]);
     }
 
     free(l.arr);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Frees a list's storage but not the strings of its elements, for when they are
+ * released in bulk (by destroying their pool)
+ */
+void lrelease(List l){
+    if (l.rope){
+        rope_free(l.rope, l.pool, false);
+        return;
+    }
+
+    if (l.refs && --*l.refs){
+        return;
+    }
+    free(l.refs);
+    free(l.chars);
+    free(l.arr);
+}
+
+/**
+ * @brief Empties a list, keeping its ring buffer to be refilled if no other list shares it.
+ * Ropes, packed and shared lists are freed.
+ */
+void lclear(List *l){
+    if (l->rope || l->chars || l->refs){
+        StrPool *pool = l->pool;
+        lfree(*l);
+        *l = (List){ .pool = pool };
+        return;
+    }
+
+    for (size_t j = 0; j < l->size; j++){
+        free_val(l->pool, l->arr[PHYS_IND(l, j)]);
+    }
+    l->size = 0;
+    l->head = 0;
+    l->start_ind = 0;
+    l->reversed = false;
+}
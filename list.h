@@ -1,26 +1,84 @@
 #ifndef LIST_H
 #define LIST_H
 
-#include "lex.h"
+#include "value.h"
 #include <stdlib.h>
+#include <stdbool.h>
 
+// Lists switch to a rope once they grow past this many elements, and back to a ring
+// once they shrink below a quarter of it
+#define LIST_ROPE_SIZE 16384
+
+// Elements per rope leaf and children per inner rope node
+#define ROPE_LEAF_SIZE 256
+#define ROPE_FANOUT 64
+
+typedef struct RopeNode RopeNode;
+
+/**
+ * A node of a rope: a B-tree of fixed size blocks of values, where each node knows how many
+ * elements are below it so that elements can be found by index.
+ * Nodes are shared between copies of a list, and copied along the path to a change.
+ */
+struct RopeNode {
+    size_t size;
+    unsigned int count;
+    // How many lists or parent nodes refer to this node
+    unsigned int refs;
+    bool leaf;
+    union {
+        RopeNode *children[ROPE_FANOUT];
+        Value values[ROPE_LEAF_SIZE];
+    };
+};
+
+/**
+ * A list stored as either a double ended ring buffer or (once large) a rope.
+ *
+ * The ring is used while rope is NULL. max_size is 0 or a power of two, so physical
+ * indices are found with a mask, and elements are stored from arr[head] onwards (wrapping).
+ * A ring filled by lappend_chars is packed: it holds single character strings as bytes in
+ * chars instead of arr, until something else is inserted.
+ *
+ * Rotating and reversing never move elements: start_ind is how far the list has been
+ * rotated and reversed whether it is read backwards, both applied on top of the order
+ * the elements are stored in. A rotated ring is moved back into list order (start_ind 0)
+ * the next time it is inserted into or popped from, so that both ends stay O(1).
+ *
+ * Copies share their storage (and the strings of their elements) until either is changed.
+ */
 typedef struct {
-    Token *arr;
+    Value *arr;
+    char *chars;
     size_t size;
     size_t max_size;
+    size_t head;
+    // How many lists share arr (or chars), or NULL if only this one has it
+    size_t *refs;
+    RopeNode *rope;
+
     size_t start_ind;
+    bool reversed;
+    // Pool the strings of the elements come from (NULL for malloc)
+    StrPool *pool;
 } List;
 
-List create_list(Token *arr, size_t size);
-int linsert(List *l, size_t ind, Token el);
+List create_list(Value *arr, size_t size);
+int linsert(List *l, size_t ind, Value el);
 int lremove(List *l, size_t start);
-int lget(List l, size_t ind, Token *dest);
+int lpop(List *l, size_t ind, Value *dest);
+int lget(List l, size_t ind, Value *dest);
+int lappend_chars(List *l, const char *s, size_t len);
+int lget_chars(List l, char *dest);
 
 void lrotate(List *l, long long amount);
 void lreverse(List *l);
-List lcopy(const List l);
+List lcopy(List *l);
+int lmove(List *src, List *dest, size_t n);
 
 void lfree(List l);
+void lrelease(List l);
+void lclear(List *l);
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,371 @@
+#include "optimise.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+
+/**
+ * The optimised program so far. Each instruction is added to the end, then the end is
+ * rewritten for as long as some rule matches it, so rewrites can enable further ones.
+ */
+typedef struct {
+    Program *p;
+    Instruction *code;
+    SourcePos *positions;
+    size_t size;
+    // Instructions before this can be jumped past, so are never combined with later ones
+    size_t start;
+    int level;
+} Window;
+
+/**
+ * @brief Gets the last n instructions, if they can be combined
+ */
+static const Instruction *tail(const Window *w, size_t n){
+    return w->size - w->start >= n ? &w->code[w->size - n] : NULL;
+}
+
+/**
+ * @brief Gets the literal an instruction pushes onto the current list, if it is a push
+ */
+static const Value *pushed(const Window *w, const Instruction *ins){
+    return ins->op == OP_PUSH ? &w->p->literals[ins->arg] : NULL;
+}
+
+// The operator of a maths emoticon, if a value is a valid one
+static char maths_op(const Value *op){
+    if (!op || op->type != VAL_STR){
+        return '\0';
+    }
+    const char *s = val_str(op);
+    return s[0] && !s[1] ? s[0] : '\0';
+}
+
+/**
+ * @brief Replaces the last n instructions with one
+ *
+ * @param pos Where the new instruction came from: where an error in it would have been
+ */
+static void replace(Window *w, size_t n, Instruction ins, SourcePos pos){
+    w->size -= n;
+    w->code[w->size] = ins;
+    w->positions[w->size++] = pos;
+}
+
+/**
+ * @brief Replaces the last n instructions with pushing a literal or its operands onto a list
+ */
+static void replace_literal(Window *w, size_t n, Opcode op, unsigned int list, Value v){
+    const SourcePos pos = w->positions[w->size - 1];
+    replace(w, n, (Instruction){ .op = op, .list = list, .arg = add_literal(w->p, v) }, pos);
+}
+
+/* Peephole */
+
+/**
+ * @brief a b op :} and a b op :/ with constant operands become pushing the result onto :
+ */
+static bool fold_constants(Window *w){
+    const Instruction *ins = tail(w, 4);
+    if (!ins || (ins[3].op != OP_MATHS_RIGHT && ins[3].op != OP_COMPARE_RIGHT)){
+        return false;
+    }
+
+    const Value *a = pushed(w, &ins[0]);
+    const Value *b = pushed(w, &ins[1]);
+    const Value *op = pushed(w, &ins[2]);
+    if (!a || !b || !op){
+        return false;
+    }
+
+    Value res;
+    if (ins[3].op == OP_MATHS_RIGHT){
+        // Leave anything that is an error (or concatenates) until it runs
+        if (!is_number(*a) || !is_number(*b) || val_maths(maths_op(op), *a, *b, &res) != MATHS_OK){
+            return false;
+        }
+    } else if (val_compare(*op, *a, *b, &res)){
+        return false;
+    }
+
+    replace_literal(w, 4, OP_PUSH_FACE, ins[3].list, res);
+    return true;
+}
+
+/**
+ * @brief n :@ with a constant n becomes rotating by n, and rotates of the same list are
+ * merged (dropping them if they cancel out)
+ */
+static bool merge_rotates(Window *w){
+    const Instruction *ins = tail(w, 2);
+    if (!ins){
+        return false;
+    }
+
+    const Value *n = pushed(w, &ins[0]);
+    if (n && n->type == VAL_INT && ins[1].op == OP_ROTATE){
+        replace_literal(w, 2, OP_ROTATE_BY, ins[1].list, *n);
+        return true;
+    }
+
+    if (ins[0].op != OP_ROTATE_BY || ins[1].op != OP_ROTATE_BY || ins[0].list != ins[1].list){
+        return false;
+    }
+
+    const long long sum = (long long) w->p->literals[ins[0].arg].i + w->p->literals[ins[1].arg].i;
+    if (sum < INT_MIN || sum > INT_MAX){
+        return false;
+    }
+    if (sum == 0){
+        w->size -= 2;
+    } else {
+        replace_literal(w, 2, OP_ROTATE_BY, ins[0].list, int_val((int) sum));
+    }
+    return true;
+}
+
+/**
+ * @brief Drops rotating by 0, and reversing a list twice
+ */
+static bool drop_noops(Window *w){
+    const Instruction *ins = tail(w, 1);
+    if (ins && ins->op == OP_ROTATE_BY && w->p->literals[ins->arg].i == 0){
+        w->size--;
+        return true;
+    }
+
+    ins = tail(w, 2);
+    if (ins && ins[0].op == OP_REVERSE && ins[1].op == OP_REVERSE && ins[0].list == ins[1].list){
+        w->size -= 2;
+        return true;
+    }
+    return false;
+}
+
+/* Superinstructions */
+
+/**
+ * @brief b op :} and b op :/ with constant b and op become one instruction taking
+ * only a from the current list
+ */
+static bool fuse_constant_operand(Window *w){
+    const Instruction *ins = tail(w, 3);
+    if (!ins || (ins[2].op != OP_MATHS_RIGHT && ins[2].op != OP_COMPARE_RIGHT)){
+        return false;
+    }
+
+    const Value *b = pushed(w, &ins[0]);
+    const Value *op = pushed(w, &ins[1]);
+    if (!b || !op){
+        return false;
+    }
+
+    // The operands are read as a pair of literals
+    unsigned int arg = ins[0].arg;
+    if (ins[1].arg != arg + 1){
+        const Value second = *op;
+        arg = add_literal(w->p, *b);
+        add_literal(w->p, second);
+    }
+
+    const Opcode fused = ins[2].op == OP_MATHS_RIGHT ? OP_MATHS_CONST_RIGHT : OP_COMPARE_CONST_RIGHT;
+    replace(w, 3, (Instruction){ .op = fused, .list = ins[2].list, .arg = arg }, w->positions[w->size - 1]);
+    return true;
+}
+
+/**
+ * @brief Runs of moves to or from the same list become one instruction. Errors in a run
+ * are reported at its first move.
+ */
+static bool fuse_moves(Window *w){
+    const Instruction *ins = tail(w, 2);
+    if (!ins || ins[0].list != ins[1].list){
+        return false;
+    }
+
+    Opcode fused;
+    if (ins[1].op == OP_MOVE_LEFT && (ins[0].op == OP_MOVE_LEFT || ins[0].op == OP_MOVE_LEFT_N)){
+        fused = OP_MOVE_LEFT_N;
+    } else if (ins[1].op == OP_MOVE_RIGHT && (ins[0].op == OP_MOVE_RIGHT || ins[0].op == OP_MOVE_RIGHT_N)){
+        fused = OP_MOVE_RIGHT_N;
+    } else {
+        return false;
+    }
+
+    const unsigned int count = ins[0].op == fused ? ins[0].arg + 1 : 2;
+    replace(w, 2, (Instruction){ .op = fused, .list = ins[0].list, .arg = count }, w->positions[w->size - 2]);
+    return true;
+}
+
+/* Loops */
+
+/**
+ * @brief Whether an instruction is :} with the literal operands 1 - (or -1 +, 1 +, -1 -):
+ * when repeated, these take an int to 0 (wrapping around if need be)
+ */
+static bool is_step(const Program *p, const Instruction *ins, bool down_only){
+    if (ins->op != OP_MATHS_CONST_RIGHT){
+        return false;
+    }
+
+    const Value b = p->literals[ins->arg];
+    const char o = maths_op(&p->literals[ins->arg + 1]);
+    if (b.type != VAL_INT || (b.i != 1 && b.i != -1) || (o != '+' && o != '-')){
+        return false;
+    }
+    return !down_only || (b.i == 1) == (o == '-');
+}
+
+/**
+ * @brief Gets the guard for a loop, if it is one of the idioms below
+ * @details All of them run their loop on the list :, and can only be replaced if the
+ * current list is : (or is not, for draining), which the guard checks when it runs.
+ *  - : ( 1 - :} : ) counts : down to 0
+ *  - : ( n ;@ 1 - :} : ) rotates ; n times the count
+ *  - : ( :< : ) moves the true elements at the top of : to the current list
+ *
+ * @param open The index of the ( of the loop
+ * @return The guard, or an instruction with op OP_HALT if the loop is not an idiom
+ */
+static Instruction loop_guard(const Program *p, size_t open){
+    const Instruction *ins = &p->code[open];
+    const size_t body = ins->arg - 1 - (open + 1);
+    const unsigned int list = ins->list;
+
+    if (body == 1 && ins[1].list == list && is_step(p, &ins[1], false)){
+        return (Instruction){ .op = OP_LOOP_COUNT_DOWN, .list = list };
+    }
+
+    if (body == 1 && ins[1].op == OP_MOVE_LEFT && ins[1].list == list){
+        return (Instruction){ .op = OP_LOOP_DRAIN, .list = list };
+    }
+
+    if (body == 2){
+        for (unsigned int r = 1; r <= 2; r++){
+            const Instruction *rotate = &ins[r];
+            const Instruction *step = &ins[3 - r];
+            if (rotate->op == OP_ROTATE_BY && rotate->list != list && step->list == list
+                    && is_step(p, step, true)){
+                // arg is where the rotate is in the loop
+                return (Instruction){ .op = OP_LOOP_ROTATE, .list = list, .arg = r };
+            }
+        }
+    }
+
+    return (Instruction){ .op = OP_HALT };
+}
+
+/**
+ * @brief Puts a guard in front of every loop that is an idiom. When its checks pass, the
+ * guard does what the loop would have done in one step, then jumps past it. Otherwise the
+ * loop runs as normal.
+ */
+static void recognise_loops(Program *p){
+    size_t count = 0;
+    for (size_t pc = 0; pc < p->size; pc++){
+        if (p->code[pc].op == OP_OPEN_BLOCK && loop_guard(p, pc).op != OP_HALT){
+            count++;
+        }
+    }
+    if (!count){
+        return;
+    }
+
+    const size_t size = p->size + count;
+    Instruction *code = (Instruction *)malloc(size * sizeof(Instruction));
+    SourcePos *positions = (SourcePos *)malloc(size * sizeof(SourcePos));
+    if (!code || !positions){
+        ERROR("Failed to allocate memory to optimise a program of %zu instructions", size);
+    }
+
+    size_t out = 0;
+    for (size_t pc = 0; pc < p->size; pc++){
+        if (p->code[pc].op == OP_OPEN_BLOCK){
+            const Instruction guard = loop_guard(p, pc);
+            if (guard.op != OP_HALT){
+                code[out] = guard;
+                positions[out++] = p->positions[pc];
+            }
+        }
+        code[out] = p->code[pc];
+        positions[out++] = p->positions[pc];
+    }
+
+    free(p->code);
+    free(p->positions);
+    p->code = code;
+    p->positions = positions;
+    p->size = size;
+    p->max_size = size;
+    link_blocks(p);
+}
+
+/* Optimising */
+
+static bool rewrite(Window *w){
+    if (fold_constants(w) || merge_rotates(w) || drop_noops(w)){
+        return true;
+    }
+    return w->level >= OPT_FUSE && (fuse_constant_operand(w) || fuse_moves(w));
+}
+
+/**
+ * @brief Rewrites a compiled program into a faster one with the same behaviour.
+ * @details Instructions are only combined if nothing jumps between them, and the result
+ * is relinked, so blocks keep working. Loops are recognised last, once their bodies are
+ * in their simplest form.
+ *
+ * @param p The program, as returned by compile
+ * @param level How much to optimise, from OPT_NONE to OPT_MAX
+ */
+void optimise(Program *p, int level){
+    if (level <= OPT_NONE || !p->size){
+        return;
+    }
+
+    bool *targets = (bool *)calloc(p->size, sizeof(bool));
+    Window w = {
+        .p = p,
+        .code = (Instruction *)malloc(p->size * sizeof(Instruction)),
+        .positions = (SourcePos *)malloc(p->size * sizeof(SourcePos)),
+        .level = level
+    };
+    if (!targets || !w.code || !w.positions){
+        ERROR("Failed to allocate memory to optimise a program of %zu instructions", p->size);
+    }
+
+    for (size_t pc = 0; pc < p->size; pc++){
+        const unsigned char op = p->code[pc].op;
+        if (op == OP_OPEN_BLOCK || op == OP_CLOSE_BLOCK || op == OP_DIVIDE_BLOCK
+                || op == OP_BREAK || op == OP_BREAK_AND_POP){
+            targets[p->code[pc].arg] = true;
+        }
+    }
+
+    for (size_t pc = 0; pc < p->size; pc++){
+        if (targets[pc]){
+            w.start = w.size;
+        }
+        w.code[w.size] = p->code[pc];
+        w.positions[w.size++] = p->positions[pc];
+        while (rewrite(&w)){}
+        // A rewrite may have removed the target itself
+        if (w.start > w.size){
+            w.start = w.size;
+        }
+    }
+
+    free(targets);
+    free(p->code);
+    free(p->positions);
+    p->code = w.code;
+    p->positions = w.positions;
+    p->size = w.size;
+    p->max_size = p->size;
+    link_blocks(p);
+
+    if (level >= OPT_LOOPS){
+        recognise_loops(p);
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef __OPTIMISE_H__
+#define __OPTIMISE_H__
+
+#include "compile.h"
+
+// Runs the program as compiled
+#define OPT_NONE 0
+// Folds constant maths and comparisons, merges rotates and drops no-ops
+#define OPT_PEEPHOLE 1
+// Also fuses common sequences into superinstructions
+#define OPT_FUSE 2
+// Also replaces loops that count down, rotate a list or drain a list with single steps
+#define OPT_LOOPS 3
+#define OPT_MAX OPT_LOOPS
+
+void optimise(Program *p, int level);
+
+#endif
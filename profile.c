@@ -0,0 +1,195 @@
+#include "profile.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void profile_init(Profile *pr, const Program *p){
+    *pr = (Profile){
+        .counts = (uint64_t *)calloc(p->size ? p->size : 1, sizeof(uint64_t)),
+        .times = (uint64_t *)calloc(p->size ? p->size : 1, sizeof(uint64_t)),
+        .size = p->size
+    };
+    if (!pr->counts || !pr->times){
+        ERROR("Failed to allocate memory to profile %zu instructions", p->size);
+    }
+}
+
+void profile_free(Profile *pr){
+    free(pr->counts);
+    free(pr->times);
+    *pr = (Profile){ 0 };
+}
+
+/* Report */
+
+// A row of a report table: everything that ran from one instruction, line or opcode
+typedef struct {
+    // The first instruction of the row
+    size_t index;
+    uint64_t count;
+    uint64_t time;
+} ProfileRow;
+
+static int by_time(const void *a, const void *b){
+    const ProfileRow *x = (const ProfileRow *) a;
+    const ProfileRow *y = (const ProfileRow *) b;
+    if (x->time != y->time){
+        return x->time < y->time ? 1 : -1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static double percent(uint64_t time, uint64_t total){
+    return total ? 100.0 * (double) time / (double) total : 0;
+}
+
+/**
+ * @brief Sorts rows hottest first and prints those that ran, up to PROFILE_REPORT_ROWS
+ *
+ * @param by What a row is (for its heading)
+ * @param print_row Prints the start of a row (what it is)
+ */
+static void print_table(FILE *f, const char *by, const char *heading, ProfileRow *rows, size_t size,
+                        uint64_t total, const Program *p, void (*print_row)(FILE *f, const Program *p, const ProfileRow *r)){
+    qsort(rows, size, sizeof(ProfileRow), by_time);
+    size_t ran = 0;
+    while (ran < size && rows[ran].count){
+        ran++;
+    }
+
+    fprintf(f, "\nBy %s, hottest first:\n%s %14s %16s %7s\n", by, heading, "count", "time", "%");
+    for (size_t i = 0; i < ran && i < PROFILE_REPORT_ROWS; i++){
+        print_row(f, p, &rows[i]);
+        fprintf(f, " %14llu %16llu %6.2f%%\n", (unsigned long long) rows[i].count,
+                (unsigned long long) rows[i].time, percent(rows[i].time, total));
+    }
+    if (ran > PROFILE_REPORT_ROWS){
+        fprintf(f, "(and %zu more)\n", ran - PROFILE_REPORT_ROWS);
+    }
+}
+
+static void print_instruction(FILE *f, const Program *p, const ProfileRow *r){
+    const SourcePos pos = p->positions[r->index];
+    fprintf(f, "%8u %6u  %-24s", pos.line, pos.column, opcode_names[p->code[r->index].op]);
+}
+
+static void print_line(FILE *f, const Program *p, const ProfileRow *r){
+    fprintf(f, "%8u", p->positions[r->index].line);
+}
+
+static void print_opcode(FILE *f, const Program *p, const ProfileRow *r){
+    fprintf(f, "%-24s", opcode_names[p->code[r->index].op]);
+}
+
+/**
+ * @brief Prints how long the program spent on each instruction, source line and opcode.
+ * Instructions made by the optimiser are at the position of the first emoticon they
+ * replaced, and include the time of those they were merged with.
+ */
+void profile_report(const Profile *pr, const Program *p, FILE *f){
+    ProfileRow *rows = (ProfileRow *)malloc((pr->size ? pr->size : 1) * sizeof(ProfileRow));
+    if (!rows){
+        ERROR("Failed to allocate memory for a profile report");
+    }
+    uint64_t total = 0;
+    uint64_t total_count = 0;
+    for (size_t i = 0; i < pr->size; i++){
+        total += pr->times[i];
+        total_count += pr->counts[i];
+    }
+    fprintf(f, "\nProfile: %llu instructions run in %llu " PROFILE_TIME_UNIT "\n",
+            (unsigned long long) total_count, (unsigned long long) total);
+
+    for (size_t i = 0; i < pr->size; i++){
+        rows[i] = (ProfileRow){ .index = i, .count = pr->counts[i], .time = pr->times[i] };
+    }
+    print_table(f, "instruction", "    line    col  instruction             ", rows, pr->size, total, p, print_instruction);
+
+    // Instructions are in source order, so each line's are together
+    size_t lines = 0;
+    for (size_t i = 0; i < pr->size; i++){
+        if (!lines || p->positions[i].line != p->positions[rows[lines - 1].index].line){
+            rows[lines++] = (ProfileRow){ .index = i };
+        }
+        rows[lines - 1].count += pr->counts[i];
+        rows[lines - 1].time += pr->times[i];
+    }
+    print_table(f, "line", "    line", rows, lines, total, p, print_line);
+
+    size_t opcodes = 0;
+    size_t first[NUM_OPCODES];
+    for (size_t op = 0; op < NUM_OPCODES; op++){
+        first[op] = SIZE_MAX;
+    }
+    for (size_t i = 0; i < pr->size; i++){
+        const unsigned char op = p->code[i].op;
+        if (first[op] == SIZE_MAX){
+            first[op] = opcodes;
+            rows[opcodes++] = (ProfileRow){ .index = i };
+        }
+        rows[first[op]].count += pr->counts[i];
+        rows[first[op]].time += pr->times[i];
+    }
+    print_table(f, "opcode", "instruction             ", rows, opcodes, total, p, print_opcode);
+    free(rows);
+}
+
+/* Collapsed stacks */
+
+/**
+ * @brief Writes the profile as collapsed stacks, a line for each instruction that ran with
+ * the time it took, which flame graph tools (such as flamegraph.pl) read. An instruction's
+ * stack is the blocks it is in, outermost first, each named by the position of its (.
+ *
+ * @return 0 on success, or 1 if the file could not be written
+ */
+int profile_write_stacks(const Profile *pr, const Program *p, const char *path){
+    FILE *f = fopen(path, "w");
+    if (!f){
+        return 1;
+    }
+
+    // The frames of the blocks the current instruction is in, and where each starts in it
+    size_t stack_max = 256;
+    char *stack = (char *)malloc(stack_max);
+    size_t *opens = (size_t *)malloc((p->size + 1) * sizeof(size_t));
+    if (!stack || !opens){
+        ERROR("Failed to allocate memory for profile stacks");
+    }
+    size_t depth = 0;
+    size_t len = (size_t) sprintf(stack, "main");
+
+    for (size_t i = 0; i < pr->size; i++){
+        const Instruction *ins = &p->code[i];
+        const SourcePos pos = p->positions[i];
+        // A block's ( and ) are in the block
+        if (ins->op == OP_OPEN_BLOCK){
+            if (stack_max - len < 64){
+                stack_max *= 2;
+                char *temp = (char *)realloc(stack, stack_max);
+                if (!temp){
+                    ERROR("Failed to allocate memory for profile stacks");
+                }
+                stack = temp;
+            }
+            opens[depth++] = len;
+            len += (size_t) sprintf(stack + len, ";(@%u:%u", pos.line, pos.column);
+        }
+
+        if (pr->counts[i]){
+            fprintf(f, "%.*s;%s@%u:%u %llu\n", (int) len, stack, opcode_names[ins->op],
+                    pos.line, pos.column, (unsigned long long) pr->times[i]);
+        }
+
+        if (ins->op == OP_CLOSE_BLOCK && depth){
+            len = opens[--depth];
+        }
+    }
+
+    free(stack);
+    free(opens);
+    const bool failed = ferror(f) | fclose(f);
+    return failed;
+}
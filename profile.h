@@ -0,0 +1,47 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "compile.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Instructions are timed in cycles where the CPU has a cycle counter, otherwise in ns
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(EMOTICON_NO_RDTSC)
+#define HAVE_RDTSC
+#include <x86intrin.h>
+#define PROFILE_TIME_UNIT "cycles"
+#else
+#include <time.h>
+#define PROFILE_TIME_UNIT "ns"
+#endif
+
+// Most rows of each table of a profile report
+#define PROFILE_REPORT_ROWS 40
+
+/**
+ * How many times each instruction of a program ran, and how long it took in total (from
+ * when it was fetched to when the next one was), indexed like Program.code.
+ */
+typedef struct {
+    uint64_t *counts;
+    uint64_t *times;
+    size_t size;
+} Profile;
+
+static inline uint64_t profile_clock(void){
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+void profile_init(Profile *pr, const Program *p);
+void profile_report(const Profile *pr, const Program *p, FILE *f);
+int profile_write_stacks(const Profile *pr, const Program *p, const char *path);
+void profile_free(Profile *pr);
+
+#endif
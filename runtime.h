@@ -0,0 +1,92 @@
+#ifndef __RUNTIME_H__
+#define __RUNTIME_H__
+
+#include "compile.h"
+#include "list.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct {
+    // Owned by the program's symbol table
+    char *name;
+    List list;
+} EmoList;
+
+// How much printed text is kept before it is written out
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+/**
+ * Everything a running program has, so that programs can run on any number of threads at
+ * once (the program itself is only read). Compiled code (from the JIT or emoticonc) runs
+ * programs by calling the functions below with it.
+ */
+typedef struct RunState {
+    // Slot of the current list. Must stay first (the JIT sets it directly).
+    size_t current;
+    const Program *program;
+
+    EmoList *lists;
+    size_t lists_size;
+    size_t lists_max_size;
+    // Long strings made at runtime. Short ones are stored inline in their values.
+    StrPool pool;
+
+    // Reused buffer for building strings and reading input
+    char *scratch;
+    size_t scratch_size;
+
+    FILE *input;
+    FILE *output;
+    // Printed text waiting to be written to output, in large chunks
+    char *output_buffer;
+    size_t output_size;
+} RunState;
+
+void runtime_start(RunState *s, const Program *p, FILE *input, FILE *output);
+void runtime_clear(RunState *s);
+void runtime_reset(RunState *s, const Program *p, FILE *input, FILE *output);
+void runtime_stop(RunState *s);
+
+// Instructions that always go on to the next one
+void step_OP_PUSH(RunState *s, const Instruction *ins);
+void step_OP_SET_CURRENT(RunState *s, const Instruction *ins);
+void step_OP_COUNT(RunState *s, const Instruction *ins);
+void step_OP_REVERSE(RunState *s, const Instruction *ins);
+void step_OP_ROTATE(RunState *s, const Instruction *ins);
+void step_OP_MOVE_LEFT(RunState *s, const Instruction *ins);
+void step_OP_MOVE_RIGHT(RunState *s, const Instruction *ins);
+void step_OP_COPY_LEFT(RunState *s, const Instruction *ins);
+void step_OP_COPY_RIGHT(RunState *s, const Instruction *ins);
+void step_OP_ASSIGN(RunState *s, const Instruction *ins);
+void step_OP_INSERT(RunState *s, const Instruction *ins);
+void step_OP_EXPLODE_LEFT(RunState *s, const Instruction *ins);
+void step_OP_EXPLODE_RIGHT(RunState *s, const Instruction *ins);
+void step_OP_IMPLODE_LEFT(RunState *s, const Instruction *ins);
+void step_OP_IMPLODE_RIGHT(RunState *s, const Instruction *ins);
+void step_OP_PRINT(RunState *s, const Instruction *ins);
+void step_OP_PRINT_AND_POP(RunState *s, const Instruction *ins);
+void step_OP_INPUT(RunState *s, const Instruction *ins);
+void step_OP_MATHS_LEFT(RunState *s, const Instruction *ins);
+void step_OP_MATHS_RIGHT(RunState *s, const Instruction *ins);
+void step_OP_COMPARE_LEFT(RunState *s, const Instruction *ins);
+void step_OP_COMPARE_RIGHT(RunState *s, const Instruction *ins);
+void step_OP_PUSH_FACE(RunState *s, const Instruction *ins);
+void step_OP_ROTATE_BY(RunState *s, const Instruction *ins);
+void step_OP_MOVE_LEFT_N(RunState *s, const Instruction *ins);
+void step_OP_MOVE_RIGHT_N(RunState *s, const Instruction *ins);
+void step_OP_MATHS_CONST_RIGHT(RunState *s, const Instruction *ins);
+void step_OP_COMPARE_CONST_RIGHT(RunState *s, const Instruction *ins);
+
+// Whether ( | and 3 leave (or skip) their block
+bool test_truthy(RunState *s, const Instruction *ins);
+// Pops the top of the face list for E, giving whether it leaves its block
+bool test_break_and_pop(RunState *s, const Instruction *ins);
+
+// Whether a loop guard did its whole loop, which should then be skipped
+bool guard_OP_LOOP_COUNT_DOWN(RunState *s, const Instruction *ins);
+bool guard_OP_LOOP_ROTATE(RunState *s, const Instruction *ins);
+bool guard_OP_LOOP_DRAIN(RunState *s, const Instruction *ins);
+
+#endif
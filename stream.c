@@ -0,0 +1,262 @@
+#include "stream.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__STDC_NO_ATOMICS__) && !defined(EMOTICON_NO_THREADS)
+#define HAVE_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#endif
+
+bool stream_available(void){
+#ifdef HAVE_THREADS
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef HAVE_THREADS
+
+/*
+ * head and tail count every lexeme ever put in and taken out, and are each only written by
+ * one side, so neither side takes a lock while the ring is neither full nor empty. A side
+ * that has to wait sets its waiting flag and sleeps on wake, which the other side only
+ * locks to signal if the flag is set.
+ */
+struct StreamRing {
+    CompiledLexeme items[STREAM_RING_SIZE];
+
+    // Apart so that the two threads do not share a cache line
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+
+    atomic_bool producer_waiting;
+    atomic_bool consumer_waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    FILE *code;
+    // Only used by the lexer thread, but kept here so they can be freed if it is cancelled
+    char *line;
+    size_t line_max;
+    // Long strings of compiled lexemes, only allocated from by the lexer thread
+    Arena strings;
+    // Why the lexer thread stopped, before its STREAM_ERROR
+    char error[ERROR_MESSAGE_SIZE];
+    pthread_t thread;
+};
+
+// Put in the ring instead of OP_HALT when the lexer thread has an error
+#define STREAM_ERROR NUM_OPCODES
+
+/* Ring */
+
+static void unlock(void *lock){
+    pthread_mutex_unlock((pthread_mutex_t *) lock);
+}
+
+/**
+ * @brief Sleeps until the other side of the ring has moved index on from seen
+ */
+static void ring_wait(StreamRing *r, atomic_bool *waiting, atomic_size_t *index, size_t seen){
+    pthread_mutex_lock(&r->lock);
+    // The lexer thread can be cancelled while it waits
+    pthread_cleanup_push(unlock, &r->lock);
+    atomic_store(waiting, true);
+    while (atomic_load(index) == seen){
+        pthread_cond_wait(&r->wake, &r->lock);
+    }
+    atomic_store(waiting, false);
+    pthread_cleanup_pop(1);
+}
+
+/**
+ * @brief Wakes the other side of the ring if it is waiting
+ */
+static void ring_wake(StreamRing *r, atomic_bool *waiting){
+    if (atomic_load(waiting)){
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_signal(&r->wake);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+static void ring_put(StreamRing *r, const CompiledLexeme *c){
+    const size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail == STREAM_RING_SIZE){
+        ring_wait(r, &r->producer_waiting, &r->tail, tail);
+    }
+    r->items[head & (STREAM_RING_SIZE - 1)] = *c;
+    atomic_store(&r->head, head + 1);
+    ring_wake(r, &r->consumer_waiting);
+}
+
+/* Lexer thread */
+
+/**
+ * @brief Compiles the code a line at a time (so that a line can run as soon as it has been
+ * written to a pipe), ending with OP_HALT, or STREAM_ERROR if it has an error
+ */
+static void *lex_thread(void *arg){
+    StreamRing *r = (StreamRing *) arg;
+    // Errors are passed on, to be reported by the interpreter's thread
+    ErrorTrap trap;
+    error_trap = &trap;
+    if (setjmp(trap.env)){
+        memcpy(r->error, trap.message, sizeof(r->error));
+        ring_put(r, &(CompiledLexeme){ .ins = { .op = STREAM_ERROR } });
+        return NULL;
+    }
+
+    ssize_t len;
+    bool obfuscated = false;
+    SourcePos end = { 0 };
+
+    // Lexemes never span lines, as newlines are whitespace
+    while ((len = getline(&r->line, &r->line_max, r->code)) >= 0){
+        Source src = string_source(r->line, (size_t) len);
+        src.line = end.line;
+        while (true) {
+            skip_ws(&src);
+            const Lexeme lx = get_lexme(&src);
+            if (!lx.length) {
+                break;
+            }
+
+            CompiledLexeme c;
+            if (compile_lexeme(r->line + lx.offset, lx, &obfuscated, &r->strings, &c)) {
+                ring_put(r, &c);
+            }
+        }
+        end = (SourcePos){ .line = src.line, .column = src.column };
+    }
+
+    if (ferror(r->code)){
+        ERROR("Could not read the code file");
+    }
+
+    ring_put(r, &(CompiledLexeme){ .ins = { .op = OP_HALT }, .pos = end });
+    return NULL;
+}
+
+/* Stream */
+
+/**
+ * @brief Starts compiling a code file on a lexer thread
+ *
+ * @return 0 on success, or 1 if the thread could not be started
+ */
+int stream_start(Stream *st, FILE *code){
+    *st = (Stream){ 0 };
+    intern(&st->program.symbols, ":", 1);
+
+    StreamRing *r = (StreamRing *)calloc(1, sizeof(StreamRing));
+    if (!r){
+        ERROR("Failed to allocate memory for a stream");
+    }
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->producer_waiting, false);
+    atomic_init(&r->consumer_waiting, false);
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake, NULL);
+    r->code = code;
+
+    if (pthread_create(&r->thread, NULL, lex_thread, r)){
+        pthread_mutex_destroy(&r->lock);
+        pthread_cond_destroy(&r->wake);
+        free(r);
+        return 1;
+    }
+    st->ring = r;
+    return 0;
+}
+
+/**
+ * @brief Adds every lexeme the lexer thread has compiled so far to the program, linking
+ * blocks as it goes
+ *
+ * @param wait Whether to wait for a lexeme if there are none yet
+ * @return How many instructions were added (0 once the program has ended with OP_HALT)
+ */
+size_t stream_take(Stream *st, bool wait){
+    StreamRing *r = st->ring;
+    Program *p = &st->program;
+    if (p->size && p->code[p->size - 1].op == OP_HALT){
+        return 0;
+    }
+
+    const size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (head == tail){
+        if (!wait){
+            return 0;
+        }
+        ring_wait(r, &r->consumer_waiting, &r->head, tail);
+        head = atomic_load_explicit(&r->head, memory_order_acquire);
+    }
+
+    for (size_t i = tail; i != head; i++){
+        const CompiledLexeme *c = &r->items[i & (STREAM_RING_SIZE - 1)];
+        if (c->ins.op == STREAM_ERROR){
+            fail("%s", r->error);
+        }
+        append_lexeme(p, c);
+        link_last(p, &st->blocks);
+    }
+
+    atomic_store(&r->tail, head);
+    ring_wake(r, &r->producer_waiting);
+    return head - tail;
+}
+
+/**
+ * @brief Stops the lexer thread (which has finished unless the program did not run to its
+ * end), and frees the stream and its program
+ */
+void stream_stop(Stream *st){
+    StreamRing *r = st->ring;
+    const Program *p = &st->program;
+    if (!p->size || p->code[p->size - 1].op != OP_HALT){
+        pthread_cancel(r->thread);
+    }
+    pthread_join(r->thread, NULL);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->wake);
+
+    // The literals' long strings are in the lexer thread's arena
+    arena_free(&st->program.strings);
+    st->program.strings = r->strings;
+    free_program(st->program);
+    TFREE(st->blocks.opens);
+    free(r->line);
+    free(r);
+    *st = (Stream){ 0 };
+}
+
+#else
+
+int stream_start(Stream *st, FILE *code){
+    (void) code;
+    *st = (Stream){ 0 };
+    return 1;
+}
+
+size_t stream_take(Stream *st, bool wait){
+    (void) st;
+    (void) wait;
+    return 0;
+}
+
+void stream_stop(Stream *st){
+    *st = (Stream){ 0 };
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include "compile.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// How many compiled lexemes the lexer thread can get ahead of the interpreter by
+#define STREAM_RING_SIZE 1024
+
+typedef struct StreamRing StreamRing;
+
+/**
+ * A program that is run while it is still being read. A lexer thread reads the code a line
+ * at a time and compiles its lexemes into a single producer, single consumer ring, which the
+ * interpreter takes them from to add to program as it needs them.
+ *
+ * Jumps out of blocks that are not closed yet are UNLINKED (see link_last). Nothing is
+ * optimised, as the optimiser needs the whole program.
+ */
+typedef struct {
+    Program program;
+    OpenBlocks blocks;
+    StreamRing *ring;
+} Stream;
+
+bool stream_available(void);
+int stream_start(Stream *st, FILE *code);
+size_t stream_take(Stream *st, bool wait);
+void stream_stop(Stream *st);
+
+#endif
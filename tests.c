@@ -1,13 +1,19 @@
 #include "error.h"
 #include "lex.h"
 #include "list.h"
+#include "interpret.h"
+#include "compile.h"
+#include "optimise.h"
+#include "cache.h"
+#include "trace.h"
+#include "emoticon.h"
 
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
-#include <vadefs.h>
+#include <limits.h>
 
 #define assert_fpos(line,col) {\
     if (lineno != line || columnno != col) {\
@@ -40,23 +46,370 @@ void _list_test(size_t line, size_t size, List l, ...){
     va_list args;
     va_start(args, l);
     
-    Token t = {0};
+    Value v = { 0 };
     for (size_t i = 0; i < l.size; i++){
-        if (lget(l, i, &t)){
+        if (lget(l, i, &v)){
             fprintf(stderr, "On Line %zu: ", line);
             ERROR("List out of bounds at %zu for list of size %zu", i, l.size);
         }
 
         int exp = va_arg(args, int);
-        if (t.value.i != exp){
+        if (v.i != exp){
             fprintf(stderr, "On Line %zu: ", line);
-            ERROR("List element %zu should be %d, but found %d", i, exp, t.value.i);
+            ERROR("List element %zu should be %d, but found %d", i, exp, v.i);
         }
     }
 
     va_end(args);
 }
 
+/**
+ * @brief Does random inserts, pops, rotations and reversals on a list and an array, checking
+ * that the list matches the array
+ *
+ * @param preload How many elements to start with
+ * @param max_size How many elements the list can grow to
+ * @param ops How many operations to do
+ * @param check_every How many operations to do between comparing every element
+ */
+void list_model_test(size_t preload, size_t max_size, int ops, int check_every){
+    int *model = (int *)malloc(max_size * sizeof(int));
+    int *rotated = (int *)malloc(max_size * sizeof(int));
+    int *snapshot_model = (int *)malloc(max_size * sizeof(int));
+    size_t model_size = 0;
+    size_t snapshot_size = 0;
+    List snapshot = { 0 };
+    List l = create_list(NULL, 0);
+    srand(2);
+
+    for (size_t i = 0; i < preload; i++){
+        model[model_size++] = (int) i;
+        assert(!linsert(&l, l.size, int_val((int) i)));
+    }
+
+    for (int op = 0; op < ops; op++){
+        // Copies share storage, so changing the list afterwards must not change the copy
+        if (op == ops / 2){
+            snapshot = lcopy(&l);
+            snapshot_size = model_size;
+            memcpy(snapshot_model, model, model_size * sizeof(int));
+        }
+
+        const int r = rand() % 9;
+        if (r < 4 && model_size < max_size){
+            const size_t ind = r == 0 ? 0 : r == 1 ? model_size : (size_t) rand() % (model_size + 1);
+            memmove(model + ind + 1, model + ind, (model_size - ind) * sizeof(int));
+            model[ind] = op;
+            model_size++;
+            assert(!linsert(&l, ind, int_val(op)));
+        } else if (r < 7 && model_size){
+            const size_t ind = r == 4 ? 0 : r == 5 ? model_size - 1 : (size_t) rand() % model_size;
+            Value v;
+            assert(!lpop(&l, ind, &v) && v.i == model[ind]);
+            memmove(model + ind, model + ind + 1, (model_size - ind - 1) * sizeof(int));
+            model_size--;
+        } else if (r == 7 && model_size){
+            const int amount = rand() % 7 - 3;
+            const size_t k = (size_t) ((amount % (int) model_size + (int) model_size) % (int) model_size);
+            for (size_t i = 0; i < model_size; i++){
+                rotated[i] = model[(i + k) % model_size];
+            }
+            memcpy(model, rotated, model_size * sizeof(int));
+            lrotate(&l, amount);
+        } else if (r == 8){
+            for (size_t i = 0; i < model_size / 2; i++){
+                const int temp = model[i];
+                model[i] = model[model_size - 1 - i];
+                model[model_size - 1 - i] = temp;
+            }
+            lreverse(&l);
+        }
+
+        assert(l.size == model_size && (l.max_size & (l.max_size - 1)) == 0);
+        if (op % check_every == 0){
+            for (size_t i = 0; i < model_size; i++){
+                Value v;
+                assert(!lget(l, i, &v) && v.i == model[i]);
+            }
+        }
+    }
+
+    assert(snapshot.size == snapshot_size);
+    for (size_t i = 0; i < snapshot_size; i++){
+        Value v;
+        assert(!lget(snapshot, i, &v) && v.i == snapshot_model[i]);
+    }
+    lfree(snapshot);
+
+    List copy = lcopy(&l);
+    for (size_t i = 0; i < model_size; i++){
+        Value v;
+        assert(!lget(copy, i, &v) && v.i == model[i]);
+    }
+
+    // Draining a rope turns it back into a ring
+    for (size_t i = 0; i < model_size; i++){
+        Value v;
+        assert(!lpop(&copy, 0, &v) && v.i == model[i]);
+    }
+    assert(copy.size == 0 && !copy.rope);
+    for (size_t i = 0; i < model_size; i++){
+        Value v;
+        assert(!lget(l, i, &v) && v.i == model[i]);
+    }
+
+    lfree(copy);
+    lfree(l);
+    free(model);
+    free(rotated);
+    free(snapshot_model);
+}
+
+#define program_test(code, input, expected) _program_test(__LINE__, code, input, expected);
+
+void _program_test(size_t line, const char *code, const char *input, const char *expected){
+    // Every program should behave the same however much it is optimised, and compiled, and
+    // when it is run as it is read
+    for (int run = 0; run <= (OPT_MAX + 1) * 2; run++){
+        const bool stream = run == (OPT_MAX + 1) * 2;
+        const int level = stream ? OPT_NONE : run / 2;
+        const bool jit = !stream && run % 2;
+        FILE *codef = tmpfile();
+        FILE *in = tmpfile();
+        FILE *out = tmpfile();
+        assert(codef && in && out);
+
+        fputs(code, codef);
+        rewind(codef);
+        fputs(input, in);
+        rewind(in);
+
+        const int res = interpret((InterpeterOptions){
+            .input = in,
+            .output = out,
+            .code = codef,
+            .opt_level = level,
+            .jit = jit,
+            .stream = stream
+        });
+
+        rewind(out);
+        char buf[1000] = { 0 };
+        size_t len = fread(buf, sizeof(char), sizeof(buf) - 1, out);
+        buf[len] = '\0';
+        if (res || strcmp(buf, expected)){
+            fprintf(stderr, "On Line %zu (opt level %d%s): ", line, level,
+                    jit ? ", jit" : stream ? ", stream" : "");
+            ERROR("Program '%s' should output\n%s\nbut actually output\n%s", code, expected, buf);
+        }
+
+        fclose(codef);
+        fclose(in);
+        fclose(out);
+    }
+}
+
+/**
+ * @brief Runs a library program on an instance, checking its status and output
+ */
+void emo_test(EmoInstance *e, const EmoProgram *p, const char *input, EmoStatus status, const char *expected){
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+    assert(in && out);
+    fputs(input, in);
+    rewind(in);
+
+    const EmoStatus res = emo_run(e, p, in, out);
+    rewind(out);
+    char buf[1000] = { 0 };
+    size_t len = fread(buf, sizeof(char), sizeof(buf) - 1, out);
+    buf[len] = '\0';
+    if (res != status || strcmp(buf, expected)){
+        ERROR("Library program should return %d after outputting\n%s\nbut returned %d after outputting\n%s\n(%s)",
+              status, expected, res, buf, emo_error(e));
+    }
+    fclose(in);
+    fclose(out);
+}
+
+#define error_test(code, expected) _error_test(__LINE__, code, expected);
+
+/**
+ * @brief Runs a program that has an error, checking that interpret returns rather than
+ * exiting, and that what was printed before the error is still output
+ */
+void _error_test(size_t line, const char *code, const char *expected){
+    for (int stream = 0; stream <= 1; stream++){
+        FILE *codef = tmpfile();
+        FILE *out = tmpfile();
+        assert(codef && out);
+        fputs(code, codef);
+        rewind(codef);
+
+        const int res = interpret((InterpeterOptions){
+            .input = stdin,
+            .output = out,
+            .code = codef,
+            .opt_level = OPT_MAX,
+            .stream = stream
+        });
+
+        rewind(out);
+        char buf[1000] = { 0 };
+        size_t len = fread(buf, sizeof(char), sizeof(buf) - 1, out);
+        buf[len] = '\0';
+        if (res != 1 || strcmp(buf, expected)){
+            ERROR("On Line %zu%s: Program '%s' should fail after outputting\n%s\nbut returned %d after outputting\n%s",
+                  line, stream ? " (stream)" : "", code, expected, res, buf);
+        }
+
+        fclose(codef);
+        fclose(out);
+    }
+}
+
+/**
+ * @brief Compiles and optimises a program, checking the opcodes it ends up with
+ */
+void optimise_test(const char *code, int level, size_t size, ...){
+    FILE *codef = tmpfile();
+    assert(codef);
+    fputs(code, codef);
+    rewind(codef);
+
+    Program p = compile(codef);
+    optimise(&p, level);
+    assert(p.size == size);
+
+    va_list ops;
+    va_start(ops, size);
+    for (size_t i = 0; i < size; i++){
+        assert(p.code[i].op == va_arg(ops, int));
+    }
+    va_end(ops);
+
+    free_program(p);
+    fclose(codef);
+}
+
+#define cache_test(code, cached, expected) _cache_test(__LINE__, code, cached, expected);
+
+/**
+ * @brief Runs a program from a file through its cache, checking whether it was already
+ * cached and what it outputs
+ */
+void _cache_test(size_t line, const char *code, bool cached, const char *expected){
+    const char *path = "cache_test.emo";
+    char *emoc = cache_path(path);
+    assert(!strcmp(emoc, "cache_test.emoc"));
+
+    FILE *codef = fopen(path, "w");
+    assert(codef);
+    fputs(code, codef);
+    fclose(codef);
+    codef = fopen(path, "r");
+    FILE *out = tmpfile();
+    assert(codef && out);
+
+    Source src;
+    CachedProgram c;
+    assert(!open_source(&src, codef));
+    const bool was_cached = !cache_load(emoc, &src, OPT_MAX, &c);
+    if (was_cached){
+        cache_free(&c);
+    }
+    close_source(&src);
+    rewind(codef);
+
+    interpret((InterpeterOptions){
+        .input = stdin,
+        .output = out,
+        .code = codef,
+        .opt_level = OPT_MAX,
+        .cache = emoc
+    });
+
+    rewind(out);
+    char buf[1000] = { 0 };
+    size_t len = fread(buf, sizeof(char), sizeof(buf) - 1, out);
+    buf[len] = '\0';
+    if (was_cached != cached || strcmp(buf, expected)){
+        ERROR("On Line %zu: Program '%s' should %sbe cached and output\n%s\nbut %s cached and output\n%s",
+              line, code, cached ? "" : "not ", expected, was_cached ? "was" : "was not", buf);
+    }
+
+    fclose(codef);
+    fclose(out);
+    free(emoc);
+}
+
+/**
+ * @brief Lexes a lexeme the way the lexer did before it had a table-driven classifier:
+ * trying each kind of token in turn, with strtol and strtod for numbers
+ */
+Token reference_token(const char *s){
+    const size_t len = strlen(s);
+    Token t = { .type = STR };
+    for (int i = 0; len == 3 && i < (int) sizeof(OBFUSCATED_CHARS) - 1; i++){
+        if (!memcmp(s, OBFUSCATED_EMO[i], 3)){
+            t.type = OBFUS;
+            t.value.inline_str[0] = OBFUSCATED_CHARS[i];
+            return t;
+        }
+    }
+    if (!strcmp(s, "^_^") || !strcmp(s, "^__^")){
+        t.type = EMOTICON;
+        t.value.emoticon.op = len == 3 ? OBFUSCATION_ON : OBFUSCATION_OFF;
+        return t;
+    }
+    if (len >= 2 && mouth_optype_table[(unsigned char) s[len - 1]]){
+        t.type = EMOTICON;
+        t.value.emoticon.op = (Op_Type) s[len - 1];
+        t.value.emoticon.nose = len > 2 ? s[len - 2] : '\0';
+        return t;
+    }
+    char *end = NULL;
+    const long ival = strtol(s, &end, 10);
+    if (end == s + len){
+        t.type = INT;
+        t.value.i = (int) ival;
+        return t;
+    }
+    const double dval = strtod(s, &end);
+    if (end == s + len){
+        t.type = DOUBLE;
+        t.value.d = dval;
+    }
+    return t;
+}
+
+/**
+ * @brief Checks that lexing a lexeme gives the same token as reference_token
+ */
+void classify_test(const char *s){
+    Token t = lex_token(s, 0, 0);
+    const Token r = reference_token(s);
+    bool same = t.type == r.type;
+    if (same && t.type == OBFUS){
+        same = tkn_str(&t)[0] == r.value.inline_str[0];
+    } else if (same && t.type == EMOTICON){
+        same = t.value.emoticon.op == r.value.emoticon.op &&
+               (t.value.emoticon.op == OBFUSCATION_ON || t.value.emoticon.op == OBFUSCATION_OFF ||
+                t.value.emoticon.nose == r.value.emoticon.nose);
+    } else if (same && t.type == INT){
+        same = t.value.i == r.value.i;
+    } else if (same && t.type == DOUBLE){
+        // Bit for bit, so that nan and -0.0 compare too
+        same = !memcmp(&t.value.d, &r.value.d, sizeof(double));
+    } else if (same && t.type == STR){
+        same = !strcmp(tkn_str(&t), s);
+    }
+    if (!same){
+        ERROR("Lexeme '%s' should lex as\n%s\nbut lexed as\n%s", s, format_token(r), format_token(t));
+    }
+    free_tkn(t);
+}
+
 int main(void){
 
     printf("HI\n");
@@ -69,24 +422,79 @@ int main(void){
 
     ////////// Tokenizing /////////
     FILE *codefile = fopen("test.txt", "r");
+    Source src;
+    assert(!open_source(&src, codefile));
     unsigned int lineno = 0;
     unsigned int columnno = 0;
 
-    skip_ws(codefile, &lineno, &columnno);
+#define sync_fpos() {lineno = src.line; columnno = src.column;}
+
+    skip_ws(&src);
+    sync_fpos();
     assert_fpos(0, 0);
-    char *c = get_lexme(codefile, &columnno);
-    assert(strcmp(c, "abc") == 0);
+    Lexeme lx = get_lexme(&src);
+    sync_fpos();
+    assert(lx.length == 3 && strncmp(src.buf + lx.offset, "abc", 3) == 0);
     assert_fpos(0, 3);
-    free(c);
-    c = NULL;
-    skip_ws(codefile, &lineno, &columnno);
+    skip_ws(&src);
+    sync_fpos();
     assert_fpos(1, 0);
-    c = get_lexme(codefile, &columnno);
-    assert(strcmp(c, "def") == 0);
+    lx = get_lexme(&src);
+    sync_fpos();
+    assert(lx.length == 3 && strncmp(src.buf + lx.offset, "def", 3) == 0);
     assert_fpos(1, 3);
+    skip_ws(&src);
+    sync_fpos();
+    assert_fpos(3, 0);
+    lx = get_lexme(&src);
+    assert(lx.length == 1 && lx.line == 3 && lx.column == 0);
+    skip_ws(&src);
+    assert(get_lexme(&src).length == 0);
 
+    close_source(&src);
     fclose(codefile);
 
+    const char *ws = " \t ab\f\v\r\n  \ncd  ";
+    src = string_source(ws, strlen(ws));
+    skip_ws(&src);
+    lx = get_lexme(&src);
+    assert(lx.offset == 3 && lx.length == 2 && lx.line == 0 && lx.column == 3);
+    skip_ws(&src);
+    lx = get_lexme(&src);
+    assert(lx.offset == 12 && lx.length == 2 && lx.line == 2 && lx.column == 0);
+    skip_ws(&src);
+    assert(get_lexme(&src).length == 0 && src.line == 2 && src.column == 4);
+
+    // Every scanning level splits a source into the same lexemes at the same positions
+    const char alphabet[] = "    \t\t\n\n\r\v\fab:)^\x80\xff";
+    const size_t gen_size = 100000;
+    char *gen = (char *)malloc(gen_size);
+    srand(1);
+    for (size_t i = 0; i < gen_size; i++){
+        gen[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+    }
+
+    Lexeme *expected_lx = (Lexeme *)calloc(gen_size + 1, sizeof(Lexeme));
+    for (ScanLevel level = SCAN_SCALAR; level <= best_scan_level(); level++){
+        src = string_source(gen, gen_size);
+        assert(set_scan_level(&src, level) == level);
+        size_t n = 0;
+        do {
+            skip_ws(&src);
+            lx = get_lexme(&src);
+            if (level == SCAN_SCALAR){
+                expected_lx[n] = lx;
+            } else if (memcmp(&expected_lx[n], &lx, sizeof(Lexeme))){
+                ERROR("Scan level %d lexed lexeme %zu at (line %u, col %u, offset %zu), expected (line %u, col %u, offset %zu)",
+                      level, n, lx.line, lx.column, lx.offset,
+                      expected_lx[n].line, expected_lx[n].column, expected_lx[n].offset);
+            }
+            n++;
+        } while (lx.length);
+    }
+    free(expected_lx);
+    free(gen);
+
     ///////// Lexing //////////
     token_test(":)`", (Token){
         .line = 0,
@@ -213,18 +621,84 @@ int main(void){
         .value.d = -1.1
     });
 
+    // The classifier lexes everything as trying each kind of token in turn did: every
+    // lexeme of up to 4 characters from those that matter, then some that are longer
+    const char classify_chars[] = "0159+-.eExXinN :8B)(`~^_P";
+    const size_t classify_size = sizeof(classify_chars) - 1;
+    char lexeme[5];
+    for (size_t len = 0; len <= 4; len++){
+        size_t combinations = 1;
+        for (size_t i = 0; i < len; i++){
+            combinations *= classify_size;
+        }
+        for (size_t n = 0; n < combinations; n++){
+            size_t rest = n;
+            for (size_t i = 0; i < len; i++){
+                lexeme[i] = classify_chars[rest % classify_size];
+                rest /= classify_size;
+            }
+            lexeme[len] = '\0';
+            classify_test(lexeme);
+        }
+    }
+    const char *classify_lexemes[] = {
+        "inf", "-Infinity", "nan", "NaN(123)", "0x1A", "-0x1p3", " 12", "\t-5.5", "1e308", "1e400",
+        "999999999", "-999999999", "1000000000", "2147483647", "-2147483648", "000000000012",
+        "+000000001", "1.5e+10", "-.5", "+.5e-3", "12.5.5", "1e5e5", "--1", "+-1", "1-", "0.000001",
+        "123456789012345678901234567890.5", "a_string_too_long_to_be_inline", ":)`", "B(~", "B(`"
+    };
+    for (size_t i = 0; i < sizeof(classify_lexemes) / sizeof(classify_lexemes[0]); i++){
+        classify_test(classify_lexemes[i]);
+    }
+
+    // Short strings are inline, long ones are not, and both compare by value
+    Token short_tkn = lex_token("short", 0, 0);
+    Token long_tkn = lex_token("a_string_too_long_to_be_inline", 0, 0);
+    Token long_eyes = lex_token("::::::::::-O", 0, 0);
+    assert(short_tkn.storage == TKN_INLINE && long_tkn.storage == TKN_HEAP);
+    assert(long_eyes.storage == TKN_HEAP && !strcmp(tkn_eyes(&long_eyes), "::::::::::"));
+    assert(token_eq(short_tkn, (Token){ .type = STR, .value.str = "short" }));
+    Token long_copy = copy_tkn(long_tkn);
+    assert(long_copy.value.str != long_tkn.value.str && token_eq(long_copy, long_tkn));
+    free_tkn(short_tkn);
+    free_tkn(long_tkn);
+    free_tkn(long_copy);
+    free_tkn(long_eyes);
+
+    /// Values ///
+
+    char text[VALUE_TEXT_SIZE];
+    Value short_val = str_val(NULL, "thirteen char", 13);
+    Value long_val = str_val(NULL, "fourteen chars", 14);
+    assert(short_val.storage == TKN_INLINE && long_val.storage == TKN_HEAP);
+    assert(!strcmp(val_str(&short_val), "thirteen char") && !strcmp(val_str(&long_val), "fourteen chars"));
+    Value long_val_copy = copy_val(NULL, long_val);
+    assert(long_val_copy.str != long_val.str && val_eq(long_val_copy, long_val));
+    assert(!val_eq(int_val(1), double_val(1)) && val_eq(char_val('x'), str_val(NULL, "x", 1)));
+    Value num_val = int_val(-3);
+    assert(!strcmp(val_text(&num_val, text), "-3"));
+    num_val = double_val(1.5);
+    assert(!strcmp(val_text(&num_val, text), "1.500000"));
+    num_val = int_val(INT_MIN);
+    assert(val_write(&num_val, text, sizeof(text)) == 11 && !strcmp(text, "-2147483648"));
+    assert(val_write(&long_val, text, 5) == 14);
+    free_val(NULL, long_val);
+    free_val(NULL, long_val_copy);
+
     /// List ///
 
     List l = create_list(NULL, 1);
 
     // Insert
-    assert(!linsert(&l, 0, lex_token("0", 0, 0)));
-    assert(!linsert(&l, 0, lex_token("1", 0, 0)));
-    assert(!linsert(&l, 2, lex_token("2", 0, 0)));
-    assert(!linsert(&l, 1, lex_token("3", 0, 0)));
+    assert(!linsert(&l, 0, int_val(0)));
+    assert(!linsert(&l, 0, int_val(1)));
+    assert(!linsert(&l, 2, int_val(2)));
+    assert(!linsert(&l, 1, int_val(3)));
 
     for (size_t i = 0; i < l.size; i++){
-        printf("%s\n", format_token(l.arr[i]));
+        Value v;
+        lget(l, i, &v);
+        printf("%s\n", val2str(v));
     }
 
     list_test(4, l, 1, 3, 0, 2);
@@ -238,12 +712,12 @@ int main(void){
     // Insert when rotated
     lrotate(&l, 2);
     list_test(4, l, 0, 2, 1, 3);
-    assert(!linsert(&l, 0, lex_token("4", 0, 0)));
-    assert(!linsert(&l, 5, lex_token("5", 0, 0)));
+    assert(!linsert(&l, 0, int_val(4)));
+    assert(!linsert(&l, 5, int_val(5)));
     list_test(6, l, 4, 0, 2, 1, 3, 5);
 
     // Remove
-    lrotate(&l, -2);
+    lrotate(&l, -4);
     assert(!lremove(&l, 5));
     list_test(5, l, 2, 1, 3, 5, 4);
     assert(!lremove(&l, 0));
@@ -252,9 +726,9 @@ int main(void){
     list_test(3, l, 1, 3, 4);
 
     // Remove when rotated
-    assert(!linsert(&l, 0, lex_token("7", 0, 0)));
-    assert(!linsert(&l, 0, lex_token("8", 0, 0)));
-    assert(!linsert(&l, 0, lex_token("9", 0, 0)));
+    assert(!linsert(&l, 0, int_val(7)));
+    assert(!linsert(&l, 0, int_val(8)));
+    assert(!linsert(&l, 0, int_val(9)));
     lrotate(&l, 3);
     list_test(6, l, 1, 3, 4, 9, 8, 7);
 
@@ -269,12 +743,388 @@ int main(void){
     list_test(4, l, 8, 9, 4, 3);
     lreverse(&l);
     list_test(4, l, 3, 4, 9, 8);
-    assert(!linsert(&l, 0, lex_token("10", 0, 0)));
+    assert(!linsert(&l, 0, int_val(10)));
     list_test(5, l, 10, 3, 4, 9, 8);
     lreverse(&l);
     list_test(5, l, 8, 9, 4, 3, 10);
 
     lfree(l);
 
-    return 0;
-}
\ No newline at end of file
+    // A rotated ring that is not full is moved back into list order by the next insert, and
+    // after that inserting at either end only writes the new element's slot
+    l = create_list(NULL, 16);
+    for (int i = 0; i < 8; i++){
+        assert(!linsert(&l, l.size, int_val(i)));
+    }
+    lrotate(&l, 3);
+    assert(!linsert(&l, l.size, int_val(8)) && !l.start_ind);
+    list_test(9, l, 3, 4, 5, 6, 7, 0, 1, 2, 8);
+    Value stored[16];
+    memcpy(stored, l.arr, sizeof(stored));
+    assert(!linsert(&l, l.size, int_val(9)));
+    assert(!linsert(&l, 0, int_val(10)));
+    size_t written = 0;
+    for (size_t i = 0; i < 16; i++){
+        written += stored[i].type != l.arr[i].type || stored[i].i != l.arr[i].i;
+    }
+    assert(written == 2);
+    list_test(11, l, 10, 3, 4, 5, 6, 7, 0, 1, 2, 8, 9);
+    // As does popping, reversed or not
+    lrotate(&l, -4);
+    lreverse(&l);
+    Value popped;
+    assert(!lpop(&l, 0, &popped) && popped.i == 0 && !l.start_ind);
+    list_test(10, l, 7, 6, 5, 4, 3, 10, 9, 8, 2, 1);
+    memcpy(stored, l.arr, sizeof(stored));
+    assert(!lpop(&l, 9, &popped) && popped.i == 1);
+    assert(!lpop(&l, 0, &popped) && popped.i == 7);
+    assert(!memcmp(stored, l.arr, sizeof(stored)));
+    list_test(8, l, 6, 5, 4, 3, 10, 9, 8, 2);
+    lfree(l);
+
+    // Random operations against an array, small and past the size lists become ropes at
+    list_model_test(0, 512, 20000, 1);
+    list_model_test(LIST_ROPE_SIZE + 1000, LIST_ROPE_SIZE * 2, 100000, 5000);
+
+    // Characters appended to an empty list are packed until something else is inserted
+    l = create_list(NULL, 0);
+    char chars[64];
+    assert(!lappend_chars(&l, "hello", 5) && l.chars && l.size == 5);
+    assert(!lappend_chars(&l, " world", 6) && l.chars && l.size == 11);
+    assert(!lget_chars(l, chars) && !memcmp(chars, "hello world", 11));
+    lreverse(&l);
+    lrotate(&l, 2);
+    assert(!lget_chars(l, chars) && !memcmp(chars, "row ollehdl", 11));
+    Value v;
+    assert(!lget(l, 0, &v) && val_eq(v, char_val('r')));
+    List packed_copy = lcopy(&l);
+    assert(!linsert(&l, 0, str_val(NULL, "x", 1)) && l.chars);
+    assert(!linsert(&l, 1, int_val(12)) && !l.chars && l.size == 13);
+    assert(!lget(l, 1, &v) && v.type == VAL_INT && v.i == 12);
+    assert(!lget(l, 12, &v) && !strcmp(val_str(&v), "l"));
+    assert(!lget_chars(packed_copy, chars) && !memcmp(chars, "row ollehdl", 11));
+    lfree(packed_copy);
+    lfree(l);
+    // Failing to allocate the packed storage leaves the list as it was
+    l = create_list(NULL, 4);
+    assert(lappend_chars(&l, "x", SIZE_MAX / 4) == 2);
+    assert(l.arr && !l.chars && l.max_size == 4 && !l.size);
+    assert(!linsert(&l, 0, int_val(1)));
+    list_test(1, l, 1);
+    lfree(l);
+
+    /// Arena ///
+
+    Arena arena = { 0 };
+    char *a1 = arena_strndup(&arena, "hello", 5);
+    char *a2 = (char *)arena_alloc(&arena, 100000);
+    char *a3 = arena_strndup(&arena, "world", 3);
+    memset(a2, 'x', 100000);
+    assert(!strcmp(a1, "hello") && !strcmp(a3, "wor"));
+    assert((size_t) a2 % 16 == 0 && a3 == a1 + 16);
+    arena_free(&arena);
+
+    StrPool sp = { 0 };
+    char *p1 = pool_strndup(&sp, "abc", 3);
+    pool_free(&sp, p1);
+    char *p2 = pool_strndup(&sp, "xyz", 3);
+    assert(p1 == p2 && !strcmp(p2, "xyz"));
+    char *p3 = pool_alloc(&sp, 5000);
+    memset(p3, 'y', 4999);
+    p3[4999] = '\0';
+    pool_free(&sp, p3);
+    // Strings are freed to the class they were allocated from, however they are changed
+    char *p4 = pool_strndup(&sp, "a string that is in the fifty-six byte class", 44);
+    p4[1] = '\0';
+    pool_free(&sp, p4);
+    assert(pool_strndup(&sp, "another string in the fifty-six byte class", 42) == p4);
+    // Large strings still in use are freed with the pool
+    pool_alloc(&sp, 5000);
+    pool_alloc(&sp, 6000);
+    pool_reset(&sp);
+    pool_alloc(&sp, 7000);
+    pool_destroy(&sp);
+
+    /// Symbols ///
+
+    SymbolTable syms = { 0 };
+    assert(intern(&syms, ":", 1) == 0);
+    assert(intern(&syms, ";", 1) == 1);
+    assert(intern(&syms, ":", 1) == 0);
+    char name[16];
+    for (unsigned int i = 0; i < 1000; i++){
+        sprintf(name, "%u", i);
+        assert(intern(&syms, name, strlen(name)) == i + 2);
+    }
+    for (unsigned int i = 0; i < 1000; i++){
+        sprintf(name, "%u", i);
+        assert(intern(&syms, name, strlen(name)) == i + 2);
+    }
+    assert(intern(&syms, ";", 1) == 1);
+    free_symbols(syms);
+
+    /// Optimiser ///
+
+    optimise_test("3 4 + ;} ;P", OPT_NONE, 6, OP_PUSH, OP_PUSH, OP_PUSH, OP_MATHS_RIGHT, OP_PRINT, OP_HALT);
+    optimise_test("3 4 + ;} ;P", OPT_PEEPHOLE, 3, OP_PUSH_FACE, OP_PRINT, OP_HALT);
+    optimise_test("3 0 / ;} 1 2 x ;/", OPT_PEEPHOLE, 9, OP_PUSH, OP_PUSH, OP_PUSH, OP_MATHS_RIGHT,
+            OP_PUSH, OP_PUSH, OP_PUSH, OP_COMPARE_RIGHT, OP_HALT);
+    optimise_test("5 ;@ 3 ;@ -8 ;@ ;X ;X :P", OPT_PEEPHOLE, 2, OP_PRINT, OP_HALT);
+    optimise_test("1 ;> ;> ;> ;< 1 - ;}", OPT_PEEPHOLE, 9, OP_PUSH, OP_MOVE_RIGHT, OP_MOVE_RIGHT,
+            OP_MOVE_RIGHT, OP_MOVE_LEFT, OP_PUSH, OP_PUSH, OP_MATHS_RIGHT, OP_HALT);
+    optimise_test("1 ;> ;> ;> ;< 1 - ;}", OPT_FUSE, 5, OP_PUSH, OP_MOVE_RIGHT_N, OP_MOVE_LEFT,
+            OP_MATHS_CONST_RIGHT, OP_HALT);
+    optimise_test("1 :( ;X :) ;X 2 :@ :( 1 :@ :)", OPT_MAX, 10, OP_PUSH, OP_OPEN_BLOCK, OP_REVERSE,
+            OP_CLOSE_BLOCK, OP_REVERSE, OP_ROTATE_BY, OP_OPEN_BLOCK, OP_ROTATE_BY, OP_CLOSE_BLOCK, OP_HALT);
+    optimise_test("5 :( 1 - :} :)", OPT_LOOPS, 6, OP_PUSH, OP_LOOP_COUNT_DOWN, OP_OPEN_BLOCK,
+            OP_MATHS_CONST_RIGHT, OP_CLOSE_BLOCK, OP_HALT);
+    optimise_test("5 :( 1 ;@ 1 - :} :) ;( ;< ;)", OPT_LOOPS, 11, OP_PUSH, OP_LOOP_ROTATE, OP_OPEN_BLOCK,
+            OP_ROTATE_BY, OP_MATHS_CONST_RIGHT, OP_CLOSE_BLOCK, OP_LOOP_DRAIN, OP_OPEN_BLOCK, OP_MOVE_LEFT,
+            OP_CLOSE_BLOCK, OP_HALT);
+
+    /// Interpreter ///
+
+    program_test("Hello :P", "", "Hello\n");
+    program_test("3 4 + :} :P", "", "7\n");
+    program_test("7 2 % :} :Q 1.5 2 * :} :Q 2 3 < :/ :Q", "", "1\n3.000000\n1\n");
+    program_test("3 :( :P 1 - :} :)", "", "3\n2\n1\n");
+    program_test("abc ;O :7 ;C ;Q ;# ;Q", "", "3\nabc\n");
+    program_test("^_^ :)` 8)` ^__^ :)` :# :Q", "", "AB:)`\n");
+    program_test("1 2 3 :O 1 ::@ :Q :Q :Q", "", "1\n3\n2\n");
+    program_test("a b ;] :X :Q ;Q", "", "a\nb\n");
+    program_test("x 0 ;V 1 ;> ;Q ;Q :C :Q", "", "1\nx\n0\n");
+    program_test(":* :* + :} :Q", "2\n3.5\n", "5.500000\n");
+    program_test("1 :( 2 :P :3 :) 9 :P", "", "2\n9\n");
+    program_test("2 :( ;O 2 ;( ;P 1 - ;} ;) :O 1 - :} :)", "", "2\n1\n2\n1\n");
+    program_test("1 :( 5 :P 0 :| 6 :P :) 9 :P", "", "5\n9\n");
+    program_test("3 4 + ;} 2 1 >= ;/ ;Q ;Q 2.5 2 - :} :Q", "", "1\n7\n0.500000\n");
+    program_test("1 2 3 :O 5 ::@ 1 ::@ ;X ;X :X :X :Q :Q :Q", "", "3\n2\n1\n");
+    program_test("1 2 3 ;> ;> ;> 4 ;< ;< :Q :Q :Q ;C :Q", "", "2\n1\n4\n1\n");
+    program_test(";O 3 ;( ;P 1 - ;} ;)", "", "3\n2\n1\n");
+    program_test("5 :( 1 - :} :) :P 0 3 - :} :( 1 + :} :) :P 2.0 :( 1 - :} :) :P", "", "0\n0\n0.000000\n");
+    program_test(";O 5 :O 3 2 1 ;( 1 - ;} ;) ;Q ;Q :C :Q", "", "0\n5\n2\n");
+    program_test("a b c d ;O 3 ;( 1 :@ 1 - ;} ;) :Q :Q :Q :Q ;P", "", "c\nb\na\nd\n0\n");
+    program_test("x 0 a b c ;O :( :< :) ;Q ;Q ;Q :C ;Q", "", "a\nb\nc\n2\n");
+    program_test("a b c ;O :( :< :) ;Q :C ;Q", "", "a\n0\n");
+    program_test(";O 20 ;( ;P 1 - ;} ;)", "",
+            "20\n19\n18\n17\n16\n15\n14\n13\n12\n11\n10\n9\n8\n7\n6\n5\n4\n3\n2\n1\n");
+    program_test(":O 20 :( 1 - :} :P ;O 3 ;( 1 - ;} ;) :O :)", "",
+            "19\n18\n17\n16\n15\n14\n13\n12\n11\n10\n9\n8\n7\n6\n5\n4\n3\n2\n1\n0\n");
+    program_test("30 :( 1 - :} :P 8] 8O 20 = 8/ :O 8E :) 9 :P", "",
+            "29\n28\n27\n26\n25\n24\n23\n22\n21\n20\n9\n");
+    program_test("a_string_too_long_to_be_inline ;O :7 ;C ;Q ;# ;Q", "", "30\na_string_too_long_to_be_inline\n");
+    program_test("abcdefghijklmnopqrstuvwxyz ;O :7 ;X :O 1 ;@ ;Q ;# :Q", "", "z\nyxwvutsrqponmlkjihgfedcba\n");
+    program_test("a_long_string_to_copy another_long_string ;] :Q ;Q ;Q :Q", "",
+            "another_long_string\nanother_long_string\na_long_string_to_copy\na_long_string_to_copy\n");
+    // Loops hot enough for the JIT, on lists its native templates handle themselves...
+    program_test("8O a b c :O 30 :( 8< 8< 8> 8> 1 - :} :) 8# :Q", "", "abc\n");
+    program_test(";O 1 2 3 ;X :O 30 :( x y ;> ;> ;C 20 > 8/ 1 - :} :) ;# :Q 8# :Q", "",
+            "321yxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyxyx\n000000001111111111111111111111\n");
+    program_test("8O 9# a_string_too_long_to_be_inline b c d e f g h i j k l m n o p q r s t u v w x y z "
+                 "8( 8Q 8) 8C 8Q", "",
+            "z\ny\nx\nw\nv\nu\nt\ns\nr\nq\np\no\nn\nm\nl\nk\nj\ni\nh\ng\nf\ne\nd\nc\nb\n"
+            "a_string_too_long_to_be_inline\n1\n");
+    program_test("-20.5 :( 0.5 + :} :) :P 20 :( 8O -0.0 8( x :P 83 8) 8Q 0.5 8( y 83 8) 8Q 8Q :O 1 - :} :)", "",
+            "0.000000\n-0.000000\ny\n0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n"
+            "0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n"
+            "0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n"
+            "0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n"
+            "0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n0.500000\n-0.000000\ny\n"
+            "0.500000\n");
+    program_test(";O 1 2 3 4 ;X :O 20 :( 7 ;@ 8O ;[ 8# 8Q :O 1 - :} :)", "",
+            "1432\n2143\n3214\n4321\n1432\n2143\n3214\n4321\n1432\n2143\n"
+            "3214\n4321\n1432\n2143\n3214\n4321\n1432\n2143\n3214\n4321\n");
+    program_test(";O 1 2 3 4 5 ;X :O 20 :( 7 ;@ 8O ;[ 8# 8Q :O 1 - :} :)", "",
+            "32154\n15432\n43215\n21543\n54321\n32154\n15432\n43215\n21543\n54321\n"
+            "32154\n15432\n43215\n21543\n54321\n32154\n15432\n43215\n21543\n54321\n");
+    // ...and on packed, shared and rope lists, which they leave to the steps
+    program_test("abcdefgh 8O :7 :O 30 :( 8( 83 8) 8< 8< 8> 8> x 8> 1 - :} :) 8# :Q", "",
+            "abcdefghxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\n");
+    program_test("8O a b c :O 8[ 30 :( 8< 8> 1 ;@ 1 - :} :) 8# :Q :# :Q", "", "abc\nabc0\n");
+    program_test("20000 :( x ;> 1 ;@ 1 - :} :) ;C :P 19990 :( ;< 8> ;( ;3 ;) 1 - :} :) ;C :P 8C :P ;# :Q", "",
+            "20000\n10\n19990\nxxxxxxxxxx\n");
+
+    /// Program cache ///
+
+    remove("cache_test.emoc");
+    const char *code = "a_string_too_long_to_be_inline :P "
+                       "long_list_name-O 5 long_list_name-( long_list_name-P 1 - long_list_name-} long_list_name-)";
+    cache_test(code, false, "a_string_too_long_to_be_inline\n5\n4\n3\n2\n1\n");
+    cache_test(code, true, "a_string_too_long_to_be_inline\n5\n4\n3\n2\n1\n");
+    // Changing the code makes the cache stale
+    code = "a_string_too_long_to_be_inline :P "
+           "long_list_name-O 2 long_list_name-( long_list_name-P 1 - long_list_name-} long_list_name-)";
+    cache_test(code, false, "a_string_too_long_to_be_inline\n2\n1\n");
+    // As does it being from another version
+    FILE *emoc = fopen("cache_test.emoc", "r+b");
+    assert(emoc && !fseek(emoc, 4, SEEK_SET));
+    fputc(EMOC_VERSION + 1, emoc);
+    fclose(emoc);
+    cache_test(code, false, "a_string_too_long_to_be_inline\n2\n1\n");
+    // As does an instruction jumping out of the program
+    cache_test(code, true, "a_string_too_long_to_be_inline\n2\n1\n");
+    FILE *cached_code = fopen("cache_test.emo", "r");
+    Source cached_src;
+    CachedProgram c;
+    assert(cached_code && !open_source(&cached_src, cached_code) && !cache_load("cache_test.emoc", &cached_src, OPT_MAX, &c));
+    size_t close = 0;
+    while (c.program.code[close].op != OP_CLOSE_BLOCK){
+        close++;
+    }
+    const long arg_at = (long) ((const char *) &c.program.code[close].arg - (const char *) c.map);
+    cache_free(&c);
+    close_source(&cached_src);
+    fclose(cached_code);
+    emoc = fopen("cache_test.emoc", "r+b");
+    const unsigned int bad_jump = 1000000;
+    assert(emoc && !fseek(emoc, arg_at, SEEK_SET) && fwrite(&bad_jump, sizeof(bad_jump), 1, emoc) == 1);
+    fclose(emoc);
+    cache_test(code, false, "a_string_too_long_to_be_inline\n2\n1\n");
+    remove("cache_test.emo");
+    remove("cache_test.emoc");
+
+    /// Profile ///
+
+    FILE *codef = tmpfile();
+    FILE *out = tmpfile();
+    assert(codef && out);
+    fputs("3 :( :P 1 - :} :)", codef);
+    rewind(codef);
+    assert(!interpret((InterpeterOptions){
+        .input = stdin,
+        .output = out,
+        .code = codef,
+        .opt_level = OPT_NONE,
+        .profile = true,
+        .profile_stacks = "profile_test.txt"
+    }));
+    rewind(out);
+    char buf[1000] = { 0 };
+    assert(fread(buf, sizeof(char), sizeof(buf) - 1, out) && !strcmp(buf, "3\n2\n1\n"));
+    fclose(codef);
+    fclose(out);
+
+    // Every instruction that ran has a stack, in the blocks it is in
+    FILE *stacks = fopen("profile_test.txt", "r");
+    assert(stacks);
+    const char *frames[] = {
+        "main;OP_PUSH@0:0 ", "main;(@0:2;OP_OPEN_BLOCK@0:2 ", "main;(@0:2;OP_PRINT@0:5 ",
+        "main;(@0:2;OP_PUSH@0:8 ", "main;(@0:2;OP_PUSH@0:10 ", "main;(@0:2;OP_MATHS_RIGHT@0:12 ",
+        "main;(@0:2;OP_CLOSE_BLOCK@0:15 ", "main;OP_HALT@0:17 "
+    };
+    for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++){
+        assert(fgets(buf, sizeof(buf), stacks) && !strncmp(buf, frames[i], strlen(frames[i])));
+    }
+    assert(!fgets(buf, sizeof(buf), stacks));
+    fclose(stacks);
+    remove("profile_test.txt");
+
+    /// Trace ///
+
+    codef = tmpfile();
+    out = tmpfile();
+    assert(codef && out);
+    fputs("3 :( :P 1 - :} :)", codef);
+    rewind(codef);
+    assert(!interpret((InterpeterOptions){
+        .input = stdin,
+        .output = out,
+        .code = codef,
+        .opt_level = OPT_NONE,
+        .trace = "trace_test.trace"
+    }));
+    fclose(codef);
+    fclose(out);
+
+    FILE *tracef = fopen("trace_test.trace", "rb");
+    assert(tracef);
+    TraceHeader header;
+    assert(fread(&header, sizeof(header), 1, tracef) == 1 && !memcmp(header.magic, TRACE_MAGIC, 4));
+    assert(header.code_size == 8 && header.symbols_size == 1 && header.names_size == 2);
+    TraceInstruction traced[8];
+    assert(fread(traced, sizeof(TraceInstruction), 8, tracef) == 8);
+    assert(traced[2].op == OP_PRINT && traced[2].line == 0 && traced[2].column == 5);
+    assert(fgetc(tracef) == ':' && fgetc(tracef) == '\0');
+    // 3 is pushed, then the loop runs three times (popping 3 2 1 to 0) and is left
+    TraceRecord records[32];
+    assert(fread(records, sizeof(TraceRecord), 32, tracef) == 21);
+    assert(records[0].index == 0 && records[0].list == 0 && records[0].size == 1);
+    assert(records[1].index == 1 && records[1].size == 1);
+    assert(records[19].index == 1 && records[19].size == 1);
+    assert(records[20].index == 7);
+    fclose(tracef);
+    remove("trace_test.trace");
+
+    /// Errors ///
+
+    fprintf(stderr, "Expecting errors:\n");
+    error_test(":) a :P", "");
+    error_test("a :P 1 :( :P ;P :)", "a\n1\n");
+    error_test("1 0 / :}", "");
+    // Failing to compile frees everything compiling made (which ASan checks)
+    error_test(":( :( :) 1 :P", "");
+
+    /// Shared programs ///
+
+    codef = tmpfile();
+    assert(codef);
+    fputs(":* :* + :} :P", codef);
+    rewind(codef);
+    Program shared;
+    assert(!interpret_compile(codef, OPT_MAX, &shared, NULL));
+    fclose(codef);
+    // The same compiled program, run on different inputs
+    for (int i = 0; i < 3; i++){
+        FILE *in = tmpfile();
+        FILE *out = tmpfile();
+        assert(in && out);
+        fprintf(in, "%d\n%d\n", i, i * 10);
+        rewind(in);
+        assert(!interpret_program(&shared, in, out, i % 2));
+
+        rewind(out);
+        char buf[100] = { 0 };
+        char expected[100];
+        snprintf(expected, sizeof(expected), "%d\n", i * 11);
+        assert(fread(buf, sizeof(char), sizeof(buf) - 1, out) && !strcmp(buf, expected));
+        fclose(in);
+        fclose(out);
+    }
+    free_program(shared);
+
+    /// Library ///
+
+    EmoInstance *e = emo_new(false);
+    assert(e);
+    EmoProgram *count, *named, *failing;
+    const char *count_code = ":* :C :P";
+    assert(emo_compile(e, count_code, strlen(count_code), EMO_OPT_MAX, &count) == EMO_OK);
+    const char *named_code = "ab ;O 1 2 3 ;C :Q ;Q";
+    assert(emo_compile(e, named_code, strlen(named_code), EMO_OPT_NONE, &named) == EMO_OK);
+    const char *failing_code = "1 :( ;P :)";
+    assert(emo_compile(e, failing_code, strlen(failing_code), EMO_OPT_MAX, &failing) == EMO_OK);
+    EmoProgram *bad = NULL;
+    assert(emo_compile(e, "a :)", 4, EMO_OPT_MAX, &bad) == EMO_COMPILE_ERROR && !bad);
+    assert(strstr(emo_error(e), "Block is never opened"));
+    // Failing to compile frees everything compiling made (which ASan checks)
+    assert(emo_compile(e, ":( :( :) 1 :P", 13, EMO_OPT_MAX, &bad) == EMO_COMPILE_ERROR && !bad);
+    assert(strstr(emo_error(e), "Block is never closed"));
+
+    // Every run starts from empty lists, whatever ran before
+    emo_test(e, count, "x\n", EMO_OK, "1\n");
+    emo_test(e, count, "y\n", EMO_OK, "1\n");
+    emo_test(e, named, "", EMO_OK, "ab\n3\n");
+    emo_test(e, count, "z\n", EMO_OK, "1\n");
+    emo_test(e, failing, "", EMO_RUNTIME_ERROR, "");
+    assert(strstr(emo_error(e), "Cannot print from empty list ';'"));
+    emo_test(e, named, "", EMO_OK, "ab\n3\n");
+    assert(!emo_error(e)[0]);
+    emo_reset(e);
+    emo_free_program(named);
+    emo_reset(e);
+    emo_test(e, count, "x\n", EMO_OK, "1\n");
+
+    emo_free_program(count);
+    emo_free_program(failing);
+    emo_free(e);
+}
@@ -0,0 +1,72 @@
+#include "trace.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Opens a trace file, writing out the program's instructions and list names so
+ * that the trace can be decoded without it
+ *
+ * @return 0 on success, or 1 if the file could not be opened
+ */
+int trace_start(Trace *t, const char *path, const Program *p){
+    *t = (Trace){ .file = fopen(path, "wb") };
+    if (!t->file){
+        return 1;
+    }
+    t->records = (TraceRecord *)malloc(TRACE_BUFFER_RECORDS * sizeof(TraceRecord));
+    if (!t->records){
+        fclose(t->file);
+        t->file = NULL;
+        ERROR("Failed to allocate a trace buffer of %d records", TRACE_BUFFER_RECORDS);
+    }
+
+    TraceHeader h = {
+        .version = TRACE_VERSION,
+        .code_size = p->size,
+        .symbols_size = p->symbols.size
+    };
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    for (size_t i = 0; i < p->symbols.size; i++){
+        h.names_size += strlen(p->symbols.names[i]) + 1;
+    }
+    t->failed |= fwrite(&h, sizeof(h), 1, t->file) != 1;
+
+    for (size_t i = 0; i < p->size; i++){
+        const TraceInstruction ins = {
+            .op = p->code[i].op,
+            .line = p->positions[i].line,
+            .column = p->positions[i].column
+        };
+        t->failed |= fwrite(&ins, sizeof(ins), 1, t->file) != 1;
+    }
+    for (size_t i = 0; i < p->symbols.size; i++){
+        t->failed |= fputs(p->symbols.names[i], t->file) == EOF || fputc('\0', t->file) == EOF;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes out the records kept so far
+ */
+void trace_flush(Trace *t){
+    if (t->size && fwrite(t->records, sizeof(TraceRecord), t->size, t->file) != t->size){
+        t->failed = true;
+    }
+    t->size = 0;
+}
+
+/**
+ * @brief Writes out the rest of a trace and closes it
+ *
+ * @return 0, or 1 if any of it could not be written
+ */
+int trace_stop(Trace *t){
+    trace_flush(t);
+    t->failed |= fclose(t->file) != 0;
+    const int res = t->failed;
+    free(t->records);
+    *t = (Trace){ 0 };
+    return res;
+}
@@ -0,0 +1,72 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "compile.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Bump whenever the trace file format changes
+#define TRACE_VERSION 1
+#define TRACE_MAGIC "EMOT"
+
+// How many records are kept before they are written out, in one write
+#define TRACE_BUFFER_RECORDS (64 * 1024)
+
+/*
+ * A trace file is a TraceHeader, then a TraceInstruction for each instruction of the
+ * program, then the program's list names (NUL terminated, in slot order), then a
+ * TraceRecord for each instruction run, until the end of the file. It is only read on the
+ * machine that wrote it, so everything is in its native layout.
+ */
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t code_size;
+    uint64_t symbols_size;
+    // Bytes of list names
+    uint64_t names_size;
+} TraceHeader;
+
+typedef struct {
+    uint32_t op;
+    uint32_t line;
+    uint32_t column;
+} TraceInstruction;
+
+// An instruction that ran: its index in the program, and the current list after it
+typedef struct {
+    uint32_t index;
+    uint32_t list;
+    uint32_t size;
+} TraceRecord;
+
+/**
+ * A trace being written. Each run has its own, so threads never share one.
+ */
+typedef struct {
+    FILE *file;
+    TraceRecord *records;
+    size_t size;
+    // Whether a write has failed, so the trace is incomplete
+    bool failed;
+} Trace;
+
+int trace_start(Trace *t, const char *path, const Program *p);
+void trace_flush(Trace *t);
+int trace_stop(Trace *t);
+
+static inline void trace_record(Trace *t, size_t index, size_t list, size_t size){
+    t->records[t->size++] = (TraceRecord){
+        .index = (uint32_t) index,
+        .list = (uint32_t) list,
+        .size = (uint32_t) size
+    };
+    if (t->size == TRACE_BUFFER_RECORDS){
+        trace_flush(t);
+    }
+}
+
+#endif
@@ -0,0 +1,246 @@
+#include "value.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/**
+ * @brief Makes a string value, storing the string inline if it fits
+ * 
+ * @param pool The pool to allocate a long string from (or NULL for malloc)
+ * @param s The string (need not be NUL terminated)
+ * @param len The length of the string
+ */
+Value str_val(StrPool *pool, const char *s, size_t len){
+    Value v = { .type = VAL_STR };
+
+    if (len < VALUE_INLINE_SIZE) {
+        v.storage = TKN_INLINE;
+        memcpy(v.inline_str, s, len);
+        v.inline_str[len] = '\0';
+    } else {
+        v.storage = TKN_HEAP;
+        v.str = pool ? pool_strndup(pool, s, len) : strndup(s, len);
+        if (!v.str) {
+            ERROR("Failed to allocate a string of %zu bytes", len + 1);
+        }
+    }
+    return v;
+}
+
+/**
+ * @brief Frees a value whose string was allocated from a pool (or with malloc if pool is NULL)
+ */
+void free_val(StrPool *pool, Value v){
+    if (v.type != VAL_STR || v.storage != TKN_HEAP) {
+        return;
+    }
+
+    if (pool) {
+        pool_free(pool, v.str);
+    } else {
+        free(v.str);
+    }
+}
+
+/**
+ * @brief Copies a value, allocating its string from a pool (or with malloc if pool is NULL)
+ */
+Value copy_val(StrPool *pool, const Value v){
+    if (v.type != VAL_STR || v.storage != TKN_HEAP) {
+        return v;
+    }
+    return str_val(pool, v.str, strlen(v.str));
+}
+
+bool val_eq(const Value a, const Value b){
+    if (a.type != b.type) {
+        return false;
+    }
+
+    switch (a.type) {
+        case VAL_STR:
+            return !strcmp(val_str(&a), val_str(&b));
+        case VAL_INT:
+            return a.i == b.i;
+        case VAL_DOUBLE:
+            return a.d == b.d;
+        default:
+            ERROR("Value type is invalid value '%d'", a.type);
+            return false;
+    }
+}
+
+/**
+ * @brief Gets the text of a value (as printed) without allocating
+ * 
+ * @param v The value
+ * @param buf Where to write the text of a number
+ * @return The text. For strings this is the string itself, otherwise buf.
+ */
+const char *val_text(const Value *v, char buf[VALUE_TEXT_SIZE]){
+    switch (v->type) {
+        case VAL_STR:
+            return val_str(v);
+        case VAL_INT:
+            snprintf(buf, VALUE_TEXT_SIZE, "%d", v->i);
+            return buf;
+        case VAL_DOUBLE:
+            snprintf(buf, VALUE_TEXT_SIZE, "%f", v->d);
+            return buf;
+        default:
+            ERROR("Bad value type %d", v->type);
+    }
+}
+
+/**
+ * @brief Writes the text of a value (as printed) straight into a buffer, without going
+ * through printf for ints
+ *
+ * @param dest Where to write the text, which is terminated
+ * @param size How much room there is at dest
+ * @return The length of the text, which is only all written if it is less than size
+ */
+size_t val_write(const Value *v, char *dest, size_t size){
+    switch (v->type) {
+        case VAL_STR: {
+            const char *str = val_str(v);
+            const size_t len = strlen(str);
+            if (len < size){
+                memcpy(dest, str, len + 1);
+            }
+            return len;
+        }
+        case VAL_INT: {
+            // Digits are made backwards, from an unsigned value so INT_MIN negates
+            char digits[16];
+            size_t n = 0;
+            unsigned int u = v->i < 0 ? 0u - (unsigned int) v->i : (unsigned int) v->i;
+            do {
+                digits[n++] = (char) ('0' + u % 10);
+                u /= 10;
+            } while (u);
+            if (v->i < 0){
+                digits[n++] = '-';
+            }
+            if (n < size){
+                for (size_t i = 0; i < n; i++){
+                    dest[i] = digits[n - 1 - i];
+                }
+                dest[n] = '\0';
+            }
+            return n;
+        }
+        case VAL_DOUBLE: {
+            const int len = snprintf(dest, size, "%f", v->d);
+            return len < 0 ? 0 : (size_t) len;
+        }
+        default:
+            ERROR("Bad value type %d", v->type);
+    }
+}
+
+/**
+ * @brief Applies a maths operator (one of `+ - * / %`) to two numbers.
+ * @details Two ints give an int (wrapping on overflow), otherwise a double.
+ *
+ * @param dest Where to write the result, unless there is an error
+ * @return MATHS_OK, or why the operation is invalid
+ */
+MathsResult val_maths(char o, const Value a, const Value b, Value *dest){
+    if (a.type == VAL_INT && b.type == VAL_INT){
+        const int x = a.i;
+        const int y = b.i;
+        switch (o) {
+            case '+':
+                *dest = int_val((int) ((unsigned int) x + (unsigned int) y));
+                return MATHS_OK;
+            case '-':
+                *dest = int_val((int) ((unsigned int) x - (unsigned int) y));
+                return MATHS_OK;
+            case '*':
+                *dest = int_val((int) ((unsigned int) x * (unsigned int) y));
+                return MATHS_OK;
+            case '/':
+            case '%':
+                if (y == 0){
+                    return MATHS_DIVIDE_BY_ZERO;
+                }
+                if (x == INT_MIN && y == -1){
+                    *dest = int_val(o == '/' ? INT_MIN : 0);
+                } else {
+                    *dest = int_val(o == '/' ? x / y : x % y);
+                }
+                return MATHS_OK;
+            default:
+                return MATHS_BAD_OPERATOR;
+        }
+    }
+
+    const double x = as_double(a);
+    const double y = as_double(b);
+    switch (o) {
+        case '+':
+            *dest = double_val(x + y);
+            return MATHS_OK;
+        case '-':
+            *dest = double_val(x - y);
+            return MATHS_OK;
+        case '*':
+            *dest = double_val(x * y);
+            return MATHS_OK;
+        case '/':
+            *dest = double_val(x / y);
+            return MATHS_OK;
+        case '%':
+            return MATHS_NOT_INTEGER;
+        default:
+            return MATHS_BAD_OPERATOR;
+    }
+}
+
+/**
+ * @brief Compares two values with a comparison operator (one of `= != < > <= >=`).
+ * @details Numbers compare numerically, anything else compares by its string form.
+ *
+ * @param dest Where to write the result (an int, 1 if true)
+ * @return 1 if the operator is invalid, else 0
+ */
+int val_compare(const Value op, const Value a, const Value b, Value *dest){
+    int c;
+    if (is_number(a) && is_number(b)){
+        const double x = as_double(a);
+        const double y = as_double(b);
+        c = (x > y) - (x < y);
+    } else {
+        char abuf[VALUE_TEXT_SIZE];
+        char bbuf[VALUE_TEXT_SIZE];
+        c = strcmp(val_text(&a, abuf), val_text(&b, bbuf));
+        c = (c > 0) - (c < 0);
+    }
+
+    const char *o = op.type == VAL_STR ? val_str(&op) : "";
+    if (!strcmp(o, "=")){
+        *dest = int_val(c == 0);
+    } else if (!strcmp(o, "!=")){
+        *dest = int_val(c != 0);
+    } else if (!strcmp(o, "<")){
+        *dest = int_val(c < 0);
+    } else if (!strcmp(o, ">")){
+        *dest = int_val(c > 0);
+    } else if (!strcmp(o, "<=")){
+        *dest = int_val(c <= 0);
+    } else if (!strcmp(o, ">=")){
+        *dest = int_val(c >= 0);
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+char *val2str(const Value v){
+    char buf[VALUE_TEXT_SIZE];
+    return strdup(val_text(&v, buf));
+}
@@ -0,0 +1,98 @@
+#ifndef __VALUE_H__
+#define __VALUE_H__
+
+#include "lex.h"
+#include "arena.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+// Longest strings (including the terminator) stored inline in a value
+#define VALUE_INLINE_SIZE 14
+
+// Large enough for the text of any number
+#define VALUE_TEXT_SIZE 512
+
+typedef enum {
+    VAL_STR,
+    VAL_INT,
+    VAL_DOUBLE
+} ValueType;
+
+/**
+ * A runtime value, as held in lists: a string, int or double in 16 bytes.
+ * Unlike tokens, values have no source position (instructions do).
+ *
+ * Short strings are stored inline, over the pointer and the padding after it, which is
+ * why type and storage are at the end.
+ */
+typedef struct {
+    union {
+        struct {
+            union {
+                char *str;
+                int i;
+                double d;
+            };
+            char pad[VALUE_INLINE_SIZE - sizeof(char *)];
+            // A ValueType
+            unsigned char type;
+            // A TokenStorage: where the string of a VAL_STR lives
+            unsigned char storage;
+        };
+        char inline_str[VALUE_INLINE_SIZE];
+    };
+} Value;
+
+_Static_assert(sizeof(Value) == 16, "Value should be 16 bytes");
+
+// The string of a VAL_STR value, wherever it is stored
+static inline const char *val_str(const Value *v){
+    return v->storage == TKN_INLINE ? v->inline_str : v->str;
+}
+
+static inline bool is_number(const Value v){
+    return v.type == VAL_INT || v.type == VAL_DOUBLE;
+}
+
+static inline double as_double(const Value v){
+    return v.type == VAL_INT ? (double) v.i : v.d;
+}
+
+static inline Value int_val(int i){
+    Value v = { .type = VAL_INT };
+    v.i = i;
+    return v;
+}
+
+static inline Value double_val(double d){
+    Value v = { .type = VAL_DOUBLE };
+    v.d = d;
+    return v;
+}
+
+static inline Value char_val(char c){
+    Value v = { .type = VAL_STR, .storage = TKN_INLINE };
+    v.inline_str[0] = c;
+    v.inline_str[1] = '\0';
+    return v;
+}
+
+typedef enum {
+    MATHS_OK,
+    MATHS_BAD_OPERATOR,
+    MATHS_DIVIDE_BY_ZERO,
+    // % of a double
+    MATHS_NOT_INTEGER
+} MathsResult;
+
+Value str_val(StrPool *pool, const char *s, size_t len);
+void free_val(StrPool *pool, Value v);
+Value copy_val(StrPool *pool, const Value v);
+bool val_eq(const Value a, const Value b);
+const char *val_text(const Value *v, char buf[VALUE_TEXT_SIZE]);
+size_t val_write(const Value *v, char *dest, size_t size);
+MathsResult val_maths(char o, const Value a, const Value b, Value *dest);
+int val_compare(const Value op, const Value a, const Value b, Value *dest);
+char *val2str(const Value v);
+
+#endif